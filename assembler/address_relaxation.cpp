@@ -0,0 +1,231 @@
+// The program counter has 16 bits, but values on the stacks only have 8. A jump goes to the address on top of
+// the evaluation stack in the page (256 bytes) it is in itself, unless `far` took a page off of the stack
+// right before it; `romload` works the same way.
+//
+// A program that fits in a single page is left exactly as it is, unless is_wide asks for the forms of a bigger
+// one anyway, see delay_synthesizer.cpp. A bigger one gets two byte return addresses on every `call` and `ret`,
+// and every jump or call whose target is pushed right before it and lies in another page gets `push <page>, far`
+// in front. `push <label>` pushes the offset of the label in its page, and a label in an expression is that offset
+// too, unless it is in low(x) or high(x). Making a jump far makes the code after it bigger, which can move other
+// targets into another page, so this repeats until no more jumps become far.
+// `romload` becomes far when there is data, see append_data.
+//
+// A jump with its target inline (see branch_fusion.cpp) is in the page of its opcode, not of its last byte.
+//
+// Computed jumps stay in their own page, so a label whose address is taken has to be in the first page, and so
+// does every jump or call whose target isn't pushed right before it. `ret` takes a two byte return address.
+
+const u64 PAGE_SIZE = 256;
+const u64 MAX_PROGRAM_SIZE = 0x10000;
+const char* DATA_LABEL = "__data";
+
+struct AddressRelaxationResult
+{
+    bool success;
+    String error;
+    Ast ast;
+    bool is_wide; // more than one page, with two byte return addresses
+    u64 far_nodes;
+};
+
+// the address of every node, and where the code ends at ast.size
+u64* get_relaxed_addresses(Ast ast)
+{
+    auto result = (u64*)malloc((ast.size + 1) * sizeof(u64));
+    u64 address = 0;
+    for (u64 i = 0; i < ast.size; i++)
+    {
+        result[i] = address;
+        address += ast.data[i].get_size();
+    }
+    result[ast.size] = address;
+    return result;
+}
+
+// `.byte` and `.table` data from split_data goes after all of the code, behind a jump around it if the
+// program would run into it otherwise. In a program of more than one page, the data starts at __data and
+// doesn't cross into another page, so a far `romload` only needs its page, see address_relaxation.cpp.
+Ast append_data(Ast ast, Ast data, bool is_wide)
+{
+    if (data.size == 0)
+    {
+        return ast;
+    }
+    auto result = Ast::allocate();
+    for (u64 i = 0; i < ast.size; i++)
+    {
+        result.push(ast.data[i]);
+    }
+    auto line = data.data[0].line;
+    auto needs_jump = ast.size == 0 || ast.data[ast.size-1].falls_through();
+    auto end_label = String::allocate();
+    end_label.push("__data_end");
+    if (needs_jump)
+    {
+        result.push(AstNode::make_push_label(end_label, line));
+        auto jump = AstNode::make(AstNodeTypeJmp, line);
+        jump.is_far = is_wide;
+        result.push(jump);
+    }
+    if (is_wide)
+    {
+        auto data_begin = result.get_size();
+        if (data_begin % PAGE_SIZE + data.get_size() > PAGE_SIZE)
+        {
+            for (auto i = data_begin % PAGE_SIZE; i < PAGE_SIZE; i++)
+            {
+                auto padding = AstNode::make(AstNodeTypeData, line);
+                padding.integer = 0;
+                result.push(padding);
+            }
+        }
+        auto data_label = String::allocate();
+        data_label.push(DATA_LABEL);
+        result.push(AstNode::make_label(data_label, line));
+    }
+    for (u64 i = 0; i < data.size; i++)
+    {
+        result.push(data.data[i]);
+    }
+    if (needs_jump)
+    {
+        result.push(AstNode::make_label(end_label, data.data[data.size-1].line));
+    }
+    return result;
+}
+
+AddressRelaxationResult relax_addresses(Ast ast, Ast data, bool is_wide)
+{
+    AddressRelaxationResult result;
+    result.success = true;
+    result.ast = Ast::allocate();
+    for (u64 i = 0; i < ast.size; i++)
+    {
+        result.ast.push(ast.data[i]);
+    }
+    ast = result.ast;
+    result.is_wide = false;
+    result.far_nodes = 0;
+
+    if (!is_wide && append_data(ast, data, false).get_size() <= PAGE_SIZE)
+    {
+        return result;
+    }
+
+    result.is_wide = true;
+    if (data.get_size() > PAGE_SIZE)
+    {
+        result.success = false;
+        result.error = String::allocate();
+        result.error.push("Data doesn't fit in a single page in a program bigger than 256 bytes");
+        return result;
+    }
+    for (u64 i = 0; i < ast.size; i++)
+    {
+        auto type = ast.data[i].type;
+        if (type == AstNodeTypeCall || type == AstNodeTypeRet)
+        {
+            ast.data[i].has_wide_return_address = true;
+        }
+        if (type == AstNodeTypeRomload && data.size != 0)
+        {
+            ast.data[i].is_far = true;
+        }
+        if (ast.data[i].is_far)
+        {
+            result.far_nodes++; // including the calls and jumps of the delays
+        }
+    }
+
+    u64* addresses;
+    bool has_changed = true;
+    while (has_changed)
+    {
+        has_changed = false;
+        addresses = get_relaxed_addresses(ast);
+        for (u64 i = 0; i < ast.size; i++)
+        {
+            auto node = &ast.data[i];
+            if (node->is_far || !node->is_jump() && node->type != AstNodeTypeCall)
+            {
+                continue;
+            }
+            auto target = ast.get_jump_target(i);
+            if (target == ast.size)
+            {
+                continue; // computed, or a label in the data
+            }
+            // the opcode of the jump is the last byte of the node, but for the bytes fuse_branches put after it
+            if ((addresses[i+1] - 1 - node->get_inline_size()) / PAGE_SIZE != addresses[target] / PAGE_SIZE)
+            {
+                node->is_far = true;
+                result.far_nodes++;
+                has_changed = true;
+            }
+        }
+        if (has_changed)
+        {
+            free(addresses);
+        }
+    }
+
+    auto size = append_data(ast, data, true).get_size();
+    if (size > MAX_PROGRAM_SIZE)
+    {
+        result.success = false;
+        result.error = String::allocate();
+        result.error.push("The program takes ");
+        result.error.push(size);
+        result.error.push(" bytes, but only 65536 fit in the ROM");
+        free(addresses);
+        return result;
+    }
+
+    for (u64 i = 0; i < ast.size; i++)
+    {
+        if (!ast.is_address_taken(i) || !ast.data[i].is_push_label())
+        {
+            continue;
+        }
+        auto label = ast.find_label(ast.data[i].label);
+        if (label != ast.size && addresses[label] >= PAGE_SIZE)
+        {
+            result.success = false;
+            result.error = String::allocate();
+            result.error.push("The address of ");
+            result.error.push(ast.data[i].label);
+            result.error.push(" doesn't fit in 8 bits on line ");
+            result.error.push(ast.data[i].line);
+            free(addresses);
+            return result;
+        }
+    }
+
+    for (u64 i = 0; i < ast.size; i++)
+    {
+        auto node = ast.data[i];
+        if (!node.is_jump() && node.type != AstNodeTypeCall || node.has_inline_target)
+        {
+            continue;
+        }
+        if (i != 0 && ast.data[i-1].is_push_label())
+        {
+            continue;
+        }
+        // a computed target is only an offset, which would be taken in the page of the jump
+        if (addresses[i+1] - 1 >= PAGE_SIZE)
+        {
+            result.success = false;
+            result.error = String::allocate();
+            result.error.push("A computed ");
+            result.error.push(node.type == AstNodeTypeCall ? "call" : "jump");
+            result.error.push(" has to be in the first page, but the one on line ");
+            result.error.push(node.line);
+            result.error.push(" isn't");
+            free(addresses);
+            return result;
+        }
+    }
+    free(addresses);
+    return result;
+}
@@ -20,13 +20,38 @@ enum AstNodeType
     AstNodeTypeLoad,
     AstNodeTypeCall,
     AstNodeTypeRet,
+    AstNodeTypeHalt,
+    AstNodeTypeRomload,
+    AstNodeTypeSub,
+    AstNodeTypeAnd,
+    AstNodeTypeOr,
+    AstNodeTypeXor,
+    AstNodeTypeShl,
+    AstNodeTypeShr,
+    AstNodeTypeMul,
+    AstNodeTypeMulh,
+    AstNodeTypeNot,
+    AstNodeTypeNeg,
+    AstNodeTypeEqz,
+    AstNodeTypeDelay, // lowered to calls of shared loop routines by lower_delays, clobbers the flags
     AstNodeTypeLabel,
+    AstNodeTypeData, // a byte of a `.byte` or `.table` line, kept apart from the code by split_data
 };
 
+const u64 MAX_DELAY_CYCLES = 0xFFFFFFFF;
+const u64 FAR_PREFIX_SIZE = 3; // push-far, see address_relaxation.cpp
+const u64 TAKEN_JUMP_PENALTY = 1; // the byte fetched after a jump is thrown away, see alu.vhd
+const u64 ROMLOAD_LATENCY = 1; // the ROM has the data a cycle after `romload` reads it
+
+// false for cores from before the native `call` and `ret`, which get them expanded, see --expand-calls
+bool has_native_calls = true;
+u64 get_delay_size(u64 cycles); // delay_synthesizer.cpp
+
 enum PushNodeType
 {
     PushNodeTypeInteger,
     PushNodeTypeLabel,
+    PushNodeTypeExpression, // refers to labels, so it can only be evaluated after layout
 };
 
 struct AstNode
@@ -38,10 +63,23 @@ struct AstNode
     PushNodeType push_type;
     union
     {
-        u8 integer;
+        u8 integer; // also the byte of AstNodeTypeData
         String label;
+        Expression* expression;
     };
 
+    // only for AstNodeTypeDelay
+    u64 delay_cycles;
+
+    // set by relax_addresses for programs that don't fit in 256 bytes, and by lower_delays for its own nodes
+    bool is_far = false; // jumps, `call` and `romload`: the page of the address is set with `push <page>, far`
+    bool has_wide_return_address = false; // `call` and `ret`: two bytes on the general stack
+
+    // set by fuse_branches, see branch_fusion.cpp
+    bool is_inlined = false; // a `push` or `cmp` whose byte(s) the jump after it carries
+    bool has_inline_target = false; // jumps and native calls: the `push` right before is folded in
+    bool has_inline_compare = false; // conditional jumps: so is the `push X, cmp` before that
+
     String to_string()
     {
         auto result = String::allocate();
@@ -61,10 +99,14 @@ struct AstNode
                         result.push(buffer[i]);
                     }
                 }
-                else // PushNodeTypeLabel
+                else if (push_type == PushNodeTypeLabel)
                 {
                     result.push(label);
                 }
+                else // PushNodeTypeExpression
+                {
+                    expression->print_to(&result);
+                }
                 break;
             case AstNodeTypePop:
                 result.push("pop");
@@ -120,9 +162,290 @@ struct AstNode
             case AstNodeTypeRet:
                 result.push("ret");
                 break;
+            case AstNodeTypeHalt:
+                result.push("halt");
+                break;
+            case AstNodeTypeRomload:
+                result.push("romload");
+                break;
+            case AstNodeTypeSub:
+                result.push("sub");
+                break;
+            case AstNodeTypeAnd:
+                result.push("and");
+                break;
+            case AstNodeTypeOr:
+                result.push("or");
+                break;
+            case AstNodeTypeXor:
+                result.push("xor");
+                break;
+            case AstNodeTypeShl:
+                result.push("shl");
+                break;
+            case AstNodeTypeShr:
+                result.push("shr");
+                break;
+            case AstNodeTypeMul:
+                result.push("mul");
+                break;
+            case AstNodeTypeMulh:
+                result.push("mulh");
+                break;
+            case AstNodeTypeNot:
+                result.push("not");
+                break;
+            case AstNodeTypeNeg:
+                result.push("neg");
+                break;
+            case AstNodeTypeEqz:
+                result.push("eqz");
+                break;
+            case AstNodeTypeDelay:
+                result.push("delay ");
+                result.push(delay_cycles);
+                break;
+            case AstNodeTypeLabel:
+                break;
+            case AstNodeTypeData:
+                result.push(".byte ");
+                result.push((u64)integer);
+                break;
+        }
+        return result;
+    }
+
+    // size of the node in the ROM after compile_to_binary
+    u64 get_size()
+    {
+        if (is_inlined)
+        {
+            return 0;
+        }
+        switch (type)
+        {
+            case AstNodeTypePush:
+                return 2;
+            case AstNodeTypeCall: // native with the target inline, otherwise push-store-jmp or push-store-push-store-jmp
+                if (has_inline_target)
+                {
+                    return 1 + get_inline_size() + (is_far ? FAR_PREFIX_SIZE : 0);
+                }
+                return (has_wide_return_address ? 7 : 4) + (is_far ? FAR_PREFIX_SIZE : 0);
+            case AstNodeTypeRet: // native, otherwise load-jmp or load-load-far-jmp
+                if (has_native_calls)
+                {
+                    return 1;
+                }
+                return has_wide_return_address ? 4 : 2;
+            case AstNodeTypeDelay:
+                return get_delay_size(delay_cycles);
             case AstNodeTypeLabel:
+                return 0;
+            default:
+                return 1 + get_inline_size() + (is_far ? FAR_PREFIX_SIZE : 0);
+        }
+    }
+
+    // bytes after the opcode of a jump that fuse_branches folded the nodes before it into
+    u64 get_inline_size()
+    {
+        return (has_inline_target ? 1 : 0) + (has_inline_compare ? 1 : 0);
+    }
+
+    // the ALU consumes one byte per clock cycle, so `push` takes two cycles, plus a cycle for every jump that is
+    // taken. `jmp`, `call` and `ret` always jump, a conditional jump is counted as not taken here and the timing
+    // analysis adds the penalty to the edge to its target.
+    u64 get_cycles()
+    {
+        if (type == AstNodeTypeDelay)
+        {
+            return delay_cycles;
+        }
+        if (type == AstNodeTypeJmp || type == AstNodeTypeCall || type == AstNodeTypeRet)
+        {
+            return get_size() + TAKEN_JUMP_PENALTY;
+        }
+        if (type == AstNodeTypeRomload)
+        {
+            return get_size() + ROMLOAD_LATENCY;
+        }
+        return get_size();
+    }
+
+    // bytes of a return address on the general stack
+    u64 get_return_address_size()
+    {
+        return has_wide_return_address ? 2 : 1;
+    }
+
+    // how far above its depth before it the evaluation stack gets while it runs: an expanded `call` or `ret` moves
+    // the return address through it, and the far prefix pushes a page
+    u64 get_transient_evaluation_depth()
+    {
+        if (type == AstNodeTypeRet)
+        {
+            return has_native_calls ? 0 : get_return_address_size();
+        }
+        return type == AstNodeTypeCall && !has_inline_target || is_far ? 1 : 0;
+    }
+
+    // add and sub to mulh take two operands, the one on top on the right, not to eqz take one
+    bool is_binary_operation()
+    {
+        return type == AstNodeTypeAdd || type >= AstNodeTypeSub && type <= AstNodeTypeMulh;
+    }
+
+    bool is_unary_operation()
+    {
+        return type >= AstNodeTypeNot && type <= AstNodeTypeEqz;
+    }
+
+    // what alu.vhd computes for one of the operations, right is ignored by the unary ones
+    u8 compute(u8 left, u8 right)
+    {
+        switch (type)
+        {
+            case AstNodeTypeAdd: return left + right;
+            case AstNodeTypeSub: return left - right;
+            case AstNodeTypeAnd: return left & right;
+            case AstNodeTypeOr: return left | right;
+            case AstNodeTypeXor: return left ^ right;
+            case AstNodeTypeShl: return right < 8 ? left << right : 0;
+            case AstNodeTypeShr: return right < 8 ? left >> right : 0;
+            case AstNodeTypeMul: return left * right;
+            case AstNodeTypeMulh: return (left * right) >> 8;
+            case AstNodeTypeNot: return ~left;
+            case AstNodeTypeNeg: return -left;
+            case AstNodeTypeEqz: return left == 0 ? 1 : 0;
+            default:
+                panic("Not an operation");
+                return 0;
+        }
+    }
+
+    bool is_jump()
+    {
+        return type >= AstNodeTypeJl && type <= AstNodeTypeJmp;
+    }
+
+    // whether the node right after this one can run next
+    bool falls_through()
+    {
+        return type != AstNodeTypeJmp && type != AstNodeTypeRet && type != AstNodeTypeHalt;
+    }
+
+    bool is_push_integer()
+    {
+        return type == AstNodeTypePush && push_type == PushNodeTypeInteger;
+    }
+
+    bool is_push_label()
+    {
+        return type == AstNodeTypePush && push_type == PushNodeTypeLabel;
+    }
+
+    bool is_push_expression()
+    {
+        return type == AstNodeTypePush && push_type == PushNodeTypeExpression;
+    }
+
+    // how many values the node takes off of the evaluation stack and how many it puts back,
+    // not counting what a called function does
+    void get_stack_effect(u64* pops, u64* pushes)
+    {
+        *pops = 0;
+        *pushes = 0;
+        switch (type)
+        {
+            case AstNodeTypePush:
+            case AstNodeTypePushNothing:
+            case AstNodeTypeLoad:
+                *pushes = 1;
+                break;
+            case AstNodeTypePop:
+            case AstNodeTypeStore:
+            case AstNodeTypeCall:
+                *pops = 1;
+                break;
+            case AstNodeTypeAdd:
+            case AstNodeTypeSub:
+            case AstNodeTypeAnd:
+            case AstNodeTypeOr:
+            case AstNodeTypeXor:
+            case AstNodeTypeShl:
+            case AstNodeTypeShr:
+            case AstNodeTypeMul:
+            case AstNodeTypeMulh:
+            case AstNodeTypeDdup:
+                *pops = 2;
+                *pushes = 1;
+                break;
+            case AstNodeTypeRomload:
+            case AstNodeTypeNot:
+            case AstNodeTypeNeg:
+            case AstNodeTypeEqz:
+                *pops = 1;
+                *pushes = 1;
+                break;
+            case AstNodeTypeCmp:
+            case AstNodeTypeOut:
+                *pops = 2;
+                break;
+            case AstNodeTypeDup:
+                *pops = 1;
+                *pushes = 2;
+                break;
+            default:
+                if (is_jump())
+                {
+                    *pops = 1;
+                }
                 break;
         }
+    }
+
+    // every label whose address ends up in the operand of this node
+    void collect_referenced_labels(Strings* labels)
+    {
+        if (is_push_label())
+        {
+            labels->push(label);
+        }
+        else if (is_push_expression())
+        {
+            expression->collect_labels(labels);
+        }
+    }
+
+    static AstNode make(AstNodeType type, u64 line)
+    {
+        AstNode result;
+        result.type = type;
+        result.line = line;
+        return result;
+    }
+
+    static AstNode make_push_integer(u8 integer, u64 line)
+    {
+        auto result = make(AstNodeTypePush, line);
+        result.push_type = PushNodeTypeInteger;
+        result.integer = integer;
+        return result;
+    }
+
+    static AstNode make_push_label(String label, u64 line)
+    {
+        auto result = make(AstNodeTypePush, line);
+        result.push_type = PushNodeTypeLabel;
+        result.label = label;
+        return result;
+    }
+
+    static AstNode make_label(String label, u64 line)
+    {
+        auto result = make(AstNodeTypeLabel, line);
+        result.label = label;
         return result;
     }
 };
@@ -154,6 +477,195 @@ struct Ast
         data[size] = node;
         size++;
     }
+
+    void insert(u64 index, AstNode node)
+    {
+        push(node);
+        memmove(data + index + 1, data + index, (size - index - 1) * sizeof(AstNode));
+        data[index] = node;
+    }
+
+    void remove(u64 index, u64 count = 1)
+    {
+        memmove(data + index, data + index + count, (size - index - count) * sizeof(AstNode));
+        size -= count;
+    }
+
+    u64 get_size()
+    {
+        return get_size_between(0, size);
+    }
+
+    u64 get_size_between(u64 begin, u64 end)
+    {
+        u64 result = 0;
+        for (u64 i = begin; i < end; i++)
+        {
+            result += data[i].get_size();
+        }
+        return result;
+    }
+
+    u64 get_cycles()
+    {
+        return get_cycles_between(0, size);
+    }
+
+    u64 get_cycles_between(u64 begin, u64 end)
+    {
+        u64 result = 0;
+        for (u64 i = begin; i < end; i++)
+        {
+            result += data[i].get_cycles();
+        }
+        return result;
+    }
+
+    bool contains(AstNodeType type)
+    {
+        for (u64 i = 0; i < size; i++)
+        {
+            if (data[i].type == type)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // returns size if the label is not defined
+    u64 find_label(String label)
+    {
+        for (u64 i = 0; i < size; i++)
+        {
+            if (data[i].type == AstNodeTypeLabel && data[i].label == label)
+            {
+                return i;
+            }
+        }
+        return size;
+    }
+
+    // index of the label a jump at index goes to, when the target is pushed right before the jump,
+    // returns size for computed jumps
+    u64 get_jump_target(u64 index)
+    {
+        if (index != 0 && data[index-1].is_push_label())
+        {
+            return find_label(data[index-1].label);
+        }
+        return size;
+    }
+
+    // the node at index pushes a label for anything other than a jump or a call right after it,
+    // so that label might be jumped to from anywhere
+    bool is_address_taken(u64 index)
+    {
+        if (data[index].is_push_expression())
+        {
+            return true;
+        }
+        if (!data[index].is_push_label())
+        {
+            return false;
+        }
+        if (index + 1 == size)
+        {
+            return true;
+        }
+        auto next = data[index+1];
+        return !next.is_jump() && next.type != AstNodeTypeCall;
+    }
+
+    // where code that is only ever called or jumped to can go: after the last `jmp`, `ret` or `halt`, so
+    // nothing falls through into it, or size + 1 if the program runs off the end and it needs a jump around it
+    u64 find_append_point()
+    {
+        for (auto i = size; i != 0; i--)
+        {
+            if (!data[i-1].falls_through())
+            {
+                return i;
+            }
+        }
+        return size + 1;
+    }
+
+    // index of the first instruction at or after index, skipping labels
+    u64 skip_labels(u64 index)
+    {
+        while (index != size && data[index].type == AstNodeTypeLabel)
+        {
+            index++;
+        }
+        return index;
+    }
+};
+
+// `.bound` and `.deadline` lines in front of a label, for the timing analyzer
+struct TimingAnnotation
+{
+    String label;
+    u64 line;
+    bool has_bound; // the loop with this header runs its body between min_iterations and max_iterations times
+    u64 min_iterations;
+    u64 max_iterations;
+    bool has_deadline; // the function starting here, or one iteration of the loop, never takes longer
+    u64 deadline;
+
+    static TimingAnnotation make(u64 line)
+    {
+        TimingAnnotation result;
+        result.line = line;
+        result.has_bound = false;
+        result.min_iterations = 0;
+        result.max_iterations = 0;
+        result.has_deadline = false;
+        result.deadline = 0;
+        return result;
+    }
+};
+
+struct TimingAnnotations
+{
+    u64 capacity;
+    u64 size;
+    TimingAnnotation* data;
+
+    static const u64 DEFAULT_CAPACITY = 8;
+
+    static TimingAnnotations allocate()
+    {
+        TimingAnnotations result;
+        result.capacity = DEFAULT_CAPACITY;
+        result.size = 0;
+        result.data = (TimingAnnotation*)malloc(result.capacity * sizeof(TimingAnnotation));
+        return result;
+    }
+
+    void push(TimingAnnotation annotation)
+    {
+        if (size == capacity)
+        {
+            capacity *= 2;
+            data = (TimingAnnotation*)realloc(data, capacity * sizeof(TimingAnnotation));
+        }
+        data[size] = annotation;
+        size++;
+    }
+
+    // returns size if the label has no annotation
+    u64 find(String label)
+    {
+        for (u64 i = 0; i < size; i++)
+        {
+            if (data[i].label == label)
+            {
+                return i;
+            }
+        }
+        return size;
+    }
 };
 
 struct CheckLabelsResult
@@ -169,6 +681,11 @@ struct AstParsingState
     Ast ast;
     Strings registered_labels;
     Strings labels_to_check;
+    bool failed;
+    String error;
+    TimingAnnotations annotations;
+    bool has_pending_annotation;
+    TimingAnnotation pending_annotation;
 
     bool skip_new_lines()
     {
@@ -197,34 +714,77 @@ struct AstParsingState
         return true;
     }
 
+    bool fail(const char* message, u64 line)
+    {
+        failed = true;
+        error = String::allocate();
+        error.push(message);
+        error.push(" on line ");
+        error.push(line);
+        return false;
+    }
+
+    // index of the new line token that ends the current line
+    u64 find_line_end()
+    {
+        auto result = token_index;
+        while (result != tokens.size && tokens.data[result].type != TokenTypeNewLine)
+        {
+            result++;
+        }
+        return result;
+    }
+
     bool parse_push()
     {
-        if (token_index > tokens.size-3
-            || tokens.data[token_index].type != TokenTypeName || tokens.data[token_index].name != "push"
-            || tokens.data[token_index+1].type != TokenTypeInteger && tokens.data[token_index+1].type != TokenTypeName
-            || tokens.data[token_index+2].type != TokenTypeNewLine)
+        auto line_end = find_line_end();
+        if (line_end == tokens.size || line_end < token_index + 2
+            || tokens.data[token_index].type != TokenTypeName || tokens.data[token_index].name != "push")
         {
             return false;
         }
         AstNode push_node;
         push_node.type = AstNodeTypePush;
         push_node.line = tokens.data[token_index].line;
-        if (tokens.data[token_index+1].type == TokenTypeInteger)
+
+        auto expression = parse_expression(tokens, token_index + 1, line_end);
+        if (expression == NULL)
         {
-            push_node.push_type = PushNodeTypeInteger;
-            push_node.integer = tokens.data[token_index+1].integer;
+            return fail("Invalid expression", push_node.line);
         }
-        else // TokenTypeName
+
+        if (expression->type == ExpressionTypeLabel)
         {
             push_node.push_type = PushNodeTypeLabel;
-            push_node.label = tokens.data[token_index+1].name.copy();
+            push_node.label = expression->label.copy();
             if (!registered_labels.contains(push_node.label))
             {
                 labels_to_check.push(push_node.label);
             }
         }
+        else if (expression->references_labels())
+        {
+            push_node.push_type = PushNodeTypeExpression;
+            push_node.expression = expression;
+            expression->collect_labels(&labels_to_check);
+        }
+        else
+        {
+            auto evaluation = evaluate_expression(expression, NULL);
+            if (!evaluation.success)
+            {
+                evaluation.error.make_c_string();
+                return fail(evaluation.error.data, push_node.line);
+            }
+            if (!fits_in_byte(evaluation.value))
+            {
+                return fail("Value doesn't fit in 8 bits", push_node.line);
+            }
+            push_node.push_type = PushNodeTypeInteger;
+            push_node.integer = (u8)evaluation.value;
+        }
         ast.push(push_node);
-        token_index += 3;
+        token_index = line_end + 1;
         return true;
     }
 
@@ -516,6 +1076,373 @@ struct AstParsingState
         return true;
     }
 
+    bool parse_halt()
+    {
+        if (token_index > tokens.size-2
+            || tokens.data[token_index].type != TokenTypeName || tokens.data[token_index].name != "halt"
+            || tokens.data[token_index+1].type != TokenTypeNewLine)
+        {
+            return false;
+        }
+        AstNode halt_node;
+        halt_node.type = AstNodeTypeHalt;
+        halt_node.line = tokens.data[token_index].line;
+        ast.push(halt_node);
+        token_index += 2;
+        return true;
+    }
+
+    // a constant expression between begin and end, fails if it's missing or refers to labels
+    bool parse_constant(u64 begin, u64 end, u64 line, s64* value)
+    {
+        auto expression = begin < end ? parse_expression(tokens, begin, end) : NULL;
+        if (expression == NULL)
+        {
+            return fail("Invalid expression", line);
+        }
+        if (expression->references_labels())
+        {
+            return fail("Expected a constant", line);
+        }
+        auto evaluation = evaluate_expression(expression, NULL);
+        if (!evaluation.success)
+        {
+            evaluation.error.make_c_string();
+            return fail(evaluation.error.data, line);
+        }
+        *value = evaluation.value;
+        return true;
+    }
+
+    bool parse_romload()
+    {
+        if (token_index > tokens.size-2
+            || tokens.data[token_index].type != TokenTypeName || tokens.data[token_index].name != "romload"
+            || tokens.data[token_index+1].type != TokenTypeNewLine)
+        {
+            return false;
+        }
+        AstNode romload_node;
+        romload_node.type = AstNodeTypeRomload;
+        romload_node.line = tokens.data[token_index].line;
+        ast.push(romload_node);
+        token_index += 2;
+        return true;
+    }
+
+    bool parse_sub()
+    {
+        if (token_index > tokens.size-2
+            || tokens.data[token_index].type != TokenTypeName || tokens.data[token_index].name != "sub"
+            || tokens.data[token_index+1].type != TokenTypeNewLine)
+        {
+            return false;
+        }
+        AstNode sub_node;
+        sub_node.type = AstNodeTypeSub;
+        sub_node.line = tokens.data[token_index].line;
+        ast.push(sub_node);
+        token_index += 2;
+        return true;
+    }
+
+    bool parse_and()
+    {
+        if (token_index > tokens.size-2
+            || tokens.data[token_index].type != TokenTypeName || tokens.data[token_index].name != "and"
+            || tokens.data[token_index+1].type != TokenTypeNewLine)
+        {
+            return false;
+        }
+        AstNode and_node;
+        and_node.type = AstNodeTypeAnd;
+        and_node.line = tokens.data[token_index].line;
+        ast.push(and_node);
+        token_index += 2;
+        return true;
+    }
+
+    bool parse_or()
+    {
+        if (token_index > tokens.size-2
+            || tokens.data[token_index].type != TokenTypeName || tokens.data[token_index].name != "or"
+            || tokens.data[token_index+1].type != TokenTypeNewLine)
+        {
+            return false;
+        }
+        AstNode or_node;
+        or_node.type = AstNodeTypeOr;
+        or_node.line = tokens.data[token_index].line;
+        ast.push(or_node);
+        token_index += 2;
+        return true;
+    }
+
+    bool parse_xor()
+    {
+        if (token_index > tokens.size-2
+            || tokens.data[token_index].type != TokenTypeName || tokens.data[token_index].name != "xor"
+            || tokens.data[token_index+1].type != TokenTypeNewLine)
+        {
+            return false;
+        }
+        AstNode xor_node;
+        xor_node.type = AstNodeTypeXor;
+        xor_node.line = tokens.data[token_index].line;
+        ast.push(xor_node);
+        token_index += 2;
+        return true;
+    }
+
+    bool parse_shl()
+    {
+        if (token_index > tokens.size-2
+            || tokens.data[token_index].type != TokenTypeName || tokens.data[token_index].name != "shl"
+            || tokens.data[token_index+1].type != TokenTypeNewLine)
+        {
+            return false;
+        }
+        AstNode shl_node;
+        shl_node.type = AstNodeTypeShl;
+        shl_node.line = tokens.data[token_index].line;
+        ast.push(shl_node);
+        token_index += 2;
+        return true;
+    }
+
+    bool parse_shr()
+    {
+        if (token_index > tokens.size-2
+            || tokens.data[token_index].type != TokenTypeName || tokens.data[token_index].name != "shr"
+            || tokens.data[token_index+1].type != TokenTypeNewLine)
+        {
+            return false;
+        }
+        AstNode shr_node;
+        shr_node.type = AstNodeTypeShr;
+        shr_node.line = tokens.data[token_index].line;
+        ast.push(shr_node);
+        token_index += 2;
+        return true;
+    }
+
+    bool parse_mul()
+    {
+        if (token_index > tokens.size-2
+            || tokens.data[token_index].type != TokenTypeName || tokens.data[token_index].name != "mul"
+            || tokens.data[token_index+1].type != TokenTypeNewLine)
+        {
+            return false;
+        }
+        AstNode mul_node;
+        mul_node.type = AstNodeTypeMul;
+        mul_node.line = tokens.data[token_index].line;
+        ast.push(mul_node);
+        token_index += 2;
+        return true;
+    }
+
+    bool parse_mulh()
+    {
+        if (token_index > tokens.size-2
+            || tokens.data[token_index].type != TokenTypeName || tokens.data[token_index].name != "mulh"
+            || tokens.data[token_index+1].type != TokenTypeNewLine)
+        {
+            return false;
+        }
+        AstNode mulh_node;
+        mulh_node.type = AstNodeTypeMulh;
+        mulh_node.line = tokens.data[token_index].line;
+        ast.push(mulh_node);
+        token_index += 2;
+        return true;
+    }
+
+    bool parse_not()
+    {
+        if (token_index > tokens.size-2
+            || tokens.data[token_index].type != TokenTypeName || tokens.data[token_index].name != "not"
+            || tokens.data[token_index+1].type != TokenTypeNewLine)
+        {
+            return false;
+        }
+        AstNode not_node;
+        not_node.type = AstNodeTypeNot;
+        not_node.line = tokens.data[token_index].line;
+        ast.push(not_node);
+        token_index += 2;
+        return true;
+    }
+
+    bool parse_neg()
+    {
+        if (token_index > tokens.size-2
+            || tokens.data[token_index].type != TokenTypeName || tokens.data[token_index].name != "neg"
+            || tokens.data[token_index+1].type != TokenTypeNewLine)
+        {
+            return false;
+        }
+        AstNode neg_node;
+        neg_node.type = AstNodeTypeNeg;
+        neg_node.line = tokens.data[token_index].line;
+        ast.push(neg_node);
+        token_index += 2;
+        return true;
+    }
+
+    bool parse_eqz()
+    {
+        if (token_index > tokens.size-2
+            || tokens.data[token_index].type != TokenTypeName || tokens.data[token_index].name != "eqz"
+            || tokens.data[token_index+1].type != TokenTypeNewLine)
+        {
+            return false;
+        }
+        AstNode eqz_node;
+        eqz_node.type = AstNodeTypeEqz;
+        eqz_node.line = tokens.data[token_index].line;
+        ast.push(eqz_node);
+        token_index += 2;
+        return true;
+    }
+
+    bool parse_delay()
+    {
+        auto line_end = find_line_end();
+        if (line_end == tokens.size || line_end < token_index + 2
+            || tokens.data[token_index].type != TokenTypeName || tokens.data[token_index].name != "delay")
+        {
+            return false;
+        }
+        AstNode delay_node;
+        delay_node.type = AstNodeTypeDelay;
+        delay_node.line = tokens.data[token_index].line;
+
+        s64 cycles;
+        if (!parse_constant(token_index + 1, line_end, delay_node.line, &cycles))
+        {
+            return false;
+        }
+        if (cycles < 0 || (u64)cycles > MAX_DELAY_CYCLES)
+        {
+            return fail("Delay is out of range", delay_node.line);
+        }
+        delay_node.delay_cycles = (u64)cycles;
+        ast.push(delay_node);
+        token_index = line_end + 1;
+        return true;
+    }
+
+    // `.byte VALUE, ...`, or `.table NAME, VALUE, ...` for a label followed by its bytes,
+    // one data node for every value
+    bool parse_data()
+    {
+        auto line_end = find_line_end();
+        if (line_end == tokens.size || tokens.data[token_index].type != TokenTypeDirective
+            || tokens.data[token_index].name != "byte" && tokens.data[token_index].name != "table")
+        {
+            return false;
+        }
+        auto line = tokens.data[token_index].line;
+        auto begin = token_index + 1;
+        if (tokens.data[token_index].name == "table")
+        {
+            if (begin + 1 >= line_end || tokens.data[begin].type != TokenTypeName
+                || tokens.data[begin+1].type != TokenTypeComma)
+            {
+                return fail("Expected a table name", line);
+            }
+            auto label_node = AstNode::make_label(tokens.data[begin].name.copy(), line);
+            ast.push(label_node);
+            registered_labels.push(label_node.label);
+            begin += 2;
+        }
+        while (true)
+        {
+            auto end = begin;
+            while (end != line_end && tokens.data[end].type != TokenTypeComma)
+            {
+                end++;
+            }
+            s64 value;
+            if (!parse_constant(begin, end, line, &value))
+            {
+                return false;
+            }
+            if (!fits_in_byte(value))
+            {
+                return fail("Value doesn't fit in 8 bits", line);
+            }
+            auto data_node = AstNode::make(AstNodeTypeData, line);
+            data_node.integer = (u8)value;
+            ast.push(data_node);
+
+            if (end == line_end)
+            {
+                break;
+            }
+            begin = end + 1;
+        }
+        token_index = line_end + 1;
+        return true;
+    }
+
+    // `.bound [MIN,] MAX` or `.deadline CYCLES`, kept until the next label
+    bool parse_timing_annotation()
+    {
+        auto line_end = find_line_end();
+        if (line_end == tokens.size || tokens.data[token_index].type != TokenTypeDirective
+            || tokens.data[token_index].name != "bound" && tokens.data[token_index].name != "deadline")
+        {
+            return false;
+        }
+        auto line = tokens.data[token_index].line;
+        if (!has_pending_annotation)
+        {
+            pending_annotation = TimingAnnotation::make(line);
+            has_pending_annotation = true;
+        }
+
+        if (tokens.data[token_index].name == "deadline")
+        {
+            s64 deadline;
+            if (!parse_constant(token_index + 1, line_end, line, &deadline))
+            {
+                return false;
+            }
+            if (deadline < 0 || pending_annotation.has_deadline)
+            {
+                return fail("Invalid deadline", line);
+            }
+            pending_annotation.has_deadline = true;
+            pending_annotation.deadline = (u64)deadline;
+        }
+        else
+        {
+            auto comma = token_index + 1;
+            while (comma != line_end && tokens.data[comma].type != TokenTypeComma)
+            {
+                comma++;
+            }
+            s64 min_iterations = 0;
+            s64 max_iterations;
+            if (comma != line_end && !parse_constant(token_index + 1, comma, line, &min_iterations)
+                || !parse_constant(comma == line_end ? token_index + 1 : comma + 1, line_end, line, &max_iterations))
+            {
+                return false;
+            }
+            if (min_iterations < 0 || max_iterations < min_iterations || pending_annotation.has_bound)
+            {
+                return fail("Invalid loop bound", line);
+            }
+            pending_annotation.has_bound = true;
+            pending_annotation.min_iterations = (u64)min_iterations;
+            pending_annotation.max_iterations = (u64)max_iterations;
+        }
+        token_index = line_end + 1;
+        return true;
+    }
+
     bool parse_label()
     {
         if (token_index > tokens.size-3
@@ -531,6 +1458,12 @@ struct AstParsingState
         label_node.label = tokens.data[token_index].name.copy();
         ast.push(label_node);
         registered_labels.push(label_node.label);
+        if (has_pending_annotation)
+        {
+            pending_annotation.label = label_node.label;
+            annotations.push(pending_annotation);
+            has_pending_annotation = false;
+        }
         token_index += 3;
         return true;
     }
@@ -557,9 +1490,33 @@ struct AstParsingResult
 {
     bool success;
     Ast ast;
+    Ast data; // see split_data
+    TimingAnnotations annotations;
     String error;
 };
 
+// Data is never executed, so it is kept out of the code the optimizer and the analyses work on, and
+// append_data puts it after all of the code. Code around a table continues as if the table weren't there.
+// Labels right in front of data belong to the data.
+void split_data(Ast ast, Ast* code, Ast* data)
+{
+    *code = Ast::allocate();
+    *data = Ast::allocate();
+    for (u64 i = 0; i < ast.size; i++)
+    {
+        auto first = ast.skip_labels(i);
+        auto is_data = first != ast.size && ast.data[first].type == AstNodeTypeData;
+        for (; i < first; i++)
+        {
+            (is_data ? data : code)->push(ast.data[i]);
+        }
+        if (i != ast.size)
+        {
+            (is_data ? data : code)->push(ast.data[i]);
+        }
+    }
+}
+
 AstParsingResult parse_ast(Tokens tokens)
 {
     AstParsingState state;
@@ -568,9 +1525,13 @@ AstParsingResult parse_ast(Tokens tokens)
     state.ast = Ast::allocate();
     state.registered_labels = Strings::allocate();
     state.labels_to_check = Strings::allocate();
+    state.failed = false;
+    state.annotations = TimingAnnotations::allocate();
+    state.has_pending_annotation = false;
 
     while (state.token_index != tokens.size)
     {
+        auto size_before = state.ast.size;
         if (
             state.skip_new_lines()
                 || state.parse_nop()
@@ -593,20 +1554,55 @@ AstParsingResult parse_ast(Tokens tokens)
                 || state.parse_load()
                 || state.parse_call()
                 || state.parse_ret()
+                || state.parse_halt()
+                || state.parse_romload()
+                || state.parse_sub()
+                || state.parse_and()
+                || state.parse_or()
+                || state.parse_xor()
+                || state.parse_shl()
+                || state.parse_shr()
+                || state.parse_mul()
+                || state.parse_mulh()
+                || state.parse_not()
+                || state.parse_neg()
+                || state.parse_eqz()
+                || state.parse_delay()
+                || state.parse_data()
+                || state.parse_timing_annotation()
                 || state.parse_label()
         )
         {
+            if (state.has_pending_annotation && state.ast.size != size_before)
+            {
+                break; // annotations only go right before a label
+            }
             continue;
         }
 
         AstParsingResult result;
         result.success = false;
+        if (state.failed)
+        {
+            result.error = state.error;
+            return result;
+        }
         result.error = String::allocate();
         result.error.push("Expected a valid instruction on line ");
         result.error.push(state.tokens.data[state.token_index].line);
         return result;
     }
 
+    if (state.has_pending_annotation)
+    {
+        AstParsingResult result;
+        result.success = false;
+        result.error = String::allocate();
+        result.error.push("Expected a label after the annotation on line ");
+        result.error.push(state.pending_annotation.line);
+        return result;
+    }
+
     auto check_labels_result = state.check_labels();
     if (!check_labels_result.all_good)
     {
@@ -623,6 +1619,7 @@ AstParsingResult parse_ast(Tokens tokens)
 
     AstParsingResult result;
     result.success = true;
-    result.ast = state.ast;
+    split_data(state.ast, &result.ast, &result.data);
+    result.annotations = state.annotations;
     return result;
 }
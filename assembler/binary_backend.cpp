@@ -18,8 +18,46 @@ enum InstructionOpCode : u8
     InstructionOpCodeDdup = 15,
     InstructionOpCodeStore = 16,
     InstructionOpCodeLoad = 17,
+    InstructionOpCodeHalt = 18,
+    InstructionOpCodeRomload = 19,
+    InstructionOpCodeFar = 20,
+    // with inline operands, see branch_fusion.cpp
+    InstructionOpCodeCmpJl = 21,
+    InstructionOpCodeCmpJle = 22,
+    InstructionOpCodeCmpJeq = 23,
+    InstructionOpCodeCmpJge = 24,
+    InstructionOpCodeCmpJg = 25,
+    InstructionOpCodeCmpJne = 26,
+    InstructionOpCodeJlInline = 27,
+    InstructionOpCodeJleInline = 28,
+    InstructionOpCodeJeqInline = 29,
+    InstructionOpCodeJgeInline = 30,
+    InstructionOpCodeJgInline = 31,
+    InstructionOpCodeJneInline = 32,
+    InstructionOpCodeJmpInline = 33,
+    InstructionOpCodeSub = 34,
+    InstructionOpCodeAnd = 35,
+    InstructionOpCodeOr = 36,
+    InstructionOpCodeXor = 37,
+    InstructionOpCodeShl = 38,
+    InstructionOpCodeShr = 39,
+    InstructionOpCodeNot = 40,
+    InstructionOpCodeNeg = 41,
+    InstructionOpCodeEqz = 42,
+    InstructionOpCodeMul = 43,
+    InstructionOpCodeMulh = 44,
+    // with the target inline, the return address on the general stack is one byte or, when wide, two
+    InstructionOpCodeCall = 45,
+    InstructionOpCodeRet = 46,
+    InstructionOpCodeCallWide = 47,
+    InstructionOpCodeRetWide = 48,
 };
 
+// the frame bootloader.vhd receives: the sync byte, the size minus 1 as two bytes, high byte first, the code
+// and a checksum that makes the size bytes, the code and itself sum up to 0
+const u8 SERIAL_FRAME_SYNC = 0xA5;
+const u64 MAX_SERIAL_FRAME_CODE_SIZE = 65536;
+
 struct BinaryResultEntry
 {
     u8 value;
@@ -33,6 +71,10 @@ struct BinaryResult
     u64 size;
     BinaryResultEntry* data;
 
+    // how many entries the stacks in alu.vhd get, see stack_analyzer.cpp
+    u64 evaluation_stack_depth;
+    u64 general_stack_depth;
+
     static const u64 DEFAULT_CAPACITY = 256;
 
     static BinaryResult allocate()
@@ -41,6 +83,8 @@ struct BinaryResult
         result.capacity = DEFAULT_CAPACITY;
         result.size = 0;
         result.data = (BinaryResultEntry*)malloc(result.capacity * sizeof(BinaryResultEntry));
+        result.evaluation_stack_depth = 256;
+        result.general_stack_depth = 256;
         return result;
     }
 
@@ -49,16 +93,17 @@ struct BinaryResult
         if (size == capacity)
         {
             capacity *= 2;
-            data = (BinaryResultEntry*)realloc(data, capacity);
+            data = (BinaryResultEntry*)realloc(data, capacity * sizeof(BinaryResultEntry));
         }
         data[size].value = byte;
+        data[size].has_comment = false;
         size++;
     }
 
     void push(u8 byte, String comment)
     {
         push(byte);
-        data[size-1].has_comment = true;
+        data[size-1].has_comment = comment.size != 0;
         data[size-1].comment = comment;
     }
 
@@ -96,10 +141,91 @@ struct BinaryResult
             }
             printf("\n");
         }
+        printf("    );\n");
+        // a stack can't have zero entries in the hardware
         printf(
-            "    );\n"
-            "end program;\n"
+            "    constant evaluation_stack_depth : natural := %llu;\n"
+            "    constant general_stack_depth : natural := %llu;\n",
+            (unsigned long long)(evaluation_stack_depth != 0 ? evaluation_stack_depth : 1),
+            (unsigned long long)(general_stack_depth != 0 ? general_stack_depth : 1)
         );
+        printf("end program;\n");
+    }
+
+    // Xilinx coefficient file for the Block Memory Generator
+    void print_coe()
+    {
+        printf("memory_initialization_radix=16;\n");
+        printf("memory_initialization_vector=\n");
+        for (u64 i = 0; i < size; i++)
+        {
+            printf("%02X%s\n", data[i].value, i != size-1 ? "," : ";");
+        }
+        if (size == 0)
+        {
+            printf("00;\n"); // the vector can't be empty
+        }
+    }
+
+    // for $readmemh, updatemem and rom_file.vhd, one byte per line
+    void print_mem()
+    {
+        printf("@0000\n");
+        for (u64 i = 0; i < size; i++)
+        {
+            printf("%02X\n", data[i].value);
+        }
+    }
+
+    // data records of 16 bytes and an end-of-file record, each with a checksum that makes its bytes sum up to 0
+    void print_intel_hex()
+    {
+        const u64 RECORD_SIZE = 16;
+        for (u64 address = 0; address < size; address += RECORD_SIZE)
+        {
+            auto count = size - address < RECORD_SIZE ? size - address : RECORD_SIZE;
+            u8 checksum = (u8)(count + (address >> 8) + address);
+            printf(":%02X%04X00", (unsigned)count, (unsigned)address);
+            for (u64 i = address; i < address + count; i++)
+            {
+                printf("%02X", data[i].value);
+                checksum += data[i].value;
+            }
+            printf("%02X\n", (u8)-checksum);
+        }
+        printf(":00000001FF\n");
+    }
+
+    void print_raw()
+    {
+#ifdef _WIN32
+        _setmode(_fileno(stdout), _O_BINARY); // or every 0x0A becomes 0x0D 0x0A
+#endif
+        for (u64 i = 0; i < size; i++)
+        {
+            fputc(data[i].value, stdout);
+        }
+    }
+
+    void print_serial_frame()
+    {
+        if (size == 0 || size > MAX_SERIAL_FRAME_CODE_SIZE)
+        {
+            panic("The program doesn't fit in a serial frame");
+        }
+#ifdef _WIN32
+        _setmode(_fileno(stdout), _O_BINARY);
+#endif
+        u8 checksum = (u8)((size - 1) >> 8) + (u8)(size - 1);
+        fputc(SERIAL_FRAME_SYNC, stdout);
+        fputc((u8)((size - 1) >> 8), stdout);
+        fputc((u8)(size - 1), stdout);
+        for (u64 i = 0; i < size; i++)
+        {
+            fputc(data[i].value, stdout);
+            checksum += data[i].value;
+        }
+        fputc((u8)-checksum, stdout);
     }
 
     // DEBUG
@@ -120,13 +246,13 @@ struct BinaryResult
 struct LabelAddress
 {
     String label;
-    u8 address;
+    u64 address;
 };
 
 struct FindLabelAddressResult
 {
     bool found;
-    u8 address;
+    u64 address;
 };
 
 struct LabelsMap
@@ -156,7 +282,7 @@ struct LabelsMap
         if (size == capacity)
         {
             capacity *= 2;
-            data = (LabelAddress*)malloc(capacity * sizeof(LabelAddress));
+            data = (LabelAddress*)realloc(data, capacity * sizeof(LabelAddress));
         }
         data[size] = item;
         size++;
@@ -179,50 +305,175 @@ struct LabelsMap
     }
 };
 
-BinaryResult compile_to_binary(Ast ast)
+struct ExpressionFixup
+{
+    Expression* expression;
+    u64 address;
+    u64 line;
+};
+
+struct ExpressionFixups
+{
+    u64 capacity;
+    u64 size;
+    ExpressionFixup* data;
+
+    static const u64 DEFAULT_CAPACITY = 16;
+
+    static ExpressionFixups allocate()
+    {
+        ExpressionFixups result;
+        result.capacity = DEFAULT_CAPACITY;
+        result.size = 0;
+        result.data = (ExpressionFixup*)malloc(result.capacity * sizeof(ExpressionFixup));
+        return result;
+    }
+
+    void deallocate()
+    {
+        free(data);
+    }
+
+    void push(ExpressionFixup item)
+    {
+        if (size == capacity)
+        {
+            capacity *= 2;
+            data = (ExpressionFixup*)realloc(data, capacity * sizeof(ExpressionFixup));
+        }
+        data[size] = item;
+        size++;
+    }
+};
+
+void fix_expressions(BinaryResult result, LabelsMap labels_map, ExpressionFixups expressions_to_fix)
+{
+    auto label_addresses = StringMap::allocate();
+    for (u64 i = 0; i < labels_map.size; i++)
+    {
+        label_addresses.set(labels_map.data[i].label, labels_map.data[i].address);
+    }
+
+    for (u64 i = 0; i < expressions_to_fix.size; i++)
+    {
+        auto fixup = expressions_to_fix.data[i];
+        auto evaluation = evaluate_expression(fixup.expression, &label_addresses);
+        if (evaluation.success && !fits_in_byte(evaluation.value))
+        {
+            evaluation.success = false;
+            evaluation.error = String::allocate();
+            evaluation.error.push("Value doesn't fit in 8 bits");
+        }
+        if (!evaluation.success)
+        {
+            evaluation.error.push(" on line ");
+            evaluation.error.push(fixup.line);
+            evaluation.error.make_c_string();
+            panic(evaluation.error.data);
+        }
+        result.data[fixup.address].value = (u8)evaluation.value;
+    }
+
+    label_addresses.deallocate();
+}
+
+// node_comments, if given, has one extra comment for every node, empty ones are left out,
+// nodes past its end get none
+BinaryResult compile_to_binary(Ast ast, Strings* node_comments = NULL)
 {
     auto result = BinaryResult::allocate();
 
     auto labels_map = LabelsMap::allocate();
     auto labels_to_fix = LabelsMap::allocate();
+    auto pages_to_fix = LabelsMap::allocate();
+    auto expressions_to_fix = ExpressionFixups::allocate();
+
+    auto data_label = String::allocate();
+    data_label.push(DATA_LABEL);
+
+    // `push <page of label>, far`, the page is only known once the label is
+    auto push_far_prefix = [&](String label, String comment)
+    {
+        result.push(InstructionOpCodePush, comment);
+        LabelAddress page_address;
+        page_address.label = label;
+        page_address.address = result.size;
+        pages_to_fix.push(page_address);
+        result.push(0);
+        result.push(InstructionOpCodeFar);
+    };
+
+    // the byte a `push` pushes, or the operand byte a jump carries in its place
+    auto push_argument = [&](AstNode node)
+    {
+        if (node.push_type == PushNodeTypeInteger)
+        {
+            result.push(node.integer);
+        }
+        else if (node.push_type == PushNodeTypeExpression)
+        {
+            ExpressionFixup fixup;
+            fixup.expression = node.expression;
+            fixup.address = result.size;
+            fixup.line = node.line;
+            expressions_to_fix.push(fixup);
+            result.push(0);
+        }
+        else // PushNodeTypeLabel
+        {
+            auto find_result = labels_map.find(node.label);
+            if (find_result.found)
+            {
+                result.push((u8)find_result.address); // the offset in its page
+            }
+            else
+            {
+                LabelAddress label_address;
+                label_address.label = node.label;
+                label_address.address = result.size;
+                labels_to_fix.push(label_address);
+                result.push(0);
+            }
+        }
+    };
+
+    // nodes folded into a jump by fuse_branches have their comments on it
+    auto inlined_comment = String::allocate();
 
     for (u64 i = 0; i < ast.size; i++)
     {
-        auto comment = ast.data[i].to_string();
+        auto comment = inlined_comment;
+        inlined_comment = String::allocate();
+        comment.push(ast.data[i].to_string());
         comment.push(" (line ");
         comment.push(ast.data[i].line);
         comment.push(")");
+        if (node_comments != NULL && i < node_comments->size && node_comments->data[i].size != 0)
+        {
+            comment.push(", ");
+            comment.push(node_comments->data[i]);
+        }
+        if (ast.data[i].is_inlined)
+        {
+            inlined_comment = comment;
+            inlined_comment.push("; ");
+            continue;
+        }
+        // relax_addresses only makes a jump far when its target is pushed right before it
+        if (ast.data[i].is_far && (ast.data[i].type != AstNodeTypeCall || ast.data[i].has_inline_target))
+        {
+            push_far_prefix(ast.data[i].type == AstNodeTypeRomload ? data_label : ast.data[i-1].label, comment);
+            comment = String::allocate();
+        }
         switch (ast.data[i].type)
         {
             case AstNodeTypeNop:
                 result.push(InstructionOpCodeNop, comment);
                 break;
             case AstNodeTypePush:
-            {
                 result.push(InstructionOpCodePush, comment);
-                if (ast.data[i].push_type == PushNodeTypeInteger)
-                {
-                    result.push(ast.data[i].integer);
-                }
-                else // PushNodeTypeLabel
-                {
-                    // TODO: this snippet needs to be extracted into its own method
-                    auto find_result = labels_map.find(ast.data[i].label);
-                    if (find_result.found)
-                    {
-                        result.push(find_result.address);
-                    }
-                    else
-                    {
-                        LabelAddress label_address;
-                        label_address.label = ast.data[i].label;
-                        label_address.address = result.size;
-                        labels_to_fix.push(label_address);
-                        result.push(0);
-                    }
-                }
+                push_argument(ast.data[i]);
                 break;
-            }
             case AstNodeTypePop:
                 result.push(InstructionOpCodePop, comment);
                 break;
@@ -233,26 +484,32 @@ BinaryResult compile_to_binary(Ast ast)
                 result.push(InstructionOpCodeCmp, comment);
                 break;
             case AstNodeTypeJl:
-                result.push(InstructionOpCodeJl, comment);
-                break;
             case AstNodeTypeJle:
-                result.push(InstructionOpCodeJle, comment);
-                break;
             case AstNodeTypeJeq:
-                result.push(InstructionOpCodeJeq, comment);
-                break;
             case AstNodeTypeJge:
-                result.push(InstructionOpCodeJge, comment);
-                break;
             case AstNodeTypeJg:
-                result.push(InstructionOpCodeJg, comment);
-                break;
             case AstNodeTypeJne:
-                result.push(InstructionOpCodeJne, comment);
-                break;
             case AstNodeTypeJmp:
-                result.push(InstructionOpCodeJmp, comment);
+            {
+                // all three kinds of jumps have their opcodes in the order of the node types
+                auto condition = (u8)(ast.data[i].type - AstNodeTypeJl);
+                if (ast.data[i].has_inline_compare)
+                {
+                    result.push(InstructionOpCodeCmpJl + condition, comment);
+                    push_argument(ast.data[i-3]);
+                    push_argument(ast.data[i-1]);
+                }
+                else if (ast.data[i].has_inline_target)
+                {
+                    result.push(InstructionOpCodeJlInline + condition, comment);
+                    push_argument(ast.data[i-1]);
+                }
+                else
+                {
+                    result.push(InstructionOpCodeJl + condition, comment);
+                }
                 break;
+            }
             case AstNodeTypeDup:
                 result.push(InstructionOpCodeDup, comment);
                 break;
@@ -273,17 +530,89 @@ BinaryResult compile_to_binary(Ast ast)
                 break;
             case AstNodeTypeCall: // call is a short hand for push-store-jmp
             {
-                auto address_after_call = result.size + 4; // 4 is size of push-store-jmp instructions
-                result.push(InstructionOpCodePush, comment);
-                result.push(address_after_call);
+                if (ast.data[i].has_inline_target)
+                {
+                    result.push(ast.data[i].has_wide_return_address ? InstructionOpCodeCallWide : InstructionOpCodeCall, comment);
+                    push_argument(ast.data[i-1]);
+                    break;
+                }
+                auto address_after_call = result.size + ast.data[i].get_size();
+                if (ast.data[i].has_wide_return_address) // the page first, so that the offset ends up on top
+                {
+                    result.push(InstructionOpCodePush, comment);
+                    result.push((u8)(address_after_call >> 8));
+                    result.push(InstructionOpCodeStore);
+                    result.push(InstructionOpCodePush, (u8)address_after_call);
+                }
+                else
+                {
+                    result.push(InstructionOpCodePush, comment);
+                    result.push((u8)address_after_call);
+                }
                 result.push(InstructionOpCodeStore);
+                if (ast.data[i].is_far)
+                {
+                    push_far_prefix(ast.data[i-1].label, String::allocate());
+                }
                 result.push(InstructionOpCodeJmp);
                 break;
             }
             case AstNodeTypeRet: // ret is a short hand for load-jmp
+                if (has_native_calls)
+                {
+                    result.push(ast.data[i].has_wide_return_address ? InstructionOpCodeRetWide : InstructionOpCodeRet, comment);
+                    break;
+                }
                 result.push(InstructionOpCodeLoad, comment);
+                if (ast.data[i].has_wide_return_address) // load-load-far-jmp
+                {
+                    result.push(InstructionOpCodeLoad);
+                    result.push(InstructionOpCodeFar);
+                }
                 result.push(InstructionOpCodeJmp);
                 break;
+            case AstNodeTypeHalt:
+                result.push(InstructionOpCodeHalt, comment);
+                break;
+            case AstNodeTypeRomload:
+                result.push(InstructionOpCodeRomload, comment);
+                break;
+            case AstNodeTypeSub:
+                result.push(InstructionOpCodeSub, comment);
+                break;
+            case AstNodeTypeAnd:
+                result.push(InstructionOpCodeAnd, comment);
+                break;
+            case AstNodeTypeOr:
+                result.push(InstructionOpCodeOr, comment);
+                break;
+            case AstNodeTypeXor:
+                result.push(InstructionOpCodeXor, comment);
+                break;
+            case AstNodeTypeShl:
+                result.push(InstructionOpCodeShl, comment);
+                break;
+            case AstNodeTypeShr:
+                result.push(InstructionOpCodeShr, comment);
+                break;
+            case AstNodeTypeMul:
+                result.push(InstructionOpCodeMul, comment);
+                break;
+            case AstNodeTypeMulh:
+                result.push(InstructionOpCodeMulh, comment);
+                break;
+            case AstNodeTypeNot:
+                result.push(InstructionOpCodeNot, comment);
+                break;
+            case AstNodeTypeNeg:
+                result.push(InstructionOpCodeNeg, comment);
+                break;
+            case AstNodeTypeEqz:
+                result.push(InstructionOpCodeEqz, comment);
+                break;
+            case AstNodeTypeDelay:
+                panic("Delays have to be lowered before compiling");
+                break;
             case AstNodeTypeLabel:
             {
                 LabelAddress label_address;
@@ -292,6 +621,9 @@ BinaryResult compile_to_binary(Ast ast)
                 labels_map.push(label_address);
                 break;
             }
+            case AstNodeTypeData:
+                result.push(ast.data[i].integer, comment);
+                break;
         }
     }
 
@@ -302,10 +634,24 @@ BinaryResult compile_to_binary(Ast ast)
         {
             panic("Failed to find a label");
         }
-        result.data[labels_to_fix.data[i].address].value = find_result.address;
+        result.data[labels_to_fix.data[i].address].value = (u8)find_result.address;
+    }
+
+    for (u64 i = 0; i < pages_to_fix.size; i++)
+    {
+        auto find_result = labels_map.find(pages_to_fix.data[i].label);
+        if (!find_result.found)
+        {
+            panic("Failed to find a label");
+        }
+        result.data[pages_to_fix.data[i].address].value = (u8)(find_result.address >> 8);
     }
 
+    fix_expressions(result, labels_map, expressions_to_fix);
+
     labels_map.deallocate();
+    pages_to_fix.deallocate();
+    expressions_to_fix.deallocate();
 
     return result;
 }
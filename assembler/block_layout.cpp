@@ -0,0 +1,743 @@
+// Reorders basic blocks so that the hot successor of every block comes right after it.
+// A `push <label>, jmp` to the next block is dropped, and a block whose successor isn't next any more gets one.
+// Conditional jumps are inverted (`jeq` <-> `jne`, `jl` <-> `jge`, `jle` <-> `jg`) to let whichever successor
+// ends up next fall through, since a taken jump costs TAKEN_JUMP_PENALTY. When neither does, the colder
+// successor gets the extra `push <label>, jmp`. Labels are resolved by compile_to_binary as usual, blocks
+// that didn't have one get a `__layout_N` label.
+//
+// How often every edge is taken comes from an execution profile of a simulation run, or from a static estimate
+// when there is none: every loop runs CostModel::ESTIMATED_LOOP_ITERATIONS times, and a branch stays in the
+// innermost loop it's in all but one of those times. Chains of blocks are built from the hottest edge down
+// (Pettis and Hansen). Block 0 stays first and a block that runs off the end of the program stays last.
+
+const u64 STATIC_FREQUENCY_SCALE = 64; // static frequencies are fractions of one run of the program
+const u64 MAX_STATIC_LOOP_DEPTH = 4;
+
+// How often the instruction at every ROM address ran. The file has an address on every line, optionally followed
+// by a count, 1 if there is none, so both the trace cpu_test.vhd writes given a profile_path (one line per cycle)
+// and summed up counts work. Lines starting with '#' are comments. The addresses are those of the program
+// assembled with the same options but without --profile.
+struct ExecutionProfile
+{
+    u64 capacity;
+    u64 size;
+    u64* data; // indexed by address
+
+    static const u64 DEFAULT_CAPACITY = 256;
+
+    static ExecutionProfile allocate()
+    {
+        ExecutionProfile result;
+        result.capacity = DEFAULT_CAPACITY;
+        result.size = 0;
+        result.data = (u64*)malloc(result.capacity * sizeof(u64));
+        return result;
+    }
+
+    void add(u64 address, u64 count)
+    {
+        while (address >= capacity)
+        {
+            capacity *= 2;
+            data = (u64*)realloc(data, capacity * sizeof(u64));
+        }
+        while (address >= size)
+        {
+            data[size] = 0;
+            size++;
+        }
+        data[address] += count;
+    }
+
+    u64 get(u64 address)
+    {
+        return address < size ? data[address] : 0;
+    }
+};
+
+struct ExecutionProfileLoadingResult
+{
+    bool success;
+    ExecutionProfile profile;
+    String error;
+};
+
+// false if there is no number at i
+bool parse_profile_number(String source, u64* i, u64 line_end, u64* result)
+{
+    while (*i < line_end && (source.data[*i] == ' ' || source.data[*i] == '\t'))
+    {
+        (*i)++;
+    }
+    if (*i == line_end || source.data[*i] < '0' || source.data[*i] > '9')
+    {
+        return false;
+    }
+    *result = 0;
+    while (*i < line_end && source.data[*i] >= '0' && source.data[*i] <= '9')
+    {
+        *result = *result * 10 + (u64)(source.data[*i] - '0');
+        (*i)++;
+    }
+    return true;
+}
+
+ExecutionProfileLoadingResult parse_execution_profile(String source)
+{
+    ExecutionProfileLoadingResult result;
+    result.success = true;
+    result.profile = ExecutionProfile::allocate();
+
+    u64 line = 1;
+    for (u64 i = 0; i < source.size; line++)
+    {
+        auto line_end = i;
+        while (line_end < source.size && source.data[line_end] != '\n')
+        {
+            line_end++;
+        }
+        auto content_end = line_end;
+        if (content_end != i && source.data[content_end-1] == '\r')
+        {
+            content_end--;
+        }
+
+        if (content_end != i && source.data[i] != '#')
+        {
+            u64 address;
+            u64 count = 1;
+            auto k = i;
+            bool is_valid = parse_profile_number(source, &k, content_end, &address);
+            if (is_valid && k != content_end)
+            {
+                is_valid = parse_profile_number(source, &k, content_end, &count);
+            }
+            while (is_valid && k < content_end && (source.data[k] == ' ' || source.data[k] == '\t'))
+            {
+                k++;
+            }
+            if (!is_valid || k != content_end)
+            {
+                result.success = false;
+                result.error = String::allocate();
+                result.error.push("Expected an address and an optional count on line ");
+                result.error.push(line);
+                return result;
+            }
+            result.profile.add(address, count);
+        }
+
+        i = line_end + 1;
+    }
+    return result;
+}
+
+struct LayoutEdge
+{
+    u64 from;
+    u64 to;
+    u64 weight;
+};
+
+struct BlockLayoutState
+{
+    Ast ast;
+    ControlFlowGraph graph;
+    CostModel cost_model;
+    u64* jump_targets; // block a known jump at the end goes to, NO_BLOCK if there is none
+    u64* fall_throughs; // block that runs next if the last node doesn't jump, NO_BLOCK if there is none
+    u64* edge_weights; // two per block, in the order of BasicBlock::successors
+    u64* order;
+    u64 jump_cycles; // of `push <label>, jmp`
+    u64 next_label_id;
+    u64 inverted_branches;
+
+    bool is_conditional(u64 block)
+    {
+        auto last = ast.data[graph.blocks[block].get_last_node()];
+        return last.is_jump() && last.type != AstNodeTypeJmp;
+    }
+
+    bool runs_off_the_end(u64 block)
+    {
+        return graph.blocks[block].end == ast.size && fall_throughs[block] == NO_BLOCK
+            && ast.data[ast.size-1].falls_through();
+    }
+
+    u64 get_edge_weight(u64 from, u64 to)
+    {
+        for (u64 k = 0; k < graph.blocks[from].successor_count; k++)
+        {
+            if (graph.blocks[from].successors[k] == to)
+            {
+                return edge_weights[2 * from + k];
+            }
+        }
+        return 0;
+    }
+
+    void set_edge_weight(u64 from, u64 to, u64 weight)
+    {
+        for (u64 k = 0; k < graph.blocks[from].successor_count; k++)
+        {
+            if (graph.blocks[from].successors[k] == to)
+            {
+                edge_weights[2 * from + k] = weight;
+            }
+        }
+    }
+
+    void find_successors()
+    {
+        jump_targets = (u64*)malloc((graph.block_count + 1) * sizeof(u64));
+        fall_throughs = (u64*)malloc((graph.block_count + 1) * sizeof(u64));
+        for (u64 b = 0; b < graph.block_count; b++)
+        {
+            auto block = graph.blocks[b];
+            auto last = block.get_last_node();
+            auto node = ast.data[last];
+            jump_targets[b] = node.is_jump() ? graph.get_block_of(ast.get_jump_target(last)) : NO_BLOCK;
+            fall_throughs[b] = node.falls_through() ? graph.get_block_of(block.end) : NO_BLOCK;
+        }
+    }
+
+    // splits the count of a conditional block between its successors, using whichever of them
+    // can only be reached from it
+    void split_counts(u64 block, u64 count, u64 target_count, u64 fall_through_count)
+    {
+        auto target = jump_targets[block];
+        auto fall_through = fall_throughs[block];
+        auto is_only_predecessor = [&](u64 successor) {
+            return !graph.is_entry_block[successor] && graph.blocks[successor].predecessor_count == 1;
+        };
+        if (is_only_predecessor(target) && !is_only_predecessor(fall_through))
+        {
+            auto taken = target_count < count ? target_count : count;
+            set_edge_weight(block, target, taken);
+            set_edge_weight(block, fall_through, count - taken);
+        }
+        else
+        {
+            auto not_taken = fall_through_count < count ? fall_through_count : count;
+            set_edge_weight(block, fall_through, not_taken);
+            set_edge_weight(block, target, count - not_taken);
+        }
+    }
+
+    bool has_two_successors(u64 block)
+    {
+        return is_conditional(block) && jump_targets[block] != NO_BLOCK && fall_throughs[block] != NO_BLOCK
+            && jump_targets[block] != fall_throughs[block];
+    }
+
+    void weigh_edges_with_profile(ExecutionProfile profile, u64* addresses)
+    {
+        auto counts = (u64*)malloc((graph.block_count + 1) * sizeof(u64));
+        for (u64 b = 0; b < graph.block_count; b++)
+        {
+            auto first = ast.skip_labels(graph.blocks[b].begin);
+            counts[b] = first < graph.blocks[b].end ? profile.get(addresses[first]) : 0;
+        }
+        for (u64 b = 0; b < graph.block_count; b++)
+        {
+            for (u64 k = 0; k < graph.blocks[b].successor_count; k++)
+            {
+                edge_weights[2 * b + k] = counts[b];
+            }
+            if (has_two_successors(b))
+            {
+                split_counts(b, counts[b], counts[jump_targets[b]], counts[fall_throughs[b]]);
+            }
+        }
+        free(counts);
+    }
+
+    void weigh_edges_statically()
+    {
+        auto loops = graph.find_loops();
+        auto depths = (u64*)calloc(graph.block_count + 1, sizeof(u64));
+        for (u64 l = 0; l < loops.size; l++)
+        {
+            for (u64 b = 0; b < graph.block_count; b++)
+            {
+                if (loops.data[l].contains[b])
+                {
+                    depths[b]++;
+                }
+            }
+        }
+        // how many loops contain both blocks
+        auto get_common_depth = [&](u64 left, u64 right) {
+            u64 result = 0;
+            for (u64 l = 0; l < loops.size; l++)
+            {
+                if (loops.data[l].contains[left] && loops.data[l].contains[right])
+                {
+                    result++;
+                }
+            }
+            return result;
+        };
+
+        auto iterations = CostModel::ESTIMATED_LOOP_ITERATIONS;
+        for (u64 b = 0; b < graph.block_count; b++)
+        {
+            auto frequency = STATIC_FREQUENCY_SCALE;
+            for (u64 d = 0; d < depths[b] && d < MAX_STATIC_LOOP_DEPTH; d++)
+            {
+                frequency *= iterations;
+            }
+            for (u64 k = 0; k < graph.blocks[b].successor_count; k++)
+            {
+                edge_weights[2 * b + k] = frequency;
+            }
+            if (!has_two_successors(b))
+            {
+                continue;
+            }
+            auto target_depth = get_common_depth(b, jump_targets[b]);
+            auto fall_through_depth = get_common_depth(b, fall_throughs[b]);
+            auto likely = frequency / iterations * (iterations - 1);
+            auto unlikely = frequency / iterations;
+            if (target_depth == fall_through_depth)
+            {
+                likely = frequency / 2;
+                unlikely = frequency / 2;
+            }
+            auto is_target_likely = target_depth > fall_through_depth;
+            set_edge_weight(b, jump_targets[b], is_target_likely ? likely : unlikely);
+            set_edge_weight(b, fall_throughs[b], is_target_likely ? unlikely : likely);
+        }
+
+        free(depths);
+        loops.deallocate();
+    }
+
+    // weighted cycles spent on `push <label>, jmp` and on taken conditional jumps when block is followed by next
+    u64 get_jump_overhead(u64 block, u64 next)
+    {
+        auto target = jump_targets[block];
+        auto fall_through = fall_throughs[block];
+        if (has_two_successors(block))
+        {
+            auto target_weight = get_edge_weight(block, target);
+            auto fall_through_weight = get_edge_weight(block, fall_through);
+            if (next == target)
+            {
+                return fall_through_weight * TAKEN_JUMP_PENALTY;
+            }
+            if (next == fall_through)
+            {
+                return target_weight * TAKEN_JUMP_PENALTY;
+            }
+            // the conditional jump goes to the hotter one
+            if (target_weight < fall_through_weight)
+            {
+                return fall_through_weight * TAKEN_JUMP_PENALTY + target_weight * jump_cycles;
+            }
+            return target_weight * TAKEN_JUMP_PENALTY + fall_through_weight * jump_cycles;
+        }
+        if (!is_conditional(block) && target != NO_BLOCK)
+        {
+            return next == target ? 0 : get_edge_weight(block, target) * jump_cycles;
+        }
+        if (fall_through != NO_BLOCK)
+        {
+            return next == fall_through ? 0 : get_edge_weight(block, fall_through) * jump_cycles;
+        }
+        return 0;
+    }
+
+    // the original code runs every known `jmp`, even one to the next block
+    u64 get_original_overhead()
+    {
+        u64 result = 0;
+        for (u64 b = 0; b < graph.block_count; b++)
+        {
+            if (!is_conditional(b) && jump_targets[b] != NO_BLOCK)
+            {
+                result += get_edge_weight(b, jump_targets[b]) * jump_cycles;
+            }
+            else if (has_two_successors(b))
+            {
+                result += get_edge_weight(b, jump_targets[b]) * TAKEN_JUMP_PENALTY;
+            }
+        }
+        return result;
+    }
+
+    u64 get_layout_overhead()
+    {
+        u64 result = 0;
+        for (u64 i = 0; i < graph.block_count; i++)
+        {
+            result += get_jump_overhead(order[i], i + 1 < graph.block_count ? order[i+1] : NO_BLOCK);
+        }
+        return result;
+    }
+
+    // fills order, returns false if nothing can be moved
+    bool build_chains()
+    {
+        auto next = (u64*)malloc((graph.block_count + 1) * sizeof(u64));
+        auto previous = (u64*)malloc((graph.block_count + 1) * sizeof(u64));
+        auto heads = (u64*)malloc((graph.block_count + 1) * sizeof(u64)); // only kept up to date for tails
+        for (u64 b = 0; b < graph.block_count; b++)
+        {
+            next[b] = NO_BLOCK;
+            previous[b] = NO_BLOCK;
+            heads[b] = b;
+        }
+        u64 last_block = NO_BLOCK;
+        for (u64 b = 0; b < graph.block_count; b++)
+        {
+            if (runs_off_the_end(b))
+            {
+                last_block = b;
+            }
+        }
+        if (last_block == 0)
+        {
+            free(next);
+            free(previous);
+            free(heads);
+            return false;
+        }
+
+        auto edges = (LayoutEdge*)malloc((2 * graph.block_count + 1) * sizeof(LayoutEdge));
+        u64 edge_count = 0;
+        for (u64 b = 0; b < graph.block_count; b++)
+        {
+            for (u64 k = 0; k < graph.blocks[b].successor_count; k++)
+            {
+                LayoutEdge edge;
+                edge.from = b;
+                edge.to = graph.blocks[b].successors[k];
+                edge.weight = edge_weights[2 * b + k];
+                edges[edge_count++] = edge;
+            }
+        }
+        // hottest first, ties keep the original order
+        auto comes_first = [](LayoutEdge left, LayoutEdge right) {
+            if (left.weight != right.weight)
+            {
+                return left.weight > right.weight;
+            }
+            auto left_is_in_order = left.to == left.from + 1;
+            auto right_is_in_order = right.to == right.from + 1;
+            if (left_is_in_order != right_is_in_order)
+            {
+                return left_is_in_order;
+            }
+            return left.from < right.from;
+        };
+        for (u64 i = 1; i < edge_count; i++)
+        {
+            auto edge = edges[i];
+            auto k = i;
+            while (k != 0 && comes_first(edge, edges[k-1]))
+            {
+                edges[k] = edges[k-1];
+                k--;
+            }
+            edges[k] = edge;
+        }
+
+        for (u64 i = 0; i < edge_count; i++)
+        {
+            auto from = edges[i].from;
+            auto to = edges[i].to;
+            if (next[from] != NO_BLOCK || previous[to] != NO_BLOCK || to == 0 || heads[from] == to
+                || from == last_block)
+            {
+                continue;
+            }
+            // block 0 has to come first and the last block last, so they can't end up in one chain
+            auto tail = to;
+            while (next[tail] != NO_BLOCK)
+            {
+                tail = next[tail];
+            }
+            if (heads[from] == 0 && tail == last_block)
+            {
+                continue;
+            }
+            next[from] = to;
+            previous[to] = from;
+            heads[tail] = heads[from];
+        }
+
+        u64 size = 0;
+        auto push_chain = [&](u64 head) {
+            for (auto b = head; b != NO_BLOCK; b = next[b])
+            {
+                order[size++] = b;
+            }
+        };
+        push_chain(0);
+        u64 last_head = NO_BLOCK;
+        for (u64 b = 1; b < graph.block_count; b++)
+        {
+            if (previous[b] != NO_BLOCK)
+            {
+                continue;
+            }
+            auto tail = b;
+            while (next[tail] != NO_BLOCK)
+            {
+                tail = next[tail];
+            }
+            if (tail == last_block)
+            {
+                last_head = b;
+                continue;
+            }
+            push_chain(b);
+        }
+        if (last_head != NO_BLOCK)
+        {
+            push_chain(last_head);
+        }
+
+        free(next);
+        free(previous);
+        free(heads);
+        free(edges);
+        return true;
+    }
+
+    AstNodeType invert_condition(AstNodeType type)
+    {
+        switch (type)
+        {
+            case AstNodeTypeJl: return AstNodeTypeJge;
+            case AstNodeTypeJge: return AstNodeTypeJl;
+            case AstNodeTypeJle: return AstNodeTypeJg;
+            case AstNodeTypeJg: return AstNodeTypeJle;
+            case AstNodeTypeJeq: return AstNodeTypeJne;
+            case AstNodeTypeJne: return AstNodeTypeJeq;
+            default:
+                panic("Not a conditional jump");
+                return type;
+        }
+    }
+
+    String get_block_label(u64 block, String* new_labels)
+    {
+        auto first = ast.data[graph.blocks[block].begin];
+        if (first.type == AstNodeTypeLabel)
+        {
+            return first.label;
+        }
+        if (new_labels[block].size == 0)
+        {
+            do
+            {
+                new_labels[block].size = 0;
+                new_labels[block].push("__layout_");
+                new_labels[block].push(next_label_id);
+                next_label_id++;
+            }
+            while (ast.find_label(new_labels[block]) != ast.size);
+        }
+        return new_labels[block];
+    }
+
+    Ast emit()
+    {
+        auto new_labels = (String*)malloc((graph.block_count + 1) * sizeof(String));
+        for (u64 b = 0; b < graph.block_count; b++)
+        {
+            new_labels[b] = String::allocate();
+        }
+
+        // all labels are known before the first block is emitted
+        for (u64 i = 0; i < graph.block_count; i++)
+        {
+            auto b = order[i];
+            auto next = i + 1 < graph.block_count ? order[i+1] : NO_BLOCK;
+            if (fall_throughs[b] != NO_BLOCK && next != fall_throughs[b])
+            {
+                get_block_label(fall_throughs[b], new_labels);
+            }
+        }
+
+        inverted_branches = 0;
+        auto result = Ast::allocate();
+        for (u64 i = 0; i < graph.block_count; i++)
+        {
+            auto b = order[i];
+            auto next = i + 1 < graph.block_count ? order[i+1] : NO_BLOCK;
+            auto block = graph.blocks[b];
+            auto last = ast.data[block.get_last_node()];
+            auto target = jump_targets[b];
+            auto fall_through = fall_throughs[b];
+
+            if (new_labels[b].size != 0)
+            {
+                result.push(AstNode::make_label(new_labels[b], ast.data[block.begin].line));
+            }
+            auto end = block.end;
+            if (target != NO_BLOCK && (next == target || has_two_successors(b)))
+            {
+                end -= 2; // the `push <label>, jmp` is dropped or rewritten
+            }
+            for (auto k = block.begin; k < end; k++)
+            {
+                result.push(ast.data[k]);
+            }
+
+            auto line = last.line;
+            if (has_two_successors(b))
+            {
+                auto target_label = ast.data[block.end-2].label;
+                auto invert = next == target
+                    || next != fall_through && get_edge_weight(b, target) < get_edge_weight(b, fall_through);
+                if (invert)
+                {
+                    inverted_branches++;
+                    result.push(AstNode::make_push_label(get_block_label(fall_through, new_labels), line));
+                    result.push(AstNode::make(invert_condition(last.type), line));
+                }
+                else
+                {
+                    result.push(ast.data[block.end-2]);
+                    result.push(last);
+                }
+                if (next != target && next != fall_through)
+                {
+                    auto other_label = invert ? target_label : get_block_label(fall_through, new_labels);
+                    result.push(AstNode::make_push_label(other_label, line));
+                    result.push(AstNode::make(AstNodeTypeJmp, line));
+                }
+            }
+            else if (fall_through != NO_BLOCK && next != fall_through)
+            {
+                result.push(AstNode::make_push_label(get_block_label(fall_through, new_labels), line));
+                result.push(AstNode::make(AstNodeTypeJmp, line));
+            }
+        }
+
+        free(new_labels);
+        return result;
+    }
+};
+
+struct BlockLayoutResult
+{
+    Ast ast;
+    u64 moved_blocks; // blocks that aren't after the same block as before
+    u64 inverted_branches;
+    s64 cycles_saved; // per run of the program for the static estimate, over the profiled run for a profile
+    s64 bytes_added;
+};
+
+// ast stays as it is if the new layout isn't expected to save anything,
+// profile is the one of the program with the addresses in profile_addresses, NULL for the static estimate
+BlockLayoutResult lay_out_blocks(Ast ast, CostModel cost_model, ExecutionProfile* profile, u64* profile_addresses)
+{
+    BlockLayoutResult result;
+    result.ast = ast;
+    result.moved_blocks = 0;
+    result.inverted_branches = 0;
+    result.cycles_saved = 0;
+    result.bytes_added = 0;
+
+    // labels in expressions might be used for address arithmetic that moving blocks would break
+    for (u64 i = 0; i < ast.size; i++)
+    {
+        if (ast.data[i].is_push_expression())
+        {
+            return result;
+        }
+    }
+
+    BlockLayoutState state;
+    state.ast = ast;
+    state.graph = build_control_flow_graph(ast);
+    state.cost_model = cost_model;
+    state.next_label_id = 0;
+    state.inverted_branches = 0;
+    auto jump = Ast::allocate();
+    jump.push(AstNode::make_push_label(String::allocate(), 0));
+    jump.push(AstNode::make(AstNodeTypeJmp, 0));
+    state.jump_cycles = jump.get_cycles();
+    if (state.graph.block_count < 2)
+    {
+        state.graph.deallocate();
+        return result;
+    }
+
+    state.find_successors();
+    state.edge_weights = (u64*)calloc(2 * state.graph.block_count + 1, sizeof(u64));
+    if (profile != NULL)
+    {
+        state.weigh_edges_with_profile(*profile, profile_addresses);
+    }
+    else
+    {
+        state.weigh_edges_statically();
+    }
+
+    state.order = (u64*)malloc((state.graph.block_count + 1) * sizeof(u64));
+    if (state.build_chains())
+    {
+        auto cycles_saved = (s64)state.get_original_overhead() - (s64)state.get_layout_overhead();
+        if (profile == NULL)
+        {
+            cycles_saved /= (s64)STATIC_FREQUENCY_SCALE;
+        }
+        auto laid_out = state.emit();
+        auto bytes_added = (s64)laid_out.get_size() - (s64)ast.get_size();
+        if (cycles_saved > 0 && cost_model.fits(laid_out.get_size())
+            && cost_model.score(bytes_added, cycles_saved) > 0)
+        {
+            for (u64 i = 0; i < state.graph.block_count; i++)
+            {
+                auto previous = i != 0 ? state.order[i-1] : NO_BLOCK;
+                if (state.order[i] != 0 && previous != state.order[i] - 1)
+                {
+                    result.moved_blocks++;
+                }
+            }
+            result.ast = laid_out;
+            result.inverted_branches = state.inverted_branches;
+            result.cycles_saved = cycles_saved;
+            result.bytes_added = bytes_added;
+        }
+    }
+
+    free(state.jump_targets);
+    free(state.fall_throughs);
+    free(state.edge_weights);
+    free(state.order);
+    state.graph.deallocate();
+    return result;
+}
+
+// the address every node will have in the ROM, lowered, fused and relaxed the way main does it, so with the
+// delay routines, far prefixes and two byte return addresses; data is the one split_data took out
+u64* get_node_addresses(Ast ast, Ast data)
+{
+    auto node_indices = (u64*)malloc(ast.size * sizeof(u64));
+    auto scratch_annotations = TimingAnnotations::allocate();
+    auto delay_lowering_result = lower_delays(ast, &scratch_annotations, false, node_indices);
+    auto relaxation_result = relax_addresses(fuse_branches(delay_lowering_result.ast).ast, data, false);
+    if (relaxation_result.success && relaxation_result.is_wide && delay_lowering_result.delays != 0)
+    {
+        scratch_annotations.size = 0;
+        delay_lowering_result = lower_delays(ast, &scratch_annotations, true, node_indices);
+        relaxation_result = relax_addresses(fuse_branches(delay_lowering_result.ast).ast, data, true);
+    }
+    auto relaxed_addresses = get_relaxed_addresses(relaxation_result.ast);
+
+    auto result = (u64*)malloc((ast.size + 1) * sizeof(u64));
+    for (u64 i = 0; i < ast.size; i++)
+    {
+        result[i] = relaxed_addresses[node_indices[i]];
+    }
+    result[ast.size] = relaxed_addresses[relaxation_result.ast.size];
+    free(relaxed_addresses);
+    free(node_indices);
+    return result;
+}
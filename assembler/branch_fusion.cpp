@@ -0,0 +1,86 @@
+// Conditional branches are written as `push X, cmp, push label, jcc`, 6 bytes and 6 cycles. The ALU also has
+// jumps that take their target as a byte after the opcode, and jumps that compare the top of the stack with a
+// byte and then jump to a second one, which leaves the flags exactly like the `cmp` would:
+//
+//     push label, jcc               -> jcc <label>         3 bytes -> 2
+//     push X, cmp, push label, jcc  -> cmp_jcc <X> <label> 6 bytes -> 3
+//
+// The same goes for the native `call <label>`, 6 bytes -> 2, unless has_native_calls is off. A call without a
+// `push` right before it is expanded, which works on every core.
+//
+// The folded nodes stay in the AST with is_inlined set, so everything that follows a jump through the
+// `push label` before it keeps working, they just take no bytes of their own. Only nodes right next to each
+// other are folded, a label in between is a node as well.
+
+struct BranchFusionResult
+{
+    Ast ast;
+    u64 fused_compares;
+    u64 inline_targets; // including those of the fused compares
+    u64 native_calls;
+    u64 bytes_saved;
+};
+
+BranchFusionResult fuse_branches(Ast ast)
+{
+    BranchFusionResult result;
+    result.ast = Ast::allocate();
+    for (u64 i = 0; i < ast.size; i++)
+    {
+        result.ast.push(ast.data[i]);
+    }
+    ast = result.ast;
+    result.fused_compares = 0;
+    result.inline_targets = 0;
+    result.native_calls = 0;
+    result.bytes_saved = 0;
+
+    auto size_before = ast.get_size();
+    for (u64 i = 1; i < ast.size; i++)
+    {
+        auto jump = &ast.data[i];
+        auto target = &ast.data[i-1];
+        auto is_native_call = jump->type == AstNodeTypeCall && has_native_calls;
+        if (!jump->is_jump() && !is_native_call || jump->has_inline_target
+            || target->type != AstNodeTypePush || target->is_inlined)
+        {
+            continue;
+        }
+        jump->has_inline_target = true;
+        target->is_inlined = true;
+        if (is_native_call)
+        {
+            result.native_calls++;
+            continue;
+        }
+        result.inline_targets++;
+
+        if (jump->type == AstNodeTypeJmp || i < 3)
+        {
+            continue;
+        }
+        auto compare = &ast.data[i-2];
+        auto value = &ast.data[i-3];
+        if (compare->type == AstNodeTypeCmp && value->type == AstNodeTypePush && !value->is_inlined)
+        {
+            jump->has_inline_compare = true;
+            compare->is_inlined = true;
+            value->is_inlined = true;
+            result.fused_compares++;
+        }
+    }
+    result.bytes_saved = size_before - ast.get_size();
+    return result;
+}
+
+// `push <label>, jmp` or `push <label>, call` as fuse_branches emits it, for the passes before it that weigh
+// adding or removing one
+Ast make_fused_jump(AstNodeType type)
+{
+    auto label = String::allocate();
+    label.push("target");
+    auto result = Ast::allocate();
+    result.push(AstNode::make_push_label(label, 0));
+    result.push(AstNode::make(type, 0));
+    return fuse_branches(result).ast;
+}
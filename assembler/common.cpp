@@ -198,6 +198,99 @@ struct Strings
     }
 };
 
+// FNV-1a
+u64 hash_string(String string)
+{
+    u64 result = 14695981039346656037ull;
+    for (u64 i = 0; i < string.size; i++)
+    {
+        result ^= (u8)string.data[i];
+        result *= 1099511628211ull;
+    }
+    return result;
+}
+
+struct StringMapEntry
+{
+    bool is_used;
+    String key;
+    u64 value;
+};
+
+// open addressing hash map from strings to integers, keys are not copied
+struct StringMap
+{
+    u64 capacity; // always a power of two
+    u64 size;
+    StringMapEntry* data;
+
+    static const u64 DEFAULT_CAPACITY = 16;
+
+    static StringMap allocate()
+    {
+        StringMap result;
+        result.capacity = DEFAULT_CAPACITY;
+        result.size = 0;
+        result.data = (StringMapEntry*)calloc(result.capacity, sizeof(StringMapEntry));
+        return result;
+    }
+
+    void deallocate()
+    {
+        free(data);
+    }
+
+    StringMapEntry* find_entry(String key)
+    {
+        auto index = hash_string(key) & (capacity - 1);
+        while (data[index].is_used && data[index].key != key)
+        {
+            index = (index + 1) & (capacity - 1);
+        }
+        return &data[index];
+    }
+
+    void set(String key, u64 value)
+    {
+        if (2 * (size + 1) > capacity)
+        {
+            auto old_capacity = capacity;
+            auto old_data = data;
+            capacity *= 2;
+            size = 0;
+            data = (StringMapEntry*)calloc(capacity, sizeof(StringMapEntry));
+            for (u64 i = 0; i < old_capacity; i++)
+            {
+                if (old_data[i].is_used)
+                {
+                    set(old_data[i].key, old_data[i].value);
+                }
+            }
+            free(old_data);
+        }
+
+        auto entry = find_entry(key);
+        if (!entry->is_used)
+        {
+            entry->is_used = true;
+            entry->key = key;
+            size++;
+        }
+        entry->value = value;
+    }
+
+    bool contains(String key)
+    {
+        return find_entry(key)->is_used;
+    }
+
+    // the key must be in the map
+    u64 get(String key)
+    {
+        return find_entry(key)->value;
+    }
+};
+
 void panic(const char* message)
 {
     printf("%s\n", message);
@@ -0,0 +1,511 @@
+// Abstract interpretation of the evaluation stack, the general stack and the flags register.
+// Every stack is tracked as a window of its topmost values, anything below the window is unknown.
+// Values are followed through dup, ddup, store/load and add, `call` pushes its return address onto the general stack,
+// so jumps to labels that took a detour through the stacks and returns from functions with a single caller
+// are resolved too. That only sharpens the analysis, the jumps themselves stay computed. A jump whose target
+// stays unknown could go to any label that had its address taken or to any return address, so all of those
+// start out with nothing known.
+
+enum AbstractValueType
+{
+    AbstractValueTypeUnknown,
+    AbstractValueTypeInteger,
+    AbstractValueTypeLabel,
+    AbstractValueTypeReturnAddress, // of the call at node call_index
+};
+
+struct AbstractValue
+{
+    AbstractValueType type;
+    u8 integer;
+    String label;
+    u64 call_index;
+
+    static AbstractValue make(AbstractValueType type)
+    {
+        AbstractValue result;
+        result.type = type;
+        return result;
+    }
+
+    bool is_known()
+    {
+        return type != AbstractValueTypeUnknown;
+    }
+};
+
+bool operator==(AbstractValue left, AbstractValue right)
+{
+    if (left.type != right.type)
+    {
+        return false;
+    }
+    switch (left.type)
+    {
+        case AbstractValueTypeUnknown: return true;
+        case AbstractValueTypeInteger: return left.integer == right.integer;
+        case AbstractValueTypeLabel: return left.label == right.label;
+        case AbstractValueTypeReturnAddress: return left.call_index == right.call_index;
+    }
+    return false;
+}
+
+bool operator!=(AbstractValue left, AbstractValue right)
+{
+    return !(left == right);
+}
+
+const u64 ABSTRACT_STACK_WINDOW = 32;
+
+struct AbstractStack
+{
+    AbstractValue data[ABSTRACT_STACK_WINDOW]; // data[size-1] is the top of the stack
+    u64 size;
+
+    void push(AbstractValue value)
+    {
+        if (size == ABSTRACT_STACK_WINDOW)
+        {
+            memmove(data, data + 1, (ABSTRACT_STACK_WINDOW - 1) * sizeof(AbstractValue));
+            size--;
+        }
+        data[size] = value;
+        size++;
+    }
+
+    AbstractValue pop()
+    {
+        if (size == 0)
+        {
+            return AbstractValue::make(AbstractValueTypeUnknown);
+        }
+        size--;
+        return data[size];
+    }
+
+    AbstractValue peek()
+    {
+        return size == 0 ? AbstractValue::make(AbstractValueTypeUnknown) : data[size-1];
+    }
+
+    // keeps what both stacks agree on, returns true if anything changed
+    bool join(AbstractStack other)
+    {
+        bool changed = false;
+        if (other.size < size)
+        {
+            memmove(data, data + size - other.size, other.size * sizeof(AbstractValue));
+            size = other.size;
+            changed = true;
+        }
+        for (u64 i = 0; i < size; i++)
+        {
+            auto other_value = other.data[other.size - size + i];
+            if (data[i].is_known() && data[i] != other_value)
+            {
+                data[i] = AbstractValue::make(AbstractValueTypeUnknown);
+                changed = true;
+            }
+        }
+        return changed;
+    }
+};
+
+enum AbstractFlags
+{
+    AbstractFlagsUnknown,
+    AbstractFlagsLess,
+    AbstractFlagsEqual,
+    AbstractFlagsGreater,
+};
+
+struct AbstractState
+{
+    bool is_reachable;
+    AbstractStack evaluation_stack;
+    AbstractStack general_stack;
+    AbstractFlags flags;
+
+    static AbstractState make_unknown()
+    {
+        AbstractState result;
+        result.is_reachable = true;
+        result.evaluation_stack.size = 0;
+        result.general_stack.size = 0;
+        result.flags = AbstractFlagsUnknown;
+        return result;
+    }
+
+    bool join(AbstractState other)
+    {
+        if (!other.is_reachable)
+        {
+            return false;
+        }
+        if (!is_reachable)
+        {
+            *this = other;
+            return true;
+        }
+        bool changed = evaluation_stack.join(other.evaluation_stack);
+        changed = general_stack.join(other.general_stack) || changed;
+        if (flags != AbstractFlagsUnknown && flags != other.flags)
+        {
+            flags = AbstractFlagsUnknown;
+            changed = true;
+        }
+        return changed;
+    }
+};
+
+enum BranchOutcome
+{
+    BranchOutcomeUnknown,
+    BranchOutcomeAlwaysTaken,
+    BranchOutcomeNeverTaken,
+};
+
+BranchOutcome get_branch_outcome(AstNodeType jump, AbstractFlags flags)
+{
+    if (jump == AstNodeTypeJmp)
+    {
+        return BranchOutcomeAlwaysTaken;
+    }
+    if (flags == AbstractFlagsUnknown)
+    {
+        return BranchOutcomeUnknown;
+    }
+    bool taken = false;
+    switch (jump)
+    {
+        case AstNodeTypeJl: taken = flags == AbstractFlagsLess; break;
+        case AstNodeTypeJle: taken = flags != AbstractFlagsGreater; break;
+        case AstNodeTypeJeq: taken = flags == AbstractFlagsEqual; break;
+        case AstNodeTypeJge: taken = flags != AbstractFlagsLess; break;
+        case AstNodeTypeJg: taken = flags == AbstractFlagsGreater; break;
+        case AstNodeTypeJne: taken = flags != AbstractFlagsEqual; break;
+        default: break;
+    }
+    return taken ? BranchOutcomeAlwaysTaken : BranchOutcomeNeverTaken;
+}
+
+struct StackStateAnalysis
+{
+    ControlFlowGraph graph;
+    AbstractState* block_states; // at the start of every block
+    bool has_unknown_jumps; // some reachable jump or return goes to an address that isn't known statically
+
+    void deallocate()
+    {
+        graph.deallocate();
+        free(block_states);
+    }
+
+    // applies a single node to the state, the target of jumps, calls and returns goes to target
+    void step(AbstractState* state, u64 index, AbstractValue* target)
+    {
+        auto node = graph.ast.data[index];
+        auto evaluation = &state->evaluation_stack;
+        *target = AbstractValue::make(AbstractValueTypeUnknown);
+        switch (node.type)
+        {
+            case AstNodeTypePush:
+            {
+                auto value = AbstractValue::make(AbstractValueTypeUnknown);
+                if (node.push_type == PushNodeTypeInteger)
+                {
+                    value.type = AbstractValueTypeInteger;
+                    value.integer = node.integer;
+                }
+                else if (node.push_type == PushNodeTypeLabel)
+                {
+                    value.type = AbstractValueTypeLabel;
+                    value.label = node.label;
+                }
+                evaluation->push(value);
+                break;
+            }
+            case AstNodeTypePop:
+                evaluation->pop();
+                break;
+            case AstNodeTypeAdd:
+            case AstNodeTypeSub:
+            case AstNodeTypeAnd:
+            case AstNodeTypeOr:
+            case AstNodeTypeXor:
+            case AstNodeTypeShl:
+            case AstNodeTypeShr:
+            case AstNodeTypeMul:
+            case AstNodeTypeMulh:
+            {
+                auto right = evaluation->pop();
+                auto left = evaluation->pop();
+                auto value = AbstractValue::make(AbstractValueTypeUnknown);
+                if (left.type == AbstractValueTypeInteger && right.type == AbstractValueTypeInteger)
+                {
+                    value.type = AbstractValueTypeInteger;
+                    value.integer = node.compute(left.integer, right.integer);
+                }
+                evaluation->push(value);
+                break;
+            }
+            case AstNodeTypeNot:
+            case AstNodeTypeNeg:
+            case AstNodeTypeEqz:
+            {
+                auto operand = evaluation->pop();
+                auto value = AbstractValue::make(AbstractValueTypeUnknown);
+                if (operand.type == AbstractValueTypeInteger)
+                {
+                    value.type = AbstractValueTypeInteger;
+                    value.integer = node.compute(operand.integer, 0);
+                }
+                evaluation->push(value);
+                break;
+            }
+            case AstNodeTypeCmp:
+            {
+                auto right = evaluation->pop();
+                auto left = evaluation->pop();
+                state->flags = AbstractFlagsUnknown;
+                if (left.type == AbstractValueTypeInteger && right.type == AbstractValueTypeInteger)
+                {
+                    state->flags = left.integer < right.integer ? AbstractFlagsLess
+                        : left.integer > right.integer ? AbstractFlagsGreater
+                        : AbstractFlagsEqual;
+                }
+                else if (left.is_known() && left == right)
+                {
+                    state->flags = AbstractFlagsEqual;
+                }
+                break;
+            }
+            case AstNodeTypeJl:
+            case AstNodeTypeJle:
+            case AstNodeTypeJeq:
+            case AstNodeTypeJge:
+            case AstNodeTypeJg:
+            case AstNodeTypeJne:
+            case AstNodeTypeJmp:
+                *target = evaluation->pop();
+                break;
+            case AstNodeTypeDup:
+                evaluation->push(evaluation->peek());
+                break;
+            case AstNodeTypeOut:
+                evaluation->pop();
+                evaluation->pop();
+                break;
+            case AstNodeTypePushNothing:
+                evaluation->push(AbstractValue::make(AbstractValueTypeUnknown));
+                break;
+            case AstNodeTypeDdup:
+            {
+                auto value = evaluation->pop();
+                evaluation->pop();
+                evaluation->push(value);
+                break;
+            }
+            case AstNodeTypeStore:
+                state->general_stack.push(evaluation->pop());
+                break;
+            case AstNodeTypeLoad:
+                evaluation->push(state->general_stack.pop());
+                break;
+            case AstNodeTypeRomload:
+                evaluation->pop();
+                evaluation->push(AbstractValue::make(AbstractValueTypeUnknown));
+                break;
+            case AstNodeTypeCall:
+            {
+                *target = evaluation->pop();
+                auto return_address = AbstractValue::make(AbstractValueTypeReturnAddress);
+                return_address.call_index = index;
+                state->general_stack.push(return_address);
+                break;
+            }
+            case AstNodeTypeRet:
+                *target = state->general_stack.pop();
+                break;
+            case AstNodeTypeDelay:
+                // the routines it turns into leave both stacks alone, but their tests compare
+                state->flags = AbstractFlagsUnknown;
+                break;
+            case AstNodeTypeNop:
+            case AstNodeTypeHalt:
+            case AstNodeTypeLabel:
+            case AstNodeTypeData: // split off by parse_ast
+                break;
+        }
+    }
+
+    // NO_BLOCK if the value isn't a known address
+    u64 get_target_block(AbstractValue target)
+    {
+        if (target.type == AbstractValueTypeLabel)
+        {
+            return graph.get_block_of(graph.ast.find_label(target.label));
+        }
+        if (target.type == AbstractValueTypeReturnAddress)
+        {
+            return graph.get_block_of(target.call_index + 1);
+        }
+        return NO_BLOCK;
+    }
+
+    // labels that are pushed for anything other than a jump or a call right after,
+    // and the return addresses of all calls
+    bool is_possible_unknown_target(u64 block)
+    {
+        auto begin = graph.blocks[block].begin;
+        if (begin != 0 && graph.ast.data[begin-1].type == AstNodeTypeCall)
+        {
+            return true;
+        }
+        return graph.blocks[block].is_address_taken;
+    }
+
+    void run()
+    {
+        auto worklist = (u64*)malloc(graph.block_count * sizeof(u64));
+        auto is_in_worklist = (bool*)calloc(graph.block_count, sizeof(bool));
+        u64 worklist_size = 0;
+
+        auto propagate = [&](u64 block, AbstractState state) {
+            if (block != NO_BLOCK && block_states[block].join(state) && !is_in_worklist[block])
+            {
+                is_in_worklist[block] = true;
+                worklist[worklist_size++] = block;
+            }
+        };
+
+        has_unknown_jumps = false;
+        bool are_unknown_targets_seeded = false;
+        propagate(0, AbstractState::make_unknown());
+
+        while (worklist_size != 0)
+        {
+            auto block_index = worklist[--worklist_size];
+            is_in_worklist[block_index] = false;
+            auto block = graph.blocks[block_index];
+
+            auto state = block_states[block_index];
+            AbstractValue target;
+            for (auto i = block.begin; i < block.end; i++)
+            {
+                step(&state, i, &target);
+            }
+
+            auto last = graph.ast.data[block.get_last_node()];
+            if (last.is_jump() || last.type == AstNodeTypeCall || last.type == AstNodeTypeRet)
+            {
+                auto target_block = get_target_block(target);
+                auto outcome = last.is_jump() ? get_branch_outcome(last.type, state.flags) : BranchOutcomeAlwaysTaken;
+                if (outcome != BranchOutcomeNeverTaken)
+                {
+                    if (target_block == NO_BLOCK)
+                    {
+                        has_unknown_jumps = true;
+                    }
+                    propagate(target_block, state);
+                }
+                if (last.is_jump() && last.type != AstNodeTypeJmp && outcome != BranchOutcomeAlwaysTaken)
+                {
+                    propagate(graph.get_block_of(block.end), state);
+                }
+            }
+            else if (last.falls_through())
+            {
+                propagate(graph.get_block_of(block.end), state);
+            }
+
+            if (worklist_size == 0 && has_unknown_jumps && !are_unknown_targets_seeded)
+            {
+                are_unknown_targets_seeded = true;
+                for (u64 i = 0; i < graph.block_count; i++)
+                {
+                    if (is_possible_unknown_target(i))
+                    {
+                        propagate(i, AbstractState::make_unknown());
+                    }
+                }
+            }
+        }
+
+        free(worklist);
+        free(is_in_worklist);
+    }
+
+    // the state right before the node at index
+    AbstractState get_state_before(u64 index)
+    {
+        auto block = graph.get_block_of(index);
+        auto state = block_states[block];
+        AbstractValue target;
+        for (auto i = graph.blocks[block].begin; i < index && state.is_reachable; i++)
+        {
+            step(&state, i, &target);
+        }
+        return state;
+    }
+};
+
+StackStateAnalysis analyze_stack_state(Ast ast)
+{
+    StackStateAnalysis result;
+    result.graph = build_control_flow_graph(ast);
+    result.block_states = (AbstractState*)malloc((result.graph.block_count + 1) * sizeof(AbstractState));
+    for (u64 i = 0; i < result.graph.block_count; i++)
+    {
+        result.block_states[i] = AbstractState::make_unknown();
+        result.block_states[i].is_reachable = false;
+    }
+    result.run();
+    return result;
+}
+
+struct ConstantPropagationResult
+{
+    Ast ast;
+    u64 folded_branches;
+};
+
+// folds conditional jumps whose outcome is known: always taken becomes `jmp`, never taken becomes `pop`,
+// which leaves the code after an always-taken jump and the `push <label>, pop` of a never-taken one
+// for the dead code eliminator and the peephole optimizer
+ConstantPropagationResult propagate_constants(Ast ast)
+{
+    auto analysis = analyze_stack_state(ast);
+
+    ConstantPropagationResult result;
+    result.ast = ast;
+    result.folded_branches = 0;
+
+    for (u64 i = 0; i < ast.size; i++)
+    {
+        auto node = ast.data[i];
+        if (!node.is_jump() || node.type == AstNodeTypeJmp)
+        {
+            continue;
+        }
+        auto state = analysis.get_state_before(i);
+        if (!state.is_reachable)
+        {
+            continue;
+        }
+        auto outcome = get_branch_outcome(node.type, state.flags);
+        if (outcome == BranchOutcomeAlwaysTaken)
+        {
+            result.ast.data[i].type = AstNodeTypeJmp;
+            result.folded_branches++;
+        }
+        else if (outcome == BranchOutcomeNeverTaken)
+        {
+            result.ast.data[i].type = AstNodeTypePop;
+            result.folded_branches++;
+        }
+    }
+
+    analysis.deallocate();
+    return result;
+}
@@ -0,0 +1,495 @@
+// Basic blocks of an Ast and the edges between them that are known without looking at values.
+// A block starts at address 0, at a run of labels and after every jump, `call` and `ret`.
+// A `call` ends its block: the block falls through to the return address and refers to the callee separately,
+// so the graph of a function doesn't include the bodies of the functions it calls.
+
+const u64 NO_BLOCK = (u64)-1;
+
+struct BasicBlock
+{
+    u64 begin;
+    u64 end;
+    u64 successors[2];
+    u64 successor_count;
+    bool has_unknown_successor; // a computed jump or a `ret`
+    u64 call_target; // NO_BLOCK if the block doesn't end with a call to a known function
+    bool is_address_taken; // one of its labels is pushed for something other than a jump or a call
+    u64 predecessors_begin; // into ControlFlowGraph::predecessors
+    u64 predecessor_count;
+    u64 immediate_dominator; // NO_BLOCK for entries and blocks that can't be reached
+
+    u64 get_last_node()
+    {
+        return end - 1;
+    }
+
+    bool has_successor(u64 block)
+    {
+        for (u64 i = 0; i < successor_count; i++)
+        {
+            if (successors[i] == block)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void add_successor(u64 block)
+    {
+        if (block != NO_BLOCK && !has_successor(block))
+        {
+            successors[successor_count] = block;
+            successor_count++;
+        }
+    }
+};
+
+// a back edge to header together with every block that can reach it without going through header
+struct Loop
+{
+    u64 header;
+    bool* contains; // indexed by block
+    u64 block_count;
+};
+
+struct Loops
+{
+    u64 capacity;
+    u64 size;
+    Loop* data;
+
+    static const u64 DEFAULT_CAPACITY = 8;
+
+    static Loops allocate()
+    {
+        Loops result;
+        result.capacity = DEFAULT_CAPACITY;
+        result.size = 0;
+        result.data = (Loop*)malloc(result.capacity * sizeof(Loop));
+        return result;
+    }
+
+    void deallocate()
+    {
+        for (u64 i = 0; i < size; i++)
+        {
+            free(data[i].contains);
+        }
+        free(data);
+    }
+
+    void push(Loop loop)
+    {
+        if (size == capacity)
+        {
+            capacity *= 2;
+            data = (Loop*)realloc(data, capacity * sizeof(Loop));
+        }
+        data[size] = loop;
+        size++;
+    }
+};
+
+struct ControlFlowGraph
+{
+    Ast ast;
+    u64 block_count;
+    BasicBlock* blocks;
+    u64* node_blocks; // index of the block every node belongs to
+    u64* predecessors;
+    bool* is_entry_block; // block 0, call targets and address-taken labels
+
+    void deallocate()
+    {
+        free(blocks);
+        free(node_blocks);
+        free(predecessors);
+        free(is_entry_block);
+    }
+
+    // NO_BLOCK for index == ast.size
+    u64 get_block_of(u64 node_index)
+    {
+        return node_index < ast.size ? node_blocks[node_index] : NO_BLOCK;
+    }
+
+    u64 get_predecessor(u64 block, u64 index)
+    {
+        return predecessors[blocks[block].predecessors_begin + index];
+    }
+
+    bool dominates(u64 dominator, u64 block)
+    {
+        while (block != NO_BLOCK)
+        {
+            if (block == dominator)
+            {
+                return true;
+            }
+            block = blocks[block].immediate_dominator;
+        }
+        return false;
+    }
+
+    void find_predecessors()
+    {
+        for (u64 i = 0; i < block_count; i++)
+        {
+            blocks[i].predecessor_count = 0;
+        }
+        for (u64 i = 0; i < block_count; i++)
+        {
+            for (u64 k = 0; k < blocks[i].successor_count; k++)
+            {
+                blocks[blocks[i].successors[k]].predecessor_count++;
+            }
+        }
+        u64 total = 0;
+        for (u64 i = 0; i < block_count; i++)
+        {
+            blocks[i].predecessors_begin = total;
+            total += blocks[i].predecessor_count;
+            blocks[i].predecessor_count = 0;
+        }
+        predecessors = (u64*)malloc((total + 1) * sizeof(u64));
+        for (u64 i = 0; i < block_count; i++)
+        {
+            for (u64 k = 0; k < blocks[i].successor_count; k++)
+            {
+                auto successor = &blocks[blocks[i].successors[k]];
+                predecessors[successor->predecessors_begin + successor->predecessor_count] = i;
+                successor->predecessor_count++;
+            }
+        }
+    }
+
+    // Cooper, Harvey and Kennedy's iterative algorithm, with a virtual root at index block_count
+    // whose successors are the entry blocks
+    void find_dominators()
+    {
+        auto root = block_count;
+        auto dominators = (u64*)malloc((block_count + 1) * sizeof(u64));
+        auto order = (u64*)malloc((block_count + 1) * sizeof(u64)); // reverse postorder
+        auto postorder_numbers = (u64*)malloc((block_count + 1) * sizeof(u64));
+        auto stack = (u64*)malloc((block_count + 1) * sizeof(u64));
+        auto next_successor = (u64*)calloc(block_count + 1, sizeof(u64));
+        auto visited = (bool*)calloc(block_count + 1, sizeof(bool));
+
+        auto get_successor_count = [&](u64 block) {
+            return block == root ? block_count : blocks[block].successor_count;
+        };
+        // NO_BLOCK for the blocks the root skips
+        auto get_successor = [&](u64 block, u64 index) {
+            if (block == root)
+            {
+                return is_entry_block[index] ? index : NO_BLOCK;
+            }
+            return blocks[block].successors[index];
+        };
+
+        u64 visited_count = 0;
+        u64 stack_size = 1;
+        stack[0] = root;
+        visited[root] = true;
+        while (stack_size != 0)
+        {
+            auto block = stack[stack_size-1];
+            if (next_successor[block] < get_successor_count(block))
+            {
+                auto successor = get_successor(block, next_successor[block]);
+                next_successor[block]++;
+                if (successor != NO_BLOCK && !visited[successor])
+                {
+                    visited[successor] = true;
+                    stack[stack_size++] = successor;
+                }
+                continue;
+            }
+            postorder_numbers[block] = visited_count;
+            visited_count++;
+            order[block_count + 1 - visited_count] = block;
+            stack_size--;
+        }
+        auto first = block_count + 1 - visited_count;
+
+        for (u64 i = 0; i <= block_count; i++)
+        {
+            dominators[i] = NO_BLOCK;
+        }
+        dominators[root] = root;
+
+        auto intersect = [&](u64 left, u64 right) {
+            while (left != right)
+            {
+                while (postorder_numbers[left] < postorder_numbers[right])
+                {
+                    left = dominators[left];
+                }
+                while (postorder_numbers[right] < postorder_numbers[left])
+                {
+                    right = dominators[right];
+                }
+            }
+            return left;
+        };
+
+        bool changed = true;
+        while (changed)
+        {
+            changed = false;
+            for (auto i = first + 1; i <= block_count; i++) // order[first] is the root
+            {
+                auto block = order[i];
+                auto dominator = is_entry_block[block] ? root : NO_BLOCK;
+                for (u64 k = 0; k < blocks[block].predecessor_count; k++)
+                {
+                    auto predecessor = get_predecessor(block, k);
+                    if (dominators[predecessor] == NO_BLOCK)
+                    {
+                        continue; // not processed yet or unreachable
+                    }
+                    dominator = dominator == NO_BLOCK ? predecessor : intersect(dominator, predecessor);
+                }
+                if (dominators[block] != dominator)
+                {
+                    dominators[block] = dominator;
+                    changed = true;
+                }
+            }
+        }
+
+        for (u64 i = 0; i < block_count; i++)
+        {
+            blocks[i].immediate_dominator = dominators[i] == root ? NO_BLOCK : dominators[i];
+        }
+
+        free(dominators);
+        free(order);
+        free(postorder_numbers);
+        free(stack);
+        free(next_successor);
+        free(visited);
+    }
+
+    // loops that share a header are merged into one
+    Loops find_loops()
+    {
+        auto result = Loops::allocate();
+        auto worklist = (u64*)malloc((block_count + 1) * sizeof(u64));
+
+        for (u64 header = 0; header < block_count; header++)
+        {
+            Loop loop;
+            loop.header = header;
+            loop.contains = NULL;
+            loop.block_count = 0;
+            u64 worklist_size = 0;
+
+            for (u64 k = 0; k < blocks[header].predecessor_count; k++)
+            {
+                auto latch = get_predecessor(header, k);
+                if (!dominates(header, latch))
+                {
+                    continue;
+                }
+                if (loop.contains == NULL)
+                {
+                    loop.contains = (bool*)calloc(block_count, sizeof(bool));
+                    loop.contains[header] = true;
+                    loop.block_count = 1;
+                }
+                if (!loop.contains[latch])
+                {
+                    loop.contains[latch] = true;
+                    loop.block_count++;
+                    worklist[worklist_size++] = latch;
+                }
+            }
+
+            while (worklist_size != 0)
+            {
+                auto block = worklist[--worklist_size];
+                for (u64 k = 0; k < blocks[block].predecessor_count; k++)
+                {
+                    auto predecessor = get_predecessor(block, k);
+                    if (!loop.contains[predecessor])
+                    {
+                        loop.contains[predecessor] = true;
+                        loop.block_count++;
+                        worklist[worklist_size++] = predecessor;
+                    }
+                }
+            }
+
+            if (loop.contains != NULL)
+            {
+                result.push(loop);
+            }
+        }
+
+        free(worklist);
+        return result;
+    }
+
+    // Graphviz, one box per block with its instructions, dashed edges for calls
+    void print_dot(FILE* file)
+    {
+        fprintf(file, "digraph cfg {\n");
+        fprintf(file, "    node [shape=box, fontname=monospace];\n");
+        for (u64 i = 0; i < block_count; i++)
+        {
+            auto block = blocks[i];
+            fprintf(file, "    b%llu [label=\"", (unsigned long long)i);
+            for (auto k = block.begin; k < block.end; k++)
+            {
+                auto text = ast.data[k].to_string();
+                if (ast.data[k].type == AstNodeTypeLabel)
+                {
+                    text.push(ast.data[k].label);
+                    text.push(':');
+                }
+                for (u64 c = 0; c < text.size; c++)
+                {
+                    if (text.data[c] == '"' || text.data[c] == '\\')
+                    {
+                        fputc('\\', file);
+                    }
+                    fputc(text.data[c], file);
+                }
+                fprintf(file, "\\l");
+            }
+            fprintf(file, "\"");
+            if (is_entry_block[i])
+            {
+                fprintf(file, ", penwidth=2");
+            }
+            fprintf(file, "];\n");
+
+            for (u64 k = 0; k < block.successor_count; k++)
+            {
+                auto successor = block.successors[k];
+                fprintf(file, "    b%llu -> b%llu", (unsigned long long)i, (unsigned long long)successor);
+                if (dominates(successor, i))
+                {
+                    fprintf(file, " [color=red]"); // back edge
+                }
+                fprintf(file, ";\n");
+            }
+            if (block.call_target != NO_BLOCK)
+            {
+                fprintf(file, "    b%llu -> b%llu [style=dashed];\n", (unsigned long long)i, (unsigned long long)block.call_target);
+            }
+            if (block.has_unknown_successor)
+            {
+                fprintf(file, "    b%llu -> unknown%llu [style=dotted];\n", (unsigned long long)i, (unsigned long long)i);
+                fprintf(file, "    unknown%llu [label=\"?\", shape=plaintext];\n", (unsigned long long)i);
+            }
+        }
+        fprintf(file, "}\n");
+    }
+};
+
+bool ends_basic_block(AstNode node)
+{
+    return node.is_jump() || node.type == AstNodeTypeCall || !node.falls_through();
+}
+
+ControlFlowGraph build_control_flow_graph(Ast ast)
+{
+    ControlFlowGraph result;
+    result.ast = ast;
+    result.node_blocks = (u64*)malloc((ast.size + 1) * sizeof(u64));
+    result.blocks = (BasicBlock*)malloc((ast.size + 1) * sizeof(BasicBlock));
+    result.block_count = 0;
+
+    for (u64 i = 0; i < ast.size; i++)
+    {
+        auto is_leader = i == 0
+            || ends_basic_block(ast.data[i-1])
+            || ast.data[i].type == AstNodeTypeLabel && ast.data[i-1].type != AstNodeTypeLabel;
+        if (is_leader)
+        {
+            if (result.block_count != 0)
+            {
+                result.blocks[result.block_count-1].end = i;
+            }
+            BasicBlock block;
+            block.begin = i;
+            block.end = ast.size;
+            block.successor_count = 0;
+            block.has_unknown_successor = false;
+            block.call_target = NO_BLOCK;
+            block.is_address_taken = false;
+            result.blocks[result.block_count] = block;
+            result.block_count++;
+        }
+        result.node_blocks[i] = result.block_count - 1;
+    }
+
+    result.is_entry_block = (bool*)calloc(result.block_count + 1, sizeof(bool));
+    if (result.block_count != 0)
+    {
+        result.is_entry_block[0] = true;
+    }
+
+    for (u64 i = 0; i < ast.size; i++)
+    {
+        if (!ast.is_address_taken(i))
+        {
+            continue;
+        }
+        auto labels = Strings::allocate();
+        ast.data[i].collect_referenced_labels(&labels);
+        for (u64 k = 0; k < labels.size; k++)
+        {
+            auto block = result.get_block_of(ast.find_label(labels.data[k]));
+            if (block != NO_BLOCK)
+            {
+                result.blocks[block].is_address_taken = true;
+                result.is_entry_block[block] = true;
+            }
+        }
+        labels.deallocate();
+    }
+
+    for (u64 i = 0; i < result.block_count; i++)
+    {
+        auto block = &result.blocks[i];
+        auto last = block->get_last_node();
+        auto node = ast.data[last];
+        auto target = node.is_jump() || node.type == AstNodeTypeCall
+            ? result.get_block_of(ast.get_jump_target(last))
+            : NO_BLOCK;
+
+        if (node.is_jump() || node.type == AstNodeTypeRet)
+        {
+            if (target == NO_BLOCK)
+            {
+                block->has_unknown_successor = true;
+            }
+            block->add_successor(target);
+        }
+        if (node.type == AstNodeTypeCall)
+        {
+            block->call_target = target;
+            if (target == NO_BLOCK)
+            {
+                block->has_unknown_successor = true;
+            }
+            else
+            {
+                result.is_entry_block[target] = true;
+            }
+        }
+        if (node.falls_through())
+        {
+            block->add_successor(result.get_block_of(block->end));
+        }
+    }
+
+    result.find_predecessors();
+    result.find_dominators();
+
+    return result;
+}
@@ -0,0 +1,41 @@
+enum OptimizationPriority
+{
+    OptimizationPrioritySpeed,
+    OptimizationPrioritySize,
+};
+
+// Weighs ROM bytes against clock cycles for the transformations that trade one for the other.
+struct CostModel
+{
+    OptimizationPriority priority;
+    u64 rom_budget;
+
+    static const u64 DEFAULT_ROM_BUDGET = 256; // the instruction register is 8 bits wide
+    static const u64 ESTIMATED_LOOP_ITERATIONS = 8; // for loops whose trip count isn't known statically
+
+    static CostModel make(OptimizationPriority priority)
+    {
+        CostModel result;
+        result.priority = priority;
+        result.rom_budget = DEFAULT_ROM_BUDGET;
+        return result;
+    }
+
+    // positive if the transformation is worth doing
+    s64 score(s64 bytes_added, s64 cycles_saved)
+    {
+        if (priority == OptimizationPrioritySpeed)
+        {
+            return 4 * cycles_saved - bytes_added;
+        }
+        else // OptimizationPrioritySize
+        {
+            return cycles_saved - 4 * bytes_added;
+        }
+    }
+
+    bool fits(u64 program_size)
+    {
+        return program_size <= rom_budget;
+    }
+};
@@ -0,0 +1,147 @@
+// Drops code that can't be reached from address 0.
+// Edges are fall-through, `push <label>, j*` and `push <label>, call` (which also falls through to the return address).
+// A label that is pushed for any other reason has its address taken and might be jumped to from anywhere,
+// so it counts as reachable as well, which also covers computed jumps and calls.
+
+struct DeadCodeEliminatorState
+{
+    Ast ast;
+    bool* reachable;
+    u64* worklist;
+    u64 worklist_size;
+
+    void mark(u64 index)
+    {
+        if (index < ast.size && !reachable[index])
+        {
+            reachable[index] = true;
+            worklist[worklist_size++] = index;
+        }
+    }
+
+    void find_reachable_nodes()
+    {
+        auto labels = Strings::allocate();
+        for (u64 i = 0; i < ast.size; i++)
+        {
+            if (ast.is_address_taken(i))
+            {
+                ast.data[i].collect_referenced_labels(&labels);
+            }
+        }
+        for (u64 i = 0; i < labels.size; i++)
+        {
+            mark(ast.find_label(labels.data[i]));
+        }
+        labels.deallocate();
+        mark(0);
+
+        while (worklist_size != 0)
+        {
+            auto index = worklist[--worklist_size];
+            auto node = ast.data[index];
+            if (node.is_jump())
+            {
+                mark(ast.get_jump_target(index));
+            }
+            if (node.type == AstNodeTypeCall && index != 0 && ast.data[index-1].is_push_label())
+            {
+                mark(ast.find_label(ast.data[index-1].label));
+            }
+            if (node.falls_through())
+            {
+                mark(index + 1);
+            }
+        }
+    }
+
+    // a label stays as long as anything that survives still refers to it
+    void keep_referenced_labels()
+    {
+        auto labels = Strings::allocate();
+        for (u64 i = 0; i < ast.size; i++)
+        {
+            if (reachable[i])
+            {
+                ast.data[i].collect_referenced_labels(&labels);
+            }
+        }
+        for (u64 i = 0; i < labels.size; i++)
+        {
+            reachable[ast.find_label(labels.data[i])] = true;
+        }
+        labels.deallocate();
+    }
+};
+
+struct DeadCodeEliminationResult
+{
+    Ast ast;
+    u64 bytes_saved;
+};
+
+DeadCodeEliminationResult eliminate_dead_code(Ast ast)
+{
+    DeadCodeEliminatorState state;
+    state.ast = ast;
+    state.reachable = (bool*)calloc(ast.size + 1, sizeof(bool));
+    state.worklist = (u64*)malloc((ast.size + 1) * sizeof(u64));
+    state.worklist_size = 0;
+
+    state.find_reachable_nodes();
+    state.keep_referenced_labels();
+
+    DeadCodeEliminationResult result;
+    result.ast = Ast::allocate();
+    result.bytes_saved = 0;
+
+    for (u64 i = 0; i < ast.size; )
+    {
+        if (state.reachable[i])
+        {
+            result.ast.push(ast.data[i]);
+            i++;
+            continue;
+        }
+
+        // report each unreachable region under the first label in it
+        auto region_begin = i;
+        while (i < ast.size && !state.reachable[i])
+        {
+            i++;
+        }
+        auto region_size = ast.get_size_between(region_begin, i);
+        result.bytes_saved += region_size;
+        if (region_size == 0)
+        {
+            continue; // only unused labels
+        }
+
+        fprintf(stderr, "Dead code eliminator: removed ");
+        auto label_index = region_begin;
+        while (label_index != i && ast.data[label_index].type != AstNodeTypeLabel)
+        {
+            label_index++;
+        }
+        if (label_index != i)
+        {
+            fprintf(stderr, "%.*s", (int)ast.data[label_index].label.size, ast.data[label_index].label.data);
+        }
+        else
+        {
+            fprintf(stderr, "unlabeled code");
+        }
+        fprintf(
+            stderr,
+            " (lines %llu-%llu), %llu bytes\n",
+            (unsigned long long)ast.data[region_begin].line,
+            (unsigned long long)ast.data[i-1].line,
+            (unsigned long long)region_size
+        );
+    }
+
+    free(state.reachable);
+    free(state.worklist);
+
+    return result;
+}
@@ -0,0 +1,346 @@
+// Turns `delay <cycles>` into code that takes exactly that many cycles.
+// Every delay becomes a few calls of shared counting loops plus fewer than one call's worth of `nop`s:
+//
+//     __delay_L: dup, push 0, cmp, push __delay_L_end, jeq   fused into cmp_jeq, see branch_fusion.cpp
+//                [push 255, push __delay_{L-1}, call]       only for L > 1
+//                push 255, add, push __delay_L, jmp
+//     __delay_L_end: pop, ret
+//
+// `push n, push __delay_L, call` runs level L n times, and each iteration of level L runs level L-1
+// 255 times. The routines are generated once per program, only for the levels some delay uses.
+// All timings are derived from the cycle counts of the generated nodes, so they follow get_cycles, which counts
+// the `jeq` of the test as not taken; the last test takes it.
+// In a program bigger than one page, every call and jump of the delays is far and every return address takes two
+// bytes, whether or not that is needed where the routines end up, so the timings only depend on is_wide. main
+// lowers the delays again once address relaxation finds that a program doesn't fit in one page.
+// While a delay runs, each level keeps its counter on the evaluation stack (two more values on top of
+// the innermost one) and its return address on the general stack.
+// A delay leaves both stacks as they were but not the flags: the tests compare, so a conditional jump after a
+// delay sees the flags of the last one.
+
+const u64 DELAY_LEVELS = 4;
+const u8 DELAY_INNER_COUNT = 255;
+
+struct DelayRoutine
+{
+    Ast test; // runs once more than the loop body, the last time jumping to the exit
+    Ast iteration;
+    Ast exit;
+};
+
+String get_delay_label(u64 level, const char* suffix)
+{
+    auto result = String::allocate();
+    result.push("__delay_");
+    result.push(level);
+    result.push(suffix);
+    return result;
+}
+
+// the forms address relaxation can give the calls and jumps, decided up front
+void set_delay_addressing(Ast ast, bool is_wide)
+{
+    for (u64 i = 0; i < ast.size; i++)
+    {
+        auto node = &ast.data[i];
+        if (node->type == AstNodeTypeCall || node->type == AstNodeTypeRet)
+        {
+            node->has_wide_return_address = is_wide;
+        }
+        if (node->is_jump() || node->type == AstNodeTypeCall)
+        {
+            node->is_far = is_wide;
+        }
+    }
+}
+
+DelayRoutine make_delay_routine(u64 level, u64 line, bool is_wide)
+{
+    auto entry_label = get_delay_label(level, "");
+    auto end_label = get_delay_label(level, "_end");
+
+    DelayRoutine result;
+    result.test = Ast::allocate();
+    result.test.push(AstNode::make_label(entry_label, line));
+    result.test.push(AstNode::make(AstNodeTypeDup, line));
+    result.test.push(AstNode::make_push_integer(0, line));
+    result.test.push(AstNode::make(AstNodeTypeCmp, line));
+    result.test.push(AstNode::make_push_label(end_label, line));
+    result.test.push(AstNode::make(AstNodeTypeJeq, line));
+
+    result.iteration = Ast::allocate();
+    if (level > 1)
+    {
+        result.iteration.push(AstNode::make_push_integer(DELAY_INNER_COUNT, line));
+        result.iteration.push(AstNode::make_push_label(get_delay_label(level - 1, ""), line));
+        result.iteration.push(AstNode::make(AstNodeTypeCall, line));
+    }
+    result.iteration.push(AstNode::make_push_integer(255, line)); // -1
+    result.iteration.push(AstNode::make(AstNodeTypeAdd, line));
+    result.iteration.push(AstNode::make_push_label(entry_label, line));
+    result.iteration.push(AstNode::make(AstNodeTypeJmp, line));
+
+    result.exit = Ast::allocate();
+    result.exit.push(AstNode::make_label(end_label, line));
+    result.exit.push(AstNode::make(AstNodeTypePop, line));
+    result.exit.push(AstNode::make(AstNodeTypeRet, line));
+
+    // timed in the form the jumps are emitted in
+    result.test = fuse_branches(result.test).ast;
+    result.iteration = fuse_branches(result.iteration).ast;
+    set_delay_addressing(result.test, is_wide);
+    set_delay_addressing(result.iteration, is_wide);
+    set_delay_addressing(result.exit, is_wide);
+    return result;
+}
+
+Ast make_delay_call(u64 level, u8 count, u64 line, bool is_wide)
+{
+    auto result = Ast::allocate();
+    result.push(AstNode::make_push_integer(count, line));
+    result.push(AstNode::make_push_label(get_delay_label(level, ""), line));
+    result.push(AstNode::make(AstNodeTypeCall, line));
+    result = fuse_branches(result).ast;
+    set_delay_addressing(result, is_wide);
+    return result;
+}
+
+// cycles of `push count, push __delay_L, call` including everything the routine does
+struct DelayTimings
+{
+    u64 call_size;
+    u64 call_cycles; // just the call sequence
+    u64 call_overhead; // the call sequence, the last test jumping to the exit, and the exit
+    u64 iteration_cycles[DELAY_LEVELS + 1]; // a test and one pass of the body, inner levels included
+
+    u64 get_call_cycles(u64 level, u64 count)
+    {
+        return call_overhead + count * iteration_cycles[level];
+    }
+};
+
+DelayTimings compute_delay_timings(bool is_wide)
+{
+    DelayTimings result;
+    auto call = make_delay_call(1, 0, 0, is_wide);
+    auto routine = make_delay_routine(1, 0, is_wide);
+    result.call_size = call.get_size();
+    result.call_cycles = call.get_cycles();
+    result.call_overhead = call.get_cycles() + routine.test.get_cycles() + TAKEN_JUMP_PENALTY + routine.exit.get_cycles();
+    result.iteration_cycles[0] = 0;
+    for (u64 level = 1; level <= DELAY_LEVELS; level++)
+    {
+        routine = make_delay_routine(level, 0, is_wide);
+        auto inner = level > 1 ? result.get_call_cycles(level - 1, DELAY_INNER_COUNT) - result.call_cycles : 0;
+        result.iteration_cycles[level] = routine.test.get_cycles() + routine.iteration.get_cycles() + inner;
+    }
+    return result;
+}
+
+DelayTimings get_delay_timings(bool is_wide)
+{
+    // the size of every delay node depends on them
+    static auto timings = compute_delay_timings(false);
+    static auto wide_timings = compute_delay_timings(true);
+    return is_wide ? wide_timings : timings;
+}
+
+// how long the routine called at call_index takes, not counting the call sequence,
+// false if it isn't a delay routine called with a constant count
+bool get_delay_routine_cycles(Ast ast, u64 call_index, u64* cycles)
+{
+    if (call_index < 2 || !ast.data[call_index-1].is_push_label() || !ast.data[call_index-2].is_push_integer())
+    {
+        return false;
+    }
+    auto timings = get_delay_timings(ast.data[call_index].has_wide_return_address);
+    for (u64 level = 1; level <= DELAY_LEVELS; level++)
+    {
+        if (ast.data[call_index-1].label == get_delay_label(level, ""))
+        {
+            *cycles = timings.get_call_cycles(level, ast.data[call_index-2].integer) - timings.call_cycles;
+            return true;
+        }
+    }
+    return false;
+}
+
+struct DelayCall
+{
+    u64 level;
+    u8 count;
+};
+
+struct DelayPlan
+{
+    u64 call_count;
+    DelayCall calls[16];
+    u64 call_size;
+    u64 nops;
+};
+
+// greedily takes the longest call that still fits, the last few cycles are nops
+DelayPlan plan_delay(u64 cycles, bool is_wide)
+{
+    auto timings = get_delay_timings(is_wide);
+    DelayPlan result;
+    result.call_count = 0;
+    auto remaining = cycles;
+    while (true)
+    {
+        u64 level = DELAY_LEVELS;
+        // level 1 is also used with a count of 0, it's the shortest call there is
+        while (level != 0 && remaining < timings.get_call_cycles(level, level == 1 ? 0 : 1))
+        {
+            level--;
+        }
+        if (level == 0)
+        {
+            break;
+        }
+        auto count = (remaining - timings.call_overhead) / timings.iteration_cycles[level];
+        if (count > DELAY_INNER_COUNT)
+        {
+            count = DELAY_INNER_COUNT;
+        }
+        if (result.call_count == sizeof(result.calls) / sizeof(result.calls[0]))
+        {
+            panic("Delay needs too many calls");
+        }
+        DelayCall call;
+        call.level = level;
+        call.count = (u8)count;
+        result.calls[result.call_count++] = call;
+        remaining -= timings.get_call_cycles(level, count);
+    }
+    result.call_size = timings.call_size;
+    result.nops = remaining;
+    return result;
+}
+
+// delay nodes only exist before lower_delays, so they're sized as in a program of one page
+u64 get_delay_size(u64 cycles)
+{
+    auto plan = plan_delay(cycles, false);
+    return plan.call_count * plan.call_size + plan.nops;
+}
+
+struct DelayLoweringResult
+{
+    Ast ast;
+    u64 delays;
+    u64 levels; // how many routines were generated
+};
+
+// every routine gets a loop bound, so the timing analyzer can bound the routines on their own,
+// node_indices, if given, gets the index in the result of the first node that every node of ast became
+DelayLoweringResult lower_delays(Ast ast, TimingAnnotations* annotations, bool is_wide, u64* node_indices = NULL)
+{
+    DelayLoweringResult result;
+    result.delays = 0;
+    result.levels = 0;
+
+    auto lowered = Ast::allocate();
+    u64 first_line = 0;
+    for (u64 i = 0; i < ast.size; i++)
+    {
+        auto node = ast.data[i];
+        if (node_indices != NULL)
+        {
+            node_indices[i] = lowered.size;
+        }
+        if (node.type != AstNodeTypeDelay)
+        {
+            lowered.push(node);
+            continue;
+        }
+        if (result.delays == 0)
+        {
+            first_line = node.line;
+        }
+        result.delays++;
+        auto plan = plan_delay(node.delay_cycles, is_wide);
+        for (u64 k = 0; k < plan.call_count; k++)
+        {
+            auto call = make_delay_call(plan.calls[k].level, plan.calls[k].count, node.line, is_wide);
+            for (u64 n = 0; n < call.size; n++)
+            {
+                lowered.push(call.data[n]);
+            }
+            if (plan.calls[k].level > result.levels)
+            {
+                result.levels = plan.calls[k].level;
+            }
+        }
+        for (u64 k = 0; k < plan.nops; k++)
+        {
+            lowered.push(AstNode::make(AstNodeTypeNop, node.line));
+        }
+    }
+
+    if (result.levels == 0)
+    {
+        result.ast = lowered;
+        return result;
+    }
+
+    // every level calls the one below it
+    auto routines = Ast::allocate();
+    for (u64 level = 1; level <= result.levels; level++)
+    {
+        auto routine = make_delay_routine(level, first_line, is_wide);
+        auto bound = TimingAnnotation::make(first_line);
+        bound.label = routine.test.data[0].label;
+        bound.has_bound = true;
+        bound.max_iterations = DELAY_INNER_COUNT;
+        annotations->push(bound);
+        Ast parts[] = { routine.test, routine.iteration, routine.exit };
+        for (u64 p = 0; p < 3; p++)
+        {
+            for (u64 k = 0; k < parts[p].size; k++)
+            {
+                routines.push(parts[p].data[k]);
+            }
+        }
+    }
+
+    auto append_point = lowered.find_append_point();
+    for (u64 i = 0; node_indices != NULL && i < ast.size; i++)
+    {
+        if (node_indices[i] >= append_point && append_point < lowered.size)
+        {
+            node_indices[i] += routines.size;
+        }
+    }
+    result.ast = Ast::allocate();
+    for (u64 i = 0; i < lowered.size; i++)
+    {
+        if (i == append_point)
+        {
+            for (u64 k = 0; k < routines.size; k++)
+            {
+                result.ast.push(routines.data[k]);
+            }
+        }
+        result.ast.push(lowered.data[i]);
+    }
+    if (append_point >= lowered.size)
+    {
+        auto skip_label = String::allocate();
+        skip_label.push("__delay_skip");
+        if (append_point == lowered.size + 1)
+        {
+            result.ast.push(AstNode::make_push_label(skip_label, first_line));
+            result.ast.push(AstNode::make(AstNodeTypeJmp, first_line));
+        }
+        for (u64 k = 0; k < routines.size; k++)
+        {
+            result.ast.push(routines.data[k]);
+        }
+        if (append_point == lowered.size + 1)
+        {
+            result.ast.push(AstNode::make_label(skip_label, first_line));
+        }
+    }
+    return result;
+}
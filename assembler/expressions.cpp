@@ -0,0 +1,366 @@
+// Constant expressions with C operators and precedence, plus low(x) and high(x).
+// Expressions are evaluated in 64 bits; only the final value is checked against the operand it goes into.
+// A label is the offset in its page, like `push <label>` pushes, except in low(x) and high(x), which take the
+// whole address, so `high(x)` is the page for `far`.
+
+enum ExpressionType
+{
+    ExpressionTypeInteger,
+    ExpressionTypeLabel,
+    ExpressionTypeUnary,
+    ExpressionTypeBinary,
+    ExpressionTypeLow,
+    ExpressionTypeHigh,
+};
+
+struct Expression
+{
+    ExpressionType type;
+    OperatorType operator_type; // only for unary and binary expressions
+    s64 integer;
+    String label;
+    Expression* left; // also the operand of unary expressions, low and high
+    Expression* right;
+
+    static Expression* allocate(ExpressionType type)
+    {
+        auto result = (Expression*)malloc(sizeof(Expression));
+        result->type = type;
+        result->left = NULL;
+        result->right = NULL;
+        return result;
+    }
+
+    bool references_labels()
+    {
+        return type == ExpressionTypeLabel
+            || left != NULL && left->references_labels()
+            || right != NULL && right->references_labels();
+    }
+
+    void collect_labels(Strings* labels)
+    {
+        if (type == ExpressionTypeLabel)
+        {
+            labels->push(label);
+        }
+        if (left != NULL)
+        {
+            left->collect_labels(labels);
+        }
+        if (right != NULL)
+        {
+            right->collect_labels(labels);
+        }
+    }
+
+    void print_to(String* result)
+    {
+        switch (type)
+        {
+            case ExpressionTypeInteger:
+                if (integer < 0)
+                {
+                    result->push('-');
+                    result->push((u64)-integer);
+                }
+                else
+                {
+                    result->push((u64)integer);
+                }
+                break;
+            case ExpressionTypeLabel:
+                result->push(label);
+                break;
+            case ExpressionTypeUnary:
+                result->push(get_operator_spelling(operator_type));
+                left->print_to(result);
+                break;
+            case ExpressionTypeBinary:
+                result->push('(');
+                left->print_to(result);
+                result->push(' ');
+                result->push(get_operator_spelling(operator_type));
+                result->push(' ');
+                right->print_to(result);
+                result->push(')');
+                break;
+            case ExpressionTypeLow:
+            case ExpressionTypeHigh:
+                result->push(type == ExpressionTypeLow ? "low(" : "high(");
+                left->print_to(result);
+                result->push(')');
+                break;
+        }
+    }
+};
+
+// higher binds tighter, 0 for operators that can't be binary
+u64 get_binary_operator_precedence(OperatorType type)
+{
+    switch (type)
+    {
+        case OperatorTypeMultiply:
+        case OperatorTypeDivide:
+        case OperatorTypeModulo:
+            return 8;
+        case OperatorTypePlus:
+        case OperatorTypeMinus:
+            return 7;
+        case OperatorTypeShiftLeft:
+        case OperatorTypeShiftRight:
+            return 6;
+        case OperatorTypeLess:
+        case OperatorTypeLessOrEqual:
+        case OperatorTypeGreater:
+        case OperatorTypeGreaterOrEqual:
+            return 5;
+        case OperatorTypeEqual:
+        case OperatorTypeNotEqual:
+            return 4;
+        case OperatorTypeAnd:
+            return 3;
+        case OperatorTypeXor:
+            return 2;
+        case OperatorTypeOr:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+struct ExpressionParsingState
+{
+    Tokens tokens;
+    u64 token_index;
+    u64 end;
+
+    bool is_token(TokenType type)
+    {
+        return token_index != end && tokens.data[token_index].type == type;
+    }
+
+    Expression* parse_primary()
+    {
+        if (is_token(TokenTypeInteger))
+        {
+            auto result = Expression::allocate(ExpressionTypeInteger);
+            result->integer = tokens.data[token_index].integer;
+            token_index++;
+            return result;
+        }
+
+        if (is_token(TokenTypeOpenParenthesis))
+        {
+            token_index++;
+            auto result = parse_binary(1);
+            if (result == NULL || !is_token(TokenTypeCloseParenthesis))
+            {
+                return NULL;
+            }
+            token_index++;
+            return result;
+        }
+
+        if (is_token(TokenTypeName))
+        {
+            auto name = tokens.data[token_index].name;
+            token_index++;
+            if ((name == "low" || name == "high") && is_token(TokenTypeOpenParenthesis))
+            {
+                auto result = Expression::allocate(name == "low" ? ExpressionTypeLow : ExpressionTypeHigh);
+                result->left = parse_primary();
+                return result->left == NULL ? NULL : result;
+            }
+            auto result = Expression::allocate(ExpressionTypeLabel);
+            result->label = name;
+            return result;
+        }
+
+        return NULL;
+    }
+
+    Expression* parse_unary()
+    {
+        if (is_token(TokenTypeOperator))
+        {
+            auto operator_type = tokens.data[token_index].operator_type;
+            if (operator_type == OperatorTypeMinus || operator_type == OperatorTypePlus || operator_type == OperatorTypeNot)
+            {
+                token_index++;
+                auto operand = parse_unary();
+                if (operand == NULL)
+                {
+                    return NULL;
+                }
+                if (operator_type == OperatorTypePlus)
+                {
+                    return operand;
+                }
+                auto result = Expression::allocate(ExpressionTypeUnary);
+                result->operator_type = operator_type;
+                result->left = operand;
+                return result;
+            }
+        }
+        return parse_primary();
+    }
+
+    // precedence climbing, all binary operators are left associative
+    Expression* parse_binary(u64 minimum_precedence)
+    {
+        auto left = parse_unary();
+        while (left != NULL && is_token(TokenTypeOperator))
+        {
+            auto operator_type = tokens.data[token_index].operator_type;
+            auto precedence = get_binary_operator_precedence(operator_type);
+            if (precedence == 0 || precedence < minimum_precedence)
+            {
+                break;
+            }
+            token_index++;
+            auto right = parse_binary(precedence + 1);
+            if (right == NULL)
+            {
+                return NULL;
+            }
+            auto binary = Expression::allocate(ExpressionTypeBinary);
+            binary->operator_type = operator_type;
+            binary->left = left;
+            binary->right = right;
+            left = binary;
+        }
+        return left;
+    }
+};
+
+// the expression has to take up all of the tokens between begin and end, returns NULL otherwise
+Expression* parse_expression(Tokens tokens, u64 begin, u64 end)
+{
+    ExpressionParsingState state;
+    state.tokens = tokens;
+    state.token_index = begin;
+    state.end = end;
+    auto result = state.parse_binary(1);
+    if (state.token_index != end)
+    {
+        return NULL;
+    }
+    return result;
+}
+
+struct ExpressionEvaluationResult
+{
+    bool success;
+    s64 value;
+    String error;
+};
+
+ExpressionEvaluationResult make_expression_evaluation_error(const char* message)
+{
+    ExpressionEvaluationResult result;
+    result.success = false;
+    result.error = String::allocate();
+    result.error.push(message);
+    return result;
+}
+
+// label_addresses can be NULL when labels aren't allowed
+ExpressionEvaluationResult evaluate_expression(Expression* expression, StringMap* label_addresses,
+    bool is_whole_address = false)
+{
+    ExpressionEvaluationResult result;
+    result.success = true;
+
+    switch (expression->type)
+    {
+        case ExpressionTypeInteger:
+            result.value = expression->integer;
+            return result;
+        case ExpressionTypeLabel:
+            if (label_addresses == NULL || !label_addresses->contains(expression->label))
+            {
+                auto error = make_expression_evaluation_error("Not a constant: ");
+                error.error.push(expression->label);
+                return error;
+            }
+            result.value = label_addresses->get(expression->label);
+            if (!is_whole_address)
+            {
+                result.value &= 0xFF;
+            }
+            return result;
+        default:
+            break;
+    }
+
+    auto is_low_or_high = expression->type == ExpressionTypeLow || expression->type == ExpressionTypeHigh;
+    auto left = evaluate_expression(expression->left, label_addresses, is_whole_address || is_low_or_high);
+    if (!left.success)
+    {
+        return left;
+    }
+
+    switch (expression->type)
+    {
+        case ExpressionTypeLow:
+            result.value = left.value & 0xFF;
+            return result;
+        case ExpressionTypeHigh:
+            result.value = (left.value >> 8) & 0xFF;
+            return result;
+        case ExpressionTypeUnary:
+            result.value = expression->operator_type == OperatorTypeMinus ? -left.value : ~left.value;
+            return result;
+        default:
+            break;
+    }
+
+    auto right = evaluate_expression(expression->right, label_addresses, is_whole_address);
+    if (!right.success)
+    {
+        return right;
+    }
+
+    auto a = left.value;
+    auto b = right.value;
+    switch (expression->operator_type)
+    {
+        case OperatorTypePlus: result.value = a + b; break;
+        case OperatorTypeMinus: result.value = a - b; break;
+        case OperatorTypeMultiply: result.value = a * b; break;
+        case OperatorTypeDivide:
+        case OperatorTypeModulo:
+            if (b == 0)
+            {
+                return make_expression_evaluation_error("Division by zero");
+            }
+            result.value = expression->operator_type == OperatorTypeDivide ? a / b : a % b;
+            break;
+        case OperatorTypeAnd: result.value = a & b; break;
+        case OperatorTypeOr: result.value = a | b; break;
+        case OperatorTypeXor: result.value = a ^ b; break;
+        case OperatorTypeShiftLeft:
+        case OperatorTypeShiftRight:
+            if (b < 0 || b > 63)
+            {
+                return make_expression_evaluation_error("Shift amount out of range");
+            }
+            result.value = expression->operator_type == OperatorTypeShiftLeft ? a << b : a >> b;
+            break;
+        case OperatorTypeEqual: result.value = a == b; break;
+        case OperatorTypeNotEqual: result.value = a != b; break;
+        case OperatorTypeLess: result.value = a < b; break;
+        case OperatorTypeLessOrEqual: result.value = a <= b; break;
+        case OperatorTypeGreater: result.value = a > b; break;
+        case OperatorTypeGreaterOrEqual: result.value = a >= b; break;
+        case OperatorTypeNot: break; // never binary
+    }
+    return result;
+}
+
+// an 8-bit operand can be written either as unsigned or as two's complement
+bool fits_in_byte(s64 value)
+{
+    return value >= -128 && value <= 255;
+}
@@ -0,0 +1,166 @@
+// A function is a label that is the target of `push <label>, call`.
+// Its body is everything reachable from the label through fall-through and `push <label>, j*` edges,
+// stopping at `ret`; calls made by the body are followed by their fall-through only.
+
+struct Function
+{
+    String name;
+    u64 begin; // index of the label node
+    u64 end; // one past the last node of the body
+    u64 call_sites;
+    bool is_leaf; // makes no calls
+    bool is_contiguous; // the body is exactly the nodes between begin and end
+    bool has_computed_jumps; // jumps to an address that isn't a `push <label>` right before the jump
+    bool uses_general_stack; // contains `store` or `load` outside of `call`/`ret`
+};
+
+struct Functions
+{
+    u64 capacity;
+    u64 size;
+    Function* data;
+
+    static const u64 DEFAULT_CAPACITY = 16;
+
+    static Functions allocate()
+    {
+        Functions result;
+        result.capacity = DEFAULT_CAPACITY;
+        result.size = 0;
+        result.data = (Function*)malloc(result.capacity * sizeof(Function));
+        return result;
+    }
+
+    void deallocate()
+    {
+        free(data);
+    }
+
+    void push(Function function)
+    {
+        if (size == capacity)
+        {
+            capacity *= 2;
+            data = (Function*)realloc(data, capacity * sizeof(Function));
+        }
+        data[size] = function;
+        size++;
+    }
+
+    // returns size if there is no such function
+    u64 find(String name)
+    {
+        for (u64 i = 0; i < size; i++)
+        {
+            if (data[i].name == name)
+            {
+                return i;
+            }
+        }
+        return size;
+    }
+};
+
+bool is_call_site(Ast ast, u64 index)
+{
+    return index + 1 < ast.size && ast.data[index].is_push_label() && ast.data[index+1].type == AstNodeTypeCall;
+}
+
+// marks every node of the body of the function starting at label_index in `visited`
+void find_function_body(Ast ast, u64 label_index, bool* visited, Function* function)
+{
+    auto worklist = (u64*)malloc((2 * ast.size + 1) * sizeof(u64)); // every node adds at most two successors
+    u64 worklist_size = 0;
+    worklist[worklist_size++] = label_index;
+
+    while (worklist_size != 0)
+    {
+        auto index = worklist[--worklist_size];
+        if (index >= ast.size || visited[index])
+        {
+            continue;
+        }
+        visited[index] = true;
+
+        auto node = ast.data[index];
+        if (node.type == AstNodeTypeCall)
+        {
+            function->is_leaf = false;
+        }
+        if (node.type == AstNodeTypeStore || node.type == AstNodeTypeLoad)
+        {
+            function->uses_general_stack = true;
+        }
+        if (node.is_jump())
+        {
+            auto target = ast.get_jump_target(index);
+            if (target != ast.size)
+            {
+                worklist[worklist_size++] = target;
+            }
+            else
+            {
+                function->has_computed_jumps = true;
+            }
+        }
+        if (node.falls_through())
+        {
+            worklist[worklist_size++] = index + 1;
+        }
+    }
+
+    free(worklist);
+}
+
+Functions find_functions(Ast ast)
+{
+    auto result = Functions::allocate();
+    auto visited = (bool*)malloc(ast.size * sizeof(bool));
+
+    for (u64 i = 0; i < ast.size; i++)
+    {
+        if (!is_call_site(ast, i))
+        {
+            continue;
+        }
+        auto existing = result.find(ast.data[i].label);
+        if (existing != result.size)
+        {
+            result.data[existing].call_sites++;
+            continue;
+        }
+
+        Function function;
+        function.name = ast.data[i].label;
+        function.begin = ast.find_label(function.name);
+        function.call_sites = 1;
+        function.is_leaf = true;
+        function.has_computed_jumps = false;
+        function.uses_general_stack = false;
+
+        memset(visited, 0, ast.size * sizeof(bool));
+        find_function_body(ast, function.begin, visited, &function);
+
+        function.end = function.begin;
+        for (u64 k = function.begin; k < ast.size; k++)
+        {
+            if (visited[k])
+            {
+                function.end = k + 1;
+            }
+        }
+        function.is_contiguous = true;
+        for (u64 k = 0; k < ast.size; k++)
+        {
+            if (visited[k] != (k >= function.begin && k < function.end))
+            {
+                function.is_contiguous = false;
+            }
+        }
+
+        result.push(function);
+    }
+
+    free(visited);
+    return result;
+}
@@ -0,0 +1,288 @@
+// Inlines small leaf functions at their call sites and turns `call, ret` into a plain jump.
+// Both transformations assume that a function never looks at the general stack below its own return address,
+// which is what `call` and `ret` are designed around.
+
+struct InlinerState
+{
+    Ast ast;
+    CostModel cost_model;
+    u64 next_inline_id;
+    u64 inlined_call_sites;
+    u64 tail_calls;
+
+    // in the forms fuse_branches emits, so they follow has_native_calls
+    u64 call_site_size; // push <function>, call
+    u64 call_overhead_cycles; // the call site and `ret`
+    u64 return_jump_size; // push <end of inlined body>, jmp
+    u64 return_jump_cycles;
+
+    bool is_last_node(Function function, u64 index)
+    {
+        return index == function.end - 1;
+    }
+
+    bool is_inlinable(Function function)
+    {
+        if (function.begin == ast.size
+            || !function.is_leaf
+            || !function.is_contiguous
+            || function.has_computed_jumps
+            || function.uses_general_stack)
+        {
+            return false;
+        }
+        // labels are only renamed in plain `push <label>` operands
+        for (u64 i = function.begin; i < function.end; i++)
+        {
+            if (ast.data[i].is_push_expression())
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    u64 get_inlined_size(Function function)
+    {
+        u64 result = 0;
+        for (u64 i = function.begin; i < function.end; i++)
+        {
+            if (ast.data[i].type == AstNodeTypeRet)
+            {
+                result += is_last_node(function, i) ? 0 : return_jump_size;
+            }
+            else
+            {
+                result += ast.data[i].get_size();
+            }
+        }
+        return result;
+    }
+
+    // the smallest number of cycles saved by a single inlined call
+    u64 get_cycles_saved_per_call(Function function)
+    {
+        for (u64 i = function.begin; i < function.end; i++)
+        {
+            if (ast.data[i].type == AstNodeTypeRet && !is_last_node(function, i))
+            {
+                return call_overhead_cycles - return_jump_cycles;
+            }
+        }
+        return call_overhead_cycles;
+    }
+
+    bool is_defined_in(Function function, String label)
+    {
+        for (u64 i = function.begin; i < function.end; i++)
+        {
+            if (ast.data[i].type == AstNodeTypeLabel && ast.data[i].label == label)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // the original body can be dropped once every call site is inlined,
+    // as long as nothing falls through into it and no other code refers to its labels
+    bool is_removable_after_inlining(Function function)
+    {
+        if (function.begin == 0)
+        {
+            return false;
+        }
+        if (ast.data[function.begin-1].falls_through())
+        {
+            return false;
+        }
+        for (u64 i = 0; i < ast.size; i++)
+        {
+            if (i >= function.begin && i < function.end)
+            {
+                continue;
+            }
+            if (is_call_site(ast, i) && ast.data[i].label == function.name)
+            {
+                continue;
+            }
+            auto labels = Strings::allocate();
+            ast.data[i].collect_referenced_labels(&labels);
+            for (u64 k = 0; k < labels.size; k++)
+            {
+                if (is_defined_in(function, labels.data[k]))
+                {
+                    labels.deallocate();
+                    return false;
+                }
+            }
+            labels.deallocate();
+        }
+        return true;
+    }
+
+    String make_inlined_label(u64 inline_id, String label)
+    {
+        auto result = String::allocate();
+        result.push("__inline_");
+        result.push(inline_id);
+        result.push("_");
+        result.push(label);
+        return result;
+    }
+
+    void push_inlined_body(Ast* result, Function function, u64 line)
+    {
+        auto inline_id = next_inline_id;
+        next_inline_id++;
+
+        auto end_label = make_inlined_label(inline_id, function.name);
+        end_label.push("_end");
+
+        for (u64 i = function.begin; i < function.end; i++)
+        {
+            auto node = ast.data[i];
+            if (node.type == AstNodeTypeLabel || node.is_push_label() && is_defined_in(function, node.label))
+            {
+                node.label = make_inlined_label(inline_id, node.label);
+            }
+            if (node.type == AstNodeTypeRet)
+            {
+                if (!is_last_node(function, i))
+                {
+                    result->push(AstNode::make_push_label(end_label, node.line));
+                    result->push(AstNode::make(AstNodeTypeJmp, node.line));
+                }
+                continue;
+            }
+            result->push(node);
+        }
+        result->push(AstNode::make_label(end_label, line));
+    }
+
+    void inline_function(Function function, bool remove_original)
+    {
+        auto result = Ast::allocate();
+        for (u64 i = 0; i < ast.size; i++)
+        {
+            if (remove_original && i >= function.begin && i < function.end)
+            {
+                continue;
+            }
+            if (is_call_site(ast, i) && ast.data[i].label == function.name)
+            {
+                push_inlined_body(&result, function, ast.data[i].line);
+                inlined_call_sites++;
+                i++; // skip the call
+                continue;
+            }
+            result.push(ast.data[i]);
+        }
+        ast = result;
+    }
+
+    // inlines one function, returns false if no function is worth inlining
+    bool inline_next_function()
+    {
+        auto functions = find_functions(ast);
+        bool result = false;
+        for (u64 i = 0; i < functions.size; i++)
+        {
+            auto function = functions.data[i];
+            if (!is_inlinable(function))
+            {
+                continue;
+            }
+
+            auto remove_original = is_removable_after_inlining(function);
+            auto inlined_size = get_inlined_size(function);
+            auto original_size = ast.get_size_between(function.begin, function.end);
+            s64 bytes_added = (s64)function.call_sites * ((s64)inlined_size - (s64)call_site_size);
+            if (remove_original)
+            {
+                bytes_added -= original_size;
+            }
+            s64 cycles_saved = function.call_sites * get_cycles_saved_per_call(function);
+
+            if (cost_model.score(bytes_added, cycles_saved) <= 0
+                || bytes_added > 0 && !cost_model.fits(ast.get_size() + bytes_added))
+            {
+                continue;
+            }
+
+            fprintf(
+                stderr,
+                "Inliner: inlined %.*s at %llu call site(s), %+lld bytes, saves at least %llu cycles per call\n",
+                (int)function.name.size,
+                function.name.data,
+                (unsigned long long)function.call_sites,
+                (long long)bytes_added,
+                (unsigned long long)get_cycles_saved_per_call(function)
+            );
+            inline_function(function, remove_original);
+            result = true;
+            break;
+        }
+        functions.deallocate();
+        return result;
+    }
+
+    // call, ret => jmp
+    void convert_tail_calls()
+    {
+        for (u64 i = 0; i + 1 < ast.size; i++)
+        {
+            if (ast.data[i].type == AstNodeTypeCall && ast.data[i+1].type == AstNodeTypeRet)
+            {
+                ast.data[i].type = AstNodeTypeJmp;
+                ast.remove(i+1);
+                tail_calls++;
+            }
+        }
+    }
+};
+
+struct InliningResult
+{
+    Ast ast;
+    u64 inlined_call_sites;
+    u64 tail_calls;
+    s64 bytes_saved;
+    s64 cycles_saved;
+};
+
+InliningResult inline_functions(Ast ast, CostModel cost_model)
+{
+    // measured the way fuse_branches emits the calls it removes
+    auto fused_before = fuse_branches(ast).ast;
+    auto size_before = fused_before.get_size();
+    auto cycles_before = fused_before.get_cycles();
+
+    InlinerState state;
+    state.ast = ast;
+    state.cost_model = cost_model;
+    state.next_inline_id = 0;
+    state.inlined_call_sites = 0;
+    state.tail_calls = 0;
+    auto call_site = make_fused_jump(AstNodeTypeCall);
+    auto return_jump = make_fused_jump(AstNodeTypeJmp);
+    state.call_site_size = call_site.get_size();
+    state.call_overhead_cycles = call_site.get_cycles() + AstNode::make(AstNodeTypeRet, 0).get_cycles();
+    state.return_jump_size = return_jump.get_size();
+    state.return_jump_cycles = return_jump.get_cycles();
+
+    // inlining a leaf can turn its callers into leaves, so keep going until nothing changes
+    while (state.inline_next_function())
+    {
+    }
+    state.convert_tail_calls();
+
+    InliningResult result;
+    result.ast = state.ast;
+    result.inlined_call_sites = state.inlined_call_sites;
+    result.tail_calls = state.tail_calls;
+    auto fused_after = fuse_branches(state.ast).ast;
+    result.bytes_saved = (s64)size_before - (s64)fused_after.get_size();
+    result.cycles_saved = (s64)cycles_before - (s64)fused_after.get_cycles();
+    return result;
+}
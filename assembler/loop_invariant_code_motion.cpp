@@ -0,0 +1,442 @@
+// Hoists a value that a loop computes from constants on every iteration out of the loop.
+// The value is computed once before the loop, parked on the general stack and fetched with `load, dup, store`
+// wherever the loop used to compute it; every exit of the loop drops it again with `load, pop`.
+// Fetching costs 3 cycles while a `push` costs 2, so only sequences of at least two instructions can pay off.
+// The loop must leave the general stack alone: no `load`, `store` or `ret` in it, and every function it calls
+// has to be free of them as well, apart from its own return address.
+
+const u64 PARKED_VALUE_FETCH_SIZE = 3; // load-dup-store
+const u64 PARKED_VALUE_DROP_SIZE = 2; // load-pop
+
+// how many values a node takes from the evaluation stack and puts back,
+// false for nodes whose result depends on anything but their operands
+bool get_pure_stack_effect(AstNode node, u64* pops, u64* pushes)
+{
+    switch (node.type)
+    {
+        case AstNodeTypePush:
+            *pops = 0;
+            *pushes = 1;
+            return true;
+        case AstNodeTypeAdd:
+        case AstNodeTypeSub:
+        case AstNodeTypeAnd:
+        case AstNodeTypeOr:
+        case AstNodeTypeXor:
+        case AstNodeTypeShl:
+        case AstNodeTypeShr:
+        case AstNodeTypeMul:
+        case AstNodeTypeMulh:
+            *pops = 2;
+            *pushes = 1;
+            return true;
+        case AstNodeTypeNot:
+        case AstNodeTypeNeg:
+        case AstNodeTypeEqz:
+        case AstNodeTypeRomload: // the ROM doesn't change while the program runs
+            *pops = 1;
+            *pushes = 1;
+            return true;
+        case AstNodeTypeDup:
+            *pops = 1;
+            *pushes = 2;
+            return true;
+        default:
+            return false;
+    }
+}
+
+bool are_nodes_equal(AstNode left, AstNode right)
+{
+    return left.type == right.type && left.to_string() == right.to_string();
+}
+
+struct LoopInvariantCodeMotionState
+{
+    Ast ast;
+    CostModel cost_model;
+    ControlFlowGraph graph;
+    Functions functions;
+
+    // the function called at the end of block leaves the general stack the way it found it
+    bool is_call_balanced(u64 function_index, u64 depth)
+    {
+        if (function_index == functions.size || depth == 16)
+        {
+            return false;
+        }
+        auto function = functions.data[function_index];
+        if (function.uses_general_stack || function.has_computed_jumps)
+        {
+            return false;
+        }
+        if (function.is_leaf)
+        {
+            return true;
+        }
+        if (!function.is_contiguous)
+        {
+            return false;
+        }
+        for (auto i = function.begin; i < function.end; i++)
+        {
+            if (ast.data[i].type != AstNodeTypeCall)
+            {
+                continue;
+            }
+            auto target = ast.get_jump_target(i);
+            if (target == ast.size || !is_call_balanced(functions.find(ast.data[target].label), depth + 1))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool is_loop_eligible(Loop loop)
+    {
+        auto header = graph.blocks[loop.header];
+        if (graph.is_entry_block[loop.header] || ast.data[header.begin].type != AstNodeTypeLabel || loop.header == 0)
+        {
+            return false;
+        }
+
+        // the only way in has to be falling through from the block right before the header
+        auto preheader = loop.header - 1;
+        for (u64 k = 0; k < header.predecessor_count; k++)
+        {
+            auto predecessor = graph.get_predecessor(loop.header, k);
+            if (!loop.contains[predecessor] && predecessor != preheader)
+            {
+                return false;
+            }
+        }
+        auto preheader_last = ast.data[graph.blocks[preheader].get_last_node()];
+        if (!preheader_last.falls_through()
+            || loop.contains[preheader])
+        {
+            return false;
+        }
+
+        for (u64 b = 0; b < graph.block_count; b++)
+        {
+            if (!loop.contains[b])
+            {
+                continue;
+            }
+            auto block = graph.blocks[b];
+            if (block.has_unknown_successor)
+            {
+                return false;
+            }
+            for (auto i = block.begin; i < block.end; i++)
+            {
+                auto type = ast.data[i].type;
+                if (type == AstNodeTypeLoad || type == AstNodeTypeStore || type == AstNodeTypeRet)
+                {
+                    return false;
+                }
+                if (type == AstNodeTypeCall
+                    && !is_call_balanced(functions.find(ast.data[ast.get_jump_target(i)].label), 0))
+                {
+                    return false;
+                }
+            }
+
+            // every exit needs a block of its own to drop the parked value in
+            for (u64 k = 0; k < block.successor_count; k++)
+            {
+                auto exit = block.successors[k];
+                if (loop.contains[exit])
+                {
+                    continue;
+                }
+                if (graph.is_entry_block[exit])
+                {
+                    return false;
+                }
+                for (u64 p = 0; p < graph.blocks[exit].predecessor_count; p++)
+                {
+                    if (!loop.contains[graph.get_predecessor(exit, p)])
+                    {
+                        return false;
+                    }
+                }
+            }
+        }
+        return true;
+    }
+
+    // the longest sequence starting at index that computes a single value out of nothing but constants,
+    // returns index if there is none worth looking at
+    u64 find_invariant_end(u64 index, u64 block_end)
+    {
+        u64 depth = 0;
+        auto result = index;
+        for (auto i = index; i < block_end; i++)
+        {
+            u64 pops;
+            u64 pushes;
+            if (!get_pure_stack_effect(ast.data[i], &pops, &pushes) || pops > depth)
+            {
+                break;
+            }
+            depth = depth - pops + pushes;
+            if (depth == 1 && i != index)
+            {
+                result = i + 1;
+            }
+        }
+        // a label pushed right before a jump or a call stays where it is, it's the target of the jump
+        if (result != index && result < block_end && (ast.data[result].is_jump() || ast.data[result].type == AstNodeTypeCall))
+        {
+            return index;
+        }
+        return result;
+    }
+
+    bool is_occurrence(u64 index, u64 begin, u64 end)
+    {
+        if (index + (end - begin) > ast.size)
+        {
+            return false;
+        }
+        for (u64 i = 0; i < end - begin; i++)
+        {
+            if (!are_nodes_equal(ast.data[index + i], ast.data[begin + i]))
+            {
+                return false;
+            }
+        }
+        return find_invariant_end(index, graph.blocks[graph.get_block_of(index)].end) == index + (end - begin);
+    }
+
+    u64 count_exits(Loop loop)
+    {
+        u64 result = 0;
+        auto is_counted = (bool*)calloc(graph.block_count, sizeof(bool));
+        for (u64 b = 0; b < graph.block_count; b++)
+        {
+            if (!loop.contains[b])
+            {
+                continue;
+            }
+            for (u64 k = 0; k < graph.blocks[b].successor_count; k++)
+            {
+                auto exit = graph.blocks[b].successors[k];
+                if (!loop.contains[exit] && !is_counted[exit])
+                {
+                    is_counted[exit] = true;
+                    result++;
+                }
+            }
+        }
+        free(is_counted);
+        return result;
+    }
+
+    // rewrites the loop if it has an invariant worth hoisting
+    bool try_hoist(Loop loop)
+    {
+        if (!is_loop_eligible(loop))
+        {
+            return false;
+        }
+
+        auto exit_count = count_exits(loop);
+        s64 best_score = 0;
+        u64 best_begin = 0;
+        u64 best_end = 0;
+        u64 best_occurrences = 0;
+
+        for (u64 b = 0; b < graph.block_count; b++)
+        {
+            if (!loop.contains[b])
+            {
+                continue;
+            }
+            for (auto i = graph.blocks[b].begin; i < graph.blocks[b].end; i++)
+            {
+                auto end = find_invariant_end(i, graph.blocks[b].end);
+                if (end == i)
+                {
+                    continue;
+                }
+
+                u64 occurrences = 0;
+                for (u64 o = 0; o < graph.block_count; o++)
+                {
+                    if (!loop.contains[o])
+                    {
+                        continue;
+                    }
+                    for (auto k = graph.blocks[o].begin; k < graph.blocks[o].end; )
+                    {
+                        if (is_occurrence(k, i, end))
+                        {
+                            occurrences++;
+                            k += end - i;
+                        }
+                        else
+                        {
+                            k++;
+                        }
+                    }
+                }
+
+                auto size = (s64)ast.get_size_between(i, end);
+                auto cycles = size;
+                auto bytes_added = size + 1 + (s64)(PARKED_VALUE_DROP_SIZE * exit_count)
+                    + (s64)occurrences * ((s64)PARKED_VALUE_FETCH_SIZE - size);
+                auto cycles_saved = (s64)CostModel::ESTIMATED_LOOP_ITERATIONS * (s64)occurrences * (cycles - (s64)PARKED_VALUE_FETCH_SIZE)
+                    - (cycles + 1 + (s64)PARKED_VALUE_DROP_SIZE);
+                auto score = cost_model.score(bytes_added, cycles_saved);
+                if (score > best_score && cost_model.fits(ast.get_size() + bytes_added))
+                {
+                    best_score = score;
+                    best_begin = i;
+                    best_end = end;
+                    best_occurrences = occurrences;
+                }
+            }
+        }
+
+        if (best_score <= 0)
+        {
+            return false;
+        }
+
+        // mark where things go before the indices change
+        auto is_occurrence_start = (bool*)calloc(ast.size + 1, sizeof(bool));
+        auto is_exit_start = (bool*)calloc(ast.size + 1, sizeof(bool));
+        for (u64 b = 0; b < graph.block_count; b++)
+        {
+            if (loop.contains[b])
+            {
+                for (auto k = graph.blocks[b].begin; k < graph.blocks[b].end; )
+                {
+                    if (is_occurrence(k, best_begin, best_end))
+                    {
+                        is_occurrence_start[k] = true;
+                        k += best_end - best_begin;
+                    }
+                    else
+                    {
+                        k++;
+                    }
+                }
+                continue;
+            }
+            for (u64 p = 0; p < graph.blocks[b].predecessor_count; p++)
+            {
+                if (loop.contains[graph.get_predecessor(b, p)])
+                {
+                    is_exit_start[ast.skip_labels(graph.blocks[b].begin)] = true;
+                    break;
+                }
+            }
+        }
+
+        auto header_begin = graph.blocks[loop.header].begin;
+        auto line = ast.data[header_begin].line;
+        auto result = Ast::allocate();
+        for (u64 i = 0; i <= ast.size; )
+        {
+            if (i == header_begin)
+            {
+                for (auto k = best_begin; k < best_end; k++)
+                {
+                    auto node = ast.data[k];
+                    node.line = line;
+                    result.push(node);
+                }
+                result.push(AstNode::make(AstNodeTypeStore, line));
+            }
+            if (is_exit_start[i])
+            {
+                auto exit_line = i < ast.size ? ast.data[i].line : line;
+                result.push(AstNode::make(AstNodeTypeLoad, exit_line));
+                result.push(AstNode::make(AstNodeTypePop, exit_line));
+            }
+            if (i == ast.size)
+            {
+                break;
+            }
+            if (is_occurrence_start[i])
+            {
+                auto occurrence_line = ast.data[i].line;
+                result.push(AstNode::make(AstNodeTypeLoad, occurrence_line));
+                result.push(AstNode::make(AstNodeTypeDup, occurrence_line));
+                result.push(AstNode::make(AstNodeTypeStore, occurrence_line));
+                i += best_end - best_begin;
+                continue;
+            }
+            result.push(ast.data[i]);
+            i++;
+        }
+
+        auto header_label = ast.data[header_begin].label;
+        fprintf(
+            stderr,
+            "Loop-invariant code motion: hoisted %llu instruction(s) out of %.*s (%llu use(s))\n",
+            (unsigned long long)(best_end - best_begin),
+            (int)header_label.size,
+            header_label.data,
+            (unsigned long long)best_occurrences
+        );
+
+        free(is_occurrence_start);
+        free(is_exit_start);
+        ast = result;
+        return true;
+    }
+};
+
+struct LoopInvariantCodeMotionResult
+{
+    Ast ast;
+    u64 loops;
+    u64 hoisted_loops;
+};
+
+LoopInvariantCodeMotionResult hoist_loop_invariants(Ast ast, CostModel cost_model)
+{
+    LoopInvariantCodeMotionState state;
+    state.ast = ast;
+    state.cost_model = cost_model;
+
+    LoopInvariantCodeMotionResult result;
+    result.loops = 0;
+    result.hoisted_loops = 0;
+
+    // every rewrite moves blocks around, so the graph is rebuilt until nothing changes;
+    // a rewritten loop now uses the general stack and isn't eligible again
+    bool changed = true;
+    bool is_first_round = true;
+    while (changed)
+    {
+        changed = false;
+        state.graph = build_control_flow_graph(state.ast);
+        state.functions = find_functions(state.ast);
+        auto loops = state.graph.find_loops();
+        if (is_first_round)
+        {
+            result.loops = loops.size;
+            is_first_round = false;
+        }
+        for (u64 i = 0; i < loops.size && !changed; i++)
+        {
+            if (state.try_hoist(loops.data[i]))
+            {
+                result.hoisted_loops++;
+                changed = true;
+            }
+        }
+        loops.deallocate();
+        state.functions.deallocate();
+        state.graph.deallocate();
+    }
+
+    result.ast = state.ast;
+    return result;
+}
@@ -0,0 +1,336 @@
+// Unrolls counted loops of the shape
+//
+//     loop: dup, push 0, cmp, push end, jeq
+//           <body>
+//           push -d, add, push loop, jmp
+//
+// where the body is straight-line code that leaves the counter on top of the evaluation stack alone.
+// When the counter is pushed right before the loop and nothing else enters it, the trip count is known
+// and the body is repeated k times for a k that divides it, with one exit test per k iterations.
+// Otherwise the unrolled loop is guarded by `counter >= k*d`, and the original loop takes care of the rest.
+// The factor is the one the cost model likes best among those that fit the ROM budget.
+
+const u64 MAX_UNROLL_FACTOR = 16;
+
+struct CountedLoop
+{
+    u64 header_begin; // first label
+    u64 test_begin; // the `dup`
+    u64 body_begin;
+    u64 step_begin; // the `push -d`
+    u64 end; // one past the `jmp`
+    String exit_label;
+    u64 decrement;
+    u64 trip_count; // 0 if not known
+};
+
+struct LoopUnrollerState
+{
+    Ast ast;
+    CostModel cost_model;
+    u64 next_unroll_id;
+    u64 unrolled_loops;
+    s64 cycles_saved;
+    s64 bytes_added; // by the loops unrolled so far
+
+    bool is_header_label(u64 header_begin, u64 test_begin, String label)
+    {
+        for (auto i = header_begin; i < test_begin; i++)
+        {
+            if (ast.data[i].label == label)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // the only reference to the header is the jump back
+    bool is_only_entered_by_falling_through(CountedLoop loop)
+    {
+        auto labels = Strings::allocate();
+        for (u64 i = 0; i < ast.size; i++)
+        {
+            if (i != loop.end - 2)
+            {
+                ast.data[i].collect_referenced_labels(&labels);
+            }
+        }
+        bool result = true;
+        for (u64 i = 0; i < labels.size && result; i++)
+        {
+            result = !is_header_label(loop.header_begin, loop.test_begin, labels.data[i]);
+        }
+        labels.deallocate();
+        return result;
+    }
+
+    bool match_counted_loop(u64 index, CountedLoop* loop)
+    {
+        if (ast.data[index].type != AstNodeTypeLabel || index != 0 && ast.data[index-1].type == AstNodeTypeLabel)
+        {
+            return false;
+        }
+        loop->header_begin = index;
+        loop->test_begin = ast.skip_labels(index);
+        auto test = loop->test_begin;
+        if (test + 5 > ast.size
+            || ast.data[test].type != AstNodeTypeDup
+            || !ast.data[test+1].is_push_integer() || ast.data[test+1].integer != 0
+            || ast.data[test+2].type != AstNodeTypeCmp
+            || !ast.data[test+3].is_push_label()
+            || ast.data[test+4].type != AstNodeTypeJeq)
+        {
+            return false;
+        }
+        loop->exit_label = ast.data[test+3].label;
+        loop->body_begin = test + 5;
+
+        auto i = loop->body_begin;
+        while (i < ast.size)
+        {
+            auto node = ast.data[i];
+            if (node.type == AstNodeTypeLabel || node.is_jump() || node.type == AstNodeTypeCall
+                || !node.falls_through() || node.is_push_label() || node.is_push_expression())
+            {
+                break;
+            }
+            i++;
+        }
+        if (i < loop->body_begin + 2)
+        {
+            return false;
+        }
+        loop->step_begin = i - 2;
+        loop->end = i + 2;
+        if (loop->end > ast.size
+            || !ast.data[loop->step_begin].is_push_integer()
+            || ast.data[loop->step_begin+1].type != AstNodeTypeAdd
+            || !ast.data[i].is_push_label()
+            || ast.data[i+1].type != AstNodeTypeJmp
+            || !is_header_label(loop->header_begin, loop->test_begin, ast.data[i].label))
+        {
+            return false;
+        }
+
+        // the step has to be a decrement, and the body may never reach below the values it pushed itself
+        auto step = ast.data[loop->step_begin].integer;
+        if (step < 129)
+        {
+            return false;
+        }
+        loop->decrement = 256 - step;
+        u64 depth = 0;
+        for (auto k = loop->body_begin; k < loop->step_begin; k++)
+        {
+            u64 pops;
+            u64 pushes;
+            ast.data[k].get_stack_effect(&pops, &pushes);
+            if (pops > depth)
+            {
+                return false;
+            }
+            depth = depth - pops + pushes;
+        }
+        if (depth != 0)
+        {
+            return false;
+        }
+
+        loop->trip_count = 0;
+        if (loop->header_begin != 0 && ast.data[loop->header_begin-1].is_push_integer()
+            && is_only_entered_by_falling_through(*loop))
+        {
+            auto counter = ast.data[loop->header_begin-1].integer;
+            if (counter != 0 && counter % loop->decrement == 0)
+            {
+                loop->trip_count = counter / loop->decrement;
+            }
+        }
+        return true;
+    }
+
+    // static cycle count of running the loop for `iterations` iterations, unrolled k times or not (k = 1)
+    u64 get_loop_cycles(CountedLoop loop, u64 k, u64 iterations)
+    {
+        auto test = ast.get_size_between(loop.test_begin, loop.body_begin);
+        auto body = ast.get_size_between(loop.body_begin, loop.end - 2);
+        auto back = ast.get_size_between(loop.end - 2, loop.end) + TAKEN_JUMP_PENALTY;
+        auto exit = test + TAKEN_JUMP_PENALTY; // the last test jumps to the end
+        auto original = iterations * (test + body + back) + exit;
+        if (k == 1)
+        {
+            return original;
+        }
+        if (loop.trip_count != 0)
+        {
+            return iterations / k * (test + k * body + back) + exit;
+        }
+        // the guard is the same shape as the test, the rest goes through the original loop
+        auto guard = test;
+        auto guard_exit = guard + TAKEN_JUMP_PENALTY; // the last guard jumps to the rest
+        auto chunks = iterations / k;
+        auto rest = iterations % k;
+        return chunks * (guard + k * body + back) + guard_exit + rest * (test + body + back) + exit;
+    }
+
+    s64 get_bytes_added(CountedLoop loop, u64 k)
+    {
+        auto test = ast.get_size_between(loop.test_begin, loop.body_begin);
+        auto body = ast.get_size_between(loop.body_begin, loop.end - 2);
+        auto back = ast.get_size_between(loop.end - 2, loop.end);
+        if (loop.trip_count != 0)
+        {
+            return (s64)((k - 1) * body);
+        }
+        return (s64)(test + k * body + back);
+    }
+
+    // 1 if unrolling doesn't pay off
+    u64 choose_factor(CountedLoop loop)
+    {
+        auto iterations = loop.trip_count != 0 ? loop.trip_count : CostModel::ESTIMATED_LOOP_ITERATIONS;
+        auto original = get_loop_cycles(loop, 1, iterations);
+        u64 best_factor = 1;
+        s64 best_score = 0;
+        for (u64 k = 2; k <= MAX_UNROLL_FACTOR; k++)
+        {
+            if (loop.trip_count != 0 ? loop.trip_count % k != 0 : k * loop.decrement > 255)
+            {
+                continue;
+            }
+            auto loop_bytes_added = get_bytes_added(loop, k);
+            if (!cost_model.fits(ast.get_size() + bytes_added + loop_bytes_added))
+            {
+                continue;
+            }
+            auto loop_cycles_saved = (s64)original - (s64)get_loop_cycles(loop, k, iterations);
+            auto score = cost_model.score(loop_bytes_added, loop_cycles_saved);
+            if (score > best_score)
+            {
+                best_score = score;
+                best_factor = k;
+            }
+        }
+        return best_factor;
+    }
+
+    void push_range(Ast* result, u64 begin, u64 end)
+    {
+        for (auto i = begin; i < end; i++)
+        {
+            result->push(ast.data[i]);
+        }
+    }
+
+    void push_unrolled(Ast* result, CountedLoop loop, u64 k)
+    {
+        auto header_label = ast.data[loop.header_begin].label;
+        auto line = ast.data[loop.test_begin].line;
+        push_range(result, loop.header_begin, loop.test_begin);
+
+        String remainder_label;
+        if (loop.trip_count != 0)
+        {
+            push_range(result, loop.test_begin, loop.body_begin);
+        }
+        else
+        {
+            remainder_label = String::allocate();
+            remainder_label.push("__unroll_");
+            remainder_label.push(next_unroll_id);
+            remainder_label.push("_remainder");
+            next_unroll_id++;
+
+            // dup, push k*d, cmp, push remainder, jl
+            result->push(AstNode::make(AstNodeTypeDup, line));
+            result->push(AstNode::make_push_integer((u8)(k * loop.decrement), line));
+            result->push(AstNode::make(AstNodeTypeCmp, line));
+            result->push(AstNode::make_push_label(remainder_label, line));
+            result->push(AstNode::make(AstNodeTypeJl, line));
+        }
+
+        for (u64 i = 0; i < k; i++)
+        {
+            push_range(result, loop.body_begin, loop.end - 2);
+        }
+        result->push(AstNode::make_push_label(header_label, ast.data[loop.end-2].line));
+        result->push(AstNode::make(AstNodeTypeJmp, ast.data[loop.end-1].line));
+
+        if (loop.trip_count == 0)
+        {
+            result->push(AstNode::make_label(remainder_label, line));
+            push_range(result, loop.test_begin, loop.end - 2);
+            result->push(AstNode::make_push_label(remainder_label, ast.data[loop.end-2].line));
+            result->push(ast.data[loop.end-1]);
+        }
+    }
+
+    Ast run()
+    {
+        auto result = Ast::allocate();
+        for (u64 i = 0; i < ast.size; )
+        {
+            CountedLoop loop;
+            if (!match_counted_loop(i, &loop))
+            {
+                result.push(ast.data[i]);
+                i++;
+                continue;
+            }
+            auto k = choose_factor(loop);
+            if (k == 1)
+            {
+                push_range(&result, i, loop.end);
+                i = loop.end;
+                continue;
+            }
+
+            auto iterations = loop.trip_count != 0 ? loop.trip_count : CostModel::ESTIMATED_LOOP_ITERATIONS;
+            auto loop_cycles_saved = (s64)get_loop_cycles(loop, 1, iterations) - (s64)get_loop_cycles(loop, k, iterations);
+            auto header_label = ast.data[loop.header_begin].label;
+            fprintf(
+                stderr,
+                "Loop unroller: unrolled %.*s by %llu, %+lld bytes, saves %lld cycles over %s%llu iterations\n",
+                (int)header_label.size,
+                header_label.data,
+                (unsigned long long)k,
+                (long long)get_bytes_added(loop, k),
+                (long long)loop_cycles_saved,
+                loop.trip_count != 0 ? "" : "an assumed ",
+                (unsigned long long)iterations
+            );
+            unrolled_loops++;
+            cycles_saved += loop_cycles_saved;
+            bytes_added += get_bytes_added(loop, k);
+
+            push_unrolled(&result, loop, k);
+            i = loop.end;
+        }
+        return result;
+    }
+};
+
+struct LoopUnrollingResult
+{
+    Ast ast;
+    u64 unrolled_loops;
+    s64 cycles_saved; // static, over the trip count or the assumed number of iterations of each loop
+};
+
+LoopUnrollingResult unroll_loops(Ast ast, CostModel cost_model)
+{
+    LoopUnrollerState state;
+    state.ast = ast;
+    state.cost_model = cost_model;
+    state.next_unroll_id = 0;
+    state.unrolled_loops = 0;
+    state.cycles_saved = 0;
+    state.bytes_added = 0;
+
+    LoopUnrollingResult result;
+    result.ast = state.run();
+    result.unrolled_loops = state.unrolled_loops;
+    result.cycles_saved = state.cycles_saved;
+    return result;
+}
@@ -0,0 +1,586 @@
+// Expands macros and conditional/repeat blocks before the tokens reach parse_ast:
+//
+// .macro NAME [PARAMETER, ...]      NAME [ARGUMENT, ...]
+// ...
+// .endm
+//
+// .rept COUNT                       .if VALUE
+// ...                               ...
+// .endr                             .else
+//                                   ...
+//                                   .endif
+//
+// .equ NAME, EXPRESSION
+//
+// COUNT, VALUE and EXPRESSION are constant expressions, see parse_expression. Constants are replaced by their value
+// wherever they are used; a constant that refers to labels is replaced by its expression instead. A constant
+// can be defined again with the same value, which a macro or `.rept` body with an `.equ` in it does.
+// Parameters are replaced by the tokens of their argument, labels defined in a macro body get a unique name
+// in every expansion, and macros may invoke other macros. Expanded tokens keep the line they were written on.
+
+struct Macro
+{
+    String name;
+    u64 line;
+    StringMap parameter_indices;
+    u64 parameter_count;
+    StringMap local_labels;
+    Tokens body; // everything between the .macro and .endm lines
+};
+
+struct Macros
+{
+    u64 capacity;
+    u64 size;
+    Macro* data;
+
+    static const u64 DEFAULT_CAPACITY = 16;
+
+    static Macros allocate()
+    {
+        Macros result;
+        result.capacity = DEFAULT_CAPACITY;
+        result.size = 0;
+        result.data = (Macro*)malloc(result.capacity * sizeof(Macro));
+        return result;
+    }
+
+    void deallocate()
+    {
+        free(data);
+    }
+
+    void push(Macro macro)
+    {
+        if (size == capacity)
+        {
+            capacity *= 2;
+            data = (Macro*)realloc(data, capacity * sizeof(Macro));
+        }
+        data[size] = macro;
+        size++;
+    }
+};
+
+struct Constant
+{
+    String name;
+    Tokens value;
+};
+
+struct Constants
+{
+    u64 capacity;
+    u64 size;
+    Constant* data;
+
+    static const u64 DEFAULT_CAPACITY = 16;
+
+    static Constants allocate()
+    {
+        Constants result;
+        result.capacity = DEFAULT_CAPACITY;
+        result.size = 0;
+        result.data = (Constant*)malloc(result.capacity * sizeof(Constant));
+        return result;
+    }
+
+    void deallocate()
+    {
+        free(data);
+    }
+
+    void push(Constant constant)
+    {
+        if (size == capacity)
+        {
+            capacity *= 2;
+            data = (Constant*)realloc(data, capacity * sizeof(Constant));
+        }
+        data[size] = constant;
+        size++;
+    }
+};
+
+// the same tokens, wherever they were written
+bool have_same_tokens(Tokens left, Tokens right)
+{
+    if (left.size != right.size)
+    {
+        return false;
+    }
+    for (u64 i = 0; i < left.size; i++)
+    {
+        auto a = left.data[i];
+        auto b = right.data[i];
+        if (a.type != b.type
+            || (a.type == TokenTypeName || a.type == TokenTypeDirective) && !(a.name == b.name)
+            || a.type == TokenTypeInteger && a.integer != b.integer
+            || a.type == TokenTypeOperator && a.operator_type != b.operator_type)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+const u64 MAX_MACRO_EXPANSION_DEPTH = 64;
+
+struct MacroExpansionState
+{
+    Macros macros;
+    StringMap macro_indices;
+    Constants constants;
+    StringMap constant_indices;
+    Tokens result;
+    u64 next_expansion_id;
+    bool failed;
+    String error;
+
+    bool fail(const char* message, u64 line)
+    {
+        failed = true;
+        error = String::allocate();
+        error.push(message);
+        error.push(" on line ");
+        error.push(line);
+        return false;
+    }
+
+    bool is_directive(Token token, const char* name)
+    {
+        return token.type == TokenTypeDirective && token.name == name;
+    }
+
+    // index of the new line token that ends the line starting at index, or end
+    u64 find_line_end(Tokens tokens, u64 index, u64 end)
+    {
+        while (index != end && tokens.data[index].type != TokenTypeNewLine)
+        {
+            index++;
+        }
+        return index;
+    }
+
+    // index of the first token of the line that closes the block opened on the line before begin,
+    // or end if the block is never closed; the first `middle` directive on the same level goes to middle_index
+    u64 find_block_end(Tokens tokens, u64 begin, u64 end, const char* open, const char* close, const char* middle, u64* middle_index)
+    {
+        u64 depth = 0;
+        for (auto i = begin; i < end; i = find_line_end(tokens, i, end) + 1)
+        {
+            auto first = tokens.data[i];
+            if (is_directive(first, open))
+            {
+                depth++;
+            }
+            else if (is_directive(first, close))
+            {
+                if (depth == 0)
+                {
+                    return i;
+                }
+                depth--;
+            }
+            else if (middle != NULL && depth == 0 && *middle_index == end && is_directive(first, middle))
+            {
+                *middle_index = i;
+            }
+        }
+        return end;
+    }
+
+    bool fail(String message, u64 line)
+    {
+        message.make_c_string();
+        return fail(message.data, line);
+    }
+
+    Tokens substitute_constants(Tokens tokens, u64 begin, u64 end)
+    {
+        auto result = Tokens::allocate();
+        for (auto i = begin; i < end; i++)
+        {
+            if (tokens.data[i].type == TokenTypeName && constant_indices.contains(tokens.data[i].name))
+            {
+                auto value = constants.data[constant_indices.get(tokens.data[i].name)].value;
+                for (u64 k = 0; k < value.size; k++)
+                {
+                    auto token = value.data[k];
+                    token.line = tokens.data[i].line;
+                    result.push(token);
+                }
+                continue;
+            }
+            result.push(tokens.data[i]);
+        }
+        return result;
+    }
+
+    // the tokens between begin and end, preceded by the directive that uses them
+    bool evaluate_constant(Tokens tokens, u64 begin, u64 end, s64* value)
+    {
+        auto line = tokens.data[begin-1].line;
+        auto substituted = substitute_constants(tokens, begin, end);
+        auto expression = parse_expression(substituted, 0, substituted.size);
+        free(substituted.data);
+        if (expression == NULL)
+        {
+            return fail("Expected a constant expression", line);
+        }
+        auto evaluation = evaluate_expression(expression, NULL);
+        if (!evaluation.success)
+        {
+            return fail(evaluation.error, line);
+        }
+        *value = evaluation.value;
+        return true;
+    }
+
+    bool define_constant(Tokens tokens, u64 line_begin, u64 line_end)
+    {
+        auto line = tokens.data[line_begin].line;
+        if (line_begin + 1 == line_end || tokens.data[line_begin+1].type != TokenTypeName)
+        {
+            return fail("Expected a constant name", line);
+        }
+        auto name = tokens.data[line_begin+1].name;
+        if (macro_indices.contains(name))
+        {
+            return fail("Constant is already defined", line);
+        }
+        auto value_begin = line_begin + 2;
+        if (value_begin != line_end && tokens.data[value_begin].type == TokenTypeComma)
+        {
+            value_begin++;
+        }
+
+        auto substituted = substitute_constants(tokens, value_begin, line_end);
+        auto expression = parse_expression(substituted, 0, substituted.size);
+        if (expression == NULL)
+        {
+            return fail("Expected a constant expression", line);
+        }
+
+        Constant constant;
+        constant.name = name;
+        constant.value = Tokens::allocate();
+        if (expression->references_labels())
+        {
+            // label addresses are only known after layout, so the expression gets evaluated wherever it's used
+            Token open_parenthesis;
+            open_parenthesis.type = TokenTypeOpenParenthesis;
+            open_parenthesis.line = line;
+            constant.value.push(open_parenthesis);
+            for (u64 i = 0; i < substituted.size; i++)
+            {
+                constant.value.push(substituted.data[i]);
+            }
+            Token close_parenthesis;
+            close_parenthesis.type = TokenTypeCloseParenthesis;
+            close_parenthesis.line = line;
+            constant.value.push(close_parenthesis);
+        }
+        else
+        {
+            auto evaluation = evaluate_expression(expression, NULL);
+            if (!evaluation.success)
+            {
+                return fail(evaluation.error, line);
+            }
+            Token integer;
+            integer.type = TokenTypeInteger;
+            integer.line = line;
+            integer.integer = evaluation.value;
+            constant.value.push(integer);
+        }
+        free(substituted.data);
+
+        // a macro or `.rept` body defines its constants again in every expansion
+        if (constant_indices.contains(name))
+        {
+            auto same = have_same_tokens(constants.data[constant_indices.get(name)].value, constant.value);
+            free(constant.value.data);
+            if (!same)
+            {
+                return fail("Constant is already defined with a different value", line);
+            }
+            return true;
+        }
+        constant_indices.set(name, constants.size);
+        constants.push(constant);
+        return true;
+    }
+
+    bool define_macro(Tokens tokens, u64 line_begin, u64 line_end, u64 block_end)
+    {
+        auto line = tokens.data[line_begin].line;
+        if (line_begin + 1 == line_end || tokens.data[line_begin+1].type != TokenTypeName)
+        {
+            return fail("Expected a macro name", line);
+        }
+
+        Macro macro;
+        macro.name = tokens.data[line_begin+1].name;
+        macro.line = line;
+        macro.parameter_indices = StringMap::allocate();
+        macro.parameter_count = 0;
+        macro.local_labels = StringMap::allocate();
+        macro.body = Tokens::allocate();
+
+        if (macro_indices.contains(macro.name) || constant_indices.contains(macro.name))
+        {
+            return fail("Macro is already defined", line);
+        }
+
+        for (auto i = line_begin + 2; i < line_end; i++)
+        {
+            if (tokens.data[i].type != TokenTypeName
+                || i + 1 != line_end && tokens.data[i+1].type != TokenTypeComma)
+            {
+                return fail("Expected a comma separated list of parameter names", line);
+            }
+            macro.parameter_indices.set(tokens.data[i].name, macro.parameter_count);
+            macro.parameter_count++;
+            i++; // skip the comma
+        }
+
+        for (auto i = line_end + 1; i < block_end; i++)
+        {
+            auto token = tokens.data[i];
+            if (is_directive(token, "macro"))
+            {
+                return fail("Macros can't be defined inside other macros", token.line);
+            }
+            if (token.type == TokenTypeName && i + 1 < block_end && tokens.data[i+1].type == TokenTypeColon)
+            {
+                macro.local_labels.set(token.name, 0);
+            }
+            macro.body.push(token);
+        }
+
+        macro_indices.set(macro.name, macros.size);
+        macros.push(macro);
+        return true;
+    }
+
+    String make_local_label(Macro macro, u64 expansion_id, String label)
+    {
+        auto result = String::allocate();
+        result.push("__");
+        result.push(macro.name);
+        result.push("_");
+        result.push(expansion_id);
+        result.push("_");
+        result.push(label);
+        return result;
+    }
+
+    bool invoke_macro(Tokens tokens, u64 line_begin, u64 line_end, u64 depth)
+    {
+        auto line = tokens.data[line_begin].line;
+        auto macro = macros.data[macro_indices.get(tokens.data[line_begin].name)];
+        if (depth == MAX_MACRO_EXPANSION_DEPTH)
+        {
+            return fail("Macros are nested too deeply (is a macro invoking itself?)", line);
+        }
+
+        // arguments are the token ranges between commas
+        auto argument_begins = (u64*)malloc((macro.parameter_count + 1) * sizeof(u64));
+        auto argument_ends = (u64*)malloc((macro.parameter_count + 1) * sizeof(u64));
+        u64 argument_count = 0;
+        for (auto i = line_begin + 1; i < line_end; )
+        {
+            auto argument_end = i;
+            while (argument_end != line_end && tokens.data[argument_end].type != TokenTypeComma)
+            {
+                argument_end++;
+            }
+            if (argument_end == i || argument_count == macro.parameter_count)
+            {
+                free(argument_begins);
+                free(argument_ends);
+                return fail("Wrong arguments for a macro", line);
+            }
+            argument_begins[argument_count] = i;
+            argument_ends[argument_count] = argument_end;
+            argument_count++;
+            i = argument_end == line_end ? line_end : argument_end + 1;
+        }
+        if (argument_count != macro.parameter_count)
+        {
+            free(argument_begins);
+            free(argument_ends);
+            return fail("Wrong number of arguments for a macro", line);
+        }
+
+        auto expansion_id = next_expansion_id;
+        next_expansion_id++;
+
+        auto expanded = Tokens::allocate();
+        for (u64 i = 0; i < macro.body.size; i++)
+        {
+            auto token = macro.body.data[i];
+            if (token.type == TokenTypeName && macro.parameter_indices.contains(token.name))
+            {
+                auto parameter_index = macro.parameter_indices.get(token.name);
+                for (auto k = argument_begins[parameter_index]; k < argument_ends[parameter_index]; k++)
+                {
+                    expanded.push(tokens.data[k]);
+                }
+                continue;
+            }
+            if (token.type == TokenTypeName && macro.local_labels.contains(token.name))
+            {
+                token.name = make_local_label(macro, expansion_id, token.name);
+            }
+            expanded.push(token);
+        }
+        free(argument_begins);
+        free(argument_ends);
+
+        auto success = expand(expanded, 0, expanded.size, depth + 1);
+        free(expanded.data);
+        return success;
+    }
+
+    bool expand(Tokens tokens, u64 begin, u64 end, u64 depth)
+    {
+        for (auto i = begin; i < end; )
+        {
+            auto line_end = find_line_end(tokens, i, end);
+            auto next_line = line_end == end ? end : line_end + 1;
+            auto first = tokens.data[i];
+
+            if (is_directive(first, "macro"))
+            {
+                auto block_end = find_block_end(tokens, next_line, end, "macro", "endm", NULL, NULL);
+                if (block_end == end)
+                {
+                    return fail("Missing .endm for the macro", first.line);
+                }
+                if (!define_macro(tokens, i, line_end, block_end))
+                {
+                    return false;
+                }
+                i = find_line_end(tokens, block_end, end) + 1;
+            }
+            else if (is_directive(first, "rept"))
+            {
+                s64 count = 0;
+                if (!evaluate_constant(tokens, i + 1, line_end, &count))
+                {
+                    return false;
+                }
+                if (count < 0)
+                {
+                    return fail("Negative repeat count", first.line);
+                }
+                auto block_end = find_block_end(tokens, next_line, end, "rept", "endr", NULL, NULL);
+                if (block_end == end)
+                {
+                    return fail("Missing .endr for the repeat block", first.line);
+                }
+                for (s64 k = 0; k < count; k++)
+                {
+                    if (!expand(tokens, next_line, block_end, depth))
+                    {
+                        return false;
+                    }
+                }
+                i = find_line_end(tokens, block_end, end) + 1;
+            }
+            else if (is_directive(first, "if"))
+            {
+                s64 value = 0;
+                if (!evaluate_constant(tokens, i + 1, line_end, &value))
+                {
+                    return false;
+                }
+                auto else_index = end;
+                auto block_end = find_block_end(tokens, next_line, end, "if", "endif", "else", &else_index);
+                if (block_end == end)
+                {
+                    return fail("Missing .endif for the conditional block", first.line);
+                }
+                auto success = true;
+                if (value != 0)
+                {
+                    success = expand(tokens, next_line, else_index == end ? block_end : else_index, depth);
+                }
+                else if (else_index != end)
+                {
+                    success = expand(tokens, find_line_end(tokens, else_index, end) + 1, block_end, depth);
+                }
+                if (!success)
+                {
+                    return false;
+                }
+                i = find_line_end(tokens, block_end, end) + 1;
+            }
+            else if (is_directive(first, "endm") || is_directive(first, "endr")
+                || is_directive(first, "else") || is_directive(first, "endif"))
+            {
+                return fail("Unexpected end of a block", first.line);
+            }
+            else if (first.type == TokenTypeName && macro_indices.contains(first.name)
+                && (i + 1 == end || tokens.data[i+1].type != TokenTypeColon))
+            {
+                if (!invoke_macro(tokens, i, line_end, depth))
+                {
+                    return false;
+                }
+                i = next_line;
+            }
+            else if (is_directive(first, "equ"))
+            {
+                if (!define_constant(tokens, i, line_end))
+                {
+                    return false;
+                }
+                i = next_line;
+            }
+            else
+            {
+                if (first.type == TokenTypeName && i + 1 != end && tokens.data[i+1].type == TokenTypeColon
+                    && constant_indices.contains(first.name))
+                {
+                    return fail("A constant can't be used as a label", first.line);
+                }
+                auto substituted = substitute_constants(tokens, i, next_line);
+                for (u64 k = 0; k < substituted.size; k++)
+                {
+                    result.push(substituted.data[k]);
+                }
+                free(substituted.data);
+                i = next_line;
+            }
+        }
+        return true;
+    }
+};
+
+struct MacroExpansionResult
+{
+    bool success;
+    Tokens tokens;
+    String error;
+};
+
+MacroExpansionResult expand_macros(Tokens tokens)
+{
+    MacroExpansionState state;
+    state.macros = Macros::allocate();
+    state.macro_indices = StringMap::allocate();
+    state.constants = Constants::allocate();
+    state.constant_indices = StringMap::allocate();
+    state.result = Tokens::allocate();
+    state.next_expansion_id = 0;
+    state.failed = false;
+
+    MacroExpansionResult result;
+    result.success = state.expand(tokens, 0, tokens.size, 0);
+    result.tokens = state.result;
+    result.error = state.error;
+    return result;
+}
@@ -4,11 +4,36 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
 
 #include "common.cpp"
 #include "tokenizer.cpp"
+#include "expressions.cpp"
+#include "macro_expander.cpp"
 #include "ast_parser.cpp"
+#include "rewrite_database.cpp"
+#include "cost_model.cpp"
+#include "functions.cpp"
+#include "branch_fusion.cpp" // before the passes that price calls in its forms
+#include "peephole_optimizer.cpp"
+#include "inliner.cpp"
+#include "dead_code_eliminator.cpp"
+#include "control_flow_graph.cpp"
+#include "constant_propagation.cpp"
+#include "loop_invariant_code_motion.cpp"
+#include "loop_unroller.cpp"
+#include "outliner.cpp"
+#include "delay_synthesizer.cpp"
+#include "address_relaxation.cpp" // before block_layout, which needs the relaxed addresses for a profile
+#include "block_layout.cpp"
+#include "optimizer.cpp"
+#include "timing_analyzer.cpp"
+#include "stack_analyzer.cpp"
 #include "binary_backend.cpp"
+#include "testbench_generator.cpp"
 
 String read_whole_file(const char* file_path)
 {
@@ -46,21 +71,192 @@ String get_program_directory_from_argv(char** argv)
     return result;
 }
 
+enum OutputFormat
+{
+    OutputFormatVhdl,
+    OutputFormatCoe,
+    OutputFormatMem,
+    OutputFormatIntelHex,
+    OutputFormatRaw,
+    OutputFormatSerialFrame,
+};
+
+struct CommandLineOptions
+{
+    bool has_source_path;
+    const char* source_path;
+    bool optimize;
+    OptimizationPriority priority;
+    u64 rom_budget;
+    const char* cfg_dot_path; // NULL if the control-flow graph isn't exported
+    const char* rewrites_path; // NULL if no superoptimizer rewrites are used
+    const char* timing_report_path; // NULL if the timing analysis is only checked against the deadlines
+    const char* stack_report_path; // NULL if the stack analysis is only checked for errors
+    const char* profile_path; // NULL if blocks are laid out with the static estimate
+    const char* testbench_path; // NULL if no testbench is generated
+    bool expand_calls; // for cores without the native `call` and `ret`
+    OutputFormat output_format;
+};
+
+CommandLineOptions parse_command_line(s32 argc, char** argv)
+{
+    CommandLineOptions result;
+    result.has_source_path = false;
+    result.optimize = false;
+    result.priority = OptimizationPrioritySpeed;
+    result.rom_budget = CostModel::DEFAULT_ROM_BUDGET;
+    result.cfg_dot_path = NULL;
+    result.rewrites_path = NULL;
+    result.timing_report_path = NULL;
+    result.stack_report_path = NULL;
+    result.profile_path = NULL;
+    result.testbench_path = NULL;
+    result.expand_calls = false;
+    result.output_format = OutputFormatVhdl;
+
+    for (s32 i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-O") == 0 || strcmp(argv[i], "--optimize") == 0)
+        {
+            result.optimize = true;
+        }
+        else if (strcmp(argv[i], "-Os") == 0 || strcmp(argv[i], "--optimize-size") == 0)
+        {
+            result.optimize = true;
+            result.priority = OptimizationPrioritySize;
+        }
+        else if (strcmp(argv[i], "--rom-budget") == 0 && i + 1 < argc)
+        {
+            i++;
+            result.rom_budget = strtoull(argv[i], NULL, 10);
+        }
+        else if (strcmp(argv[i], "--cfg-dot") == 0 && i + 1 < argc)
+        {
+            i++;
+            result.cfg_dot_path = argv[i];
+        }
+        else if (strcmp(argv[i], "--rewrites") == 0 && i + 1 < argc)
+        {
+            i++;
+            result.rewrites_path = argv[i];
+        }
+        else if (strcmp(argv[i], "--timing-report") == 0 && i + 1 < argc)
+        {
+            i++;
+            result.timing_report_path = argv[i];
+        }
+        else if (strcmp(argv[i], "--stack-report") == 0 && i + 1 < argc)
+        {
+            i++;
+            result.stack_report_path = argv[i];
+        }
+        else if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc)
+        {
+            i++;
+            result.profile_path = argv[i];
+        }
+        else if (strcmp(argv[i], "--testbench") == 0 && i + 1 < argc)
+        {
+            i++;
+            result.testbench_path = argv[i];
+        }
+        else if (strcmp(argv[i], "--expand-calls") == 0)
+        {
+            result.expand_calls = true;
+        }
+        else if (strcmp(argv[i], "--output-format") == 0 && i + 1 < argc)
+        {
+            i++;
+            if (strcmp(argv[i], "vhdl") == 0)
+            {
+                result.output_format = OutputFormatVhdl;
+            }
+            else if (strcmp(argv[i], "coe") == 0)
+            {
+                result.output_format = OutputFormatCoe;
+            }
+            else if (strcmp(argv[i], "mem") == 0)
+            {
+                result.output_format = OutputFormatMem;
+            }
+            else if (strcmp(argv[i], "hex") == 0)
+            {
+                result.output_format = OutputFormatIntelHex;
+            }
+            else if (strcmp(argv[i], "bin") == 0)
+            {
+                result.output_format = OutputFormatRaw;
+            }
+            else if (strcmp(argv[i], "serial") == 0)
+            {
+                result.output_format = OutputFormatSerialFrame;
+            }
+            else
+            {
+                printf("Unknown output format: %s\n", argv[i]);
+                exit(1);
+            }
+        }
+        else if (argv[i][0] == '-')
+        {
+            printf("Unknown option: %s\n", argv[i]);
+            exit(1);
+        }
+        else if (!result.has_source_path)
+        {
+            result.has_source_path = true;
+            result.source_path = argv[i];
+        }
+        else
+        {
+            panic("Only one source file can be assembled at a time");
+        }
+    }
+
+    if (result.profile_path != NULL && !result.optimize)
+    {
+        printf("--profile only works together with -O or -Os\n");
+        exit(1);
+    }
+
+    return result;
+}
+
 int main(s32 argc, char** argv)
 {
-    auto program_directory = get_program_directory_from_argv(argv);
-    auto source_path = program_directory.copy();
-    source_path.push("/samples/4.asm");
+    auto options = parse_command_line(argc, argv);
+    has_native_calls = !options.expand_calls; // before anything asks a node for its size
+
+    auto source_path = String::allocate(64);
+    if (options.has_source_path)
+    {
+        source_path.push(options.source_path);
+    }
+    else
+    {
+        source_path = get_program_directory_from_argv(argv);
+        source_path.push("/samples/4.asm");
+    }
     source_path.make_c_string();
     auto source = read_whole_file(source_path.data);
 
     auto tokenization_result = tokenize(source);
     if (!tokenization_result.success)
     {
-        panic("Tokenization failed");
+        printf("Tokenization failed on line %llu\n", (unsigned long long)tokenization_result.error_line);
+        return 1;
+    }
+
+    auto macro_expansion_result = expand_macros(tokenization_result.tokens);
+    if (!macro_expansion_result.success)
+    {
+        printf("Expanding macros failed: ");
+        macro_expansion_result.error.print();
+        printf("\n");
+        return 1;
     }
 
-    auto ast_parsing_result = parse_ast(tokenization_result.tokens);
+    auto ast_parsing_result = parse_ast(macro_expansion_result.tokens);
     if (!ast_parsing_result.success)
     {
         printf("Parsing AST failed: ");
@@ -69,9 +265,200 @@ int main(s32 argc, char** argv)
         return 1;
     }
 
-    auto binary_result = compile_to_binary(ast_parsing_result.ast);
+    auto ast = ast_parsing_result.ast;
+    auto annotations = ast_parsing_result.annotations;
+
+    if (options.optimize)
+    {
+        auto cost_model = CostModel::make(options.priority);
+        cost_model.rom_budget = options.rom_budget;
+        auto database = RewriteDatabase::allocate();
+        if (options.rewrites_path != NULL)
+        {
+            auto database_loading_result = parse_rewrite_database(read_whole_file(options.rewrites_path));
+            if (!database_loading_result.success)
+            {
+                printf("Loading rewrites failed: ");
+                database_loading_result.error.print();
+                printf("\n");
+                return 1;
+            }
+            database = database_loading_result.database;
+        }
+        ExecutionProfile profile;
+        if (options.profile_path != NULL)
+        {
+            auto profile_loading_result = parse_execution_profile(read_whole_file(options.profile_path));
+            if (!profile_loading_result.success)
+            {
+                printf("Loading the profile failed: ");
+                profile_loading_result.error.print();
+                printf("\n");
+                return 1;
+            }
+            profile = profile_loading_result.profile;
+        }
+        ast = optimize(ast, ast_parsing_result.data, cost_model, database, options.profile_path != NULL ? &profile : NULL);
+    }
+
+    auto annotation_count = annotations.size;
+    auto delay_lowering_result = lower_delays(ast, &annotations, false);
+    auto branch_fusion_result = fuse_branches(delay_lowering_result.ast);
+    auto address_relaxation_result = relax_addresses(branch_fusion_result.ast, ast_parsing_result.data, false);
+    if (address_relaxation_result.success && address_relaxation_result.is_wide && delay_lowering_result.delays != 0)
+    {
+        // the delays were timed for one page, so they're lowered again with far calls and two byte return addresses,
+        // and the program stays wide even if that makes it fit in one page
+        annotations.size = annotation_count;
+        delay_lowering_result = lower_delays(ast, &annotations, true);
+        branch_fusion_result = fuse_branches(delay_lowering_result.ast);
+        address_relaxation_result = relax_addresses(branch_fusion_result.ast, ast_parsing_result.data, true);
+    }
+
+    if (delay_lowering_result.delays != 0)
+    {
+        fprintf(
+            stderr,
+            "Delays: %llu delay(s), %llu shared loop level(s)\n",
+            (unsigned long long)delay_lowering_result.delays,
+            (unsigned long long)delay_lowering_result.levels
+        );
+    }
+
+    if (branch_fusion_result.inline_targets != 0 || branch_fusion_result.native_calls != 0)
+    {
+        fprintf(
+            stderr,
+            "Branch fusion: %llu compare-and-branch(es), %llu jump(s) with an inline target, %llu native call(s), saved %llu bytes\n",
+            (unsigned long long)branch_fusion_result.fused_compares,
+            (unsigned long long)(branch_fusion_result.inline_targets - branch_fusion_result.fused_compares),
+            (unsigned long long)branch_fusion_result.native_calls,
+            (unsigned long long)branch_fusion_result.bytes_saved
+        );
+    }
+
+    if (!address_relaxation_result.success)
+    {
+        printf("Address relaxation failed: ");
+        address_relaxation_result.error.print();
+        printf("\n");
+        return 1;
+    }
+    ast = address_relaxation_result.ast;
+    if (address_relaxation_result.is_wide)
+    {
+        fprintf(
+            stderr,
+            "Address relaxation: 16-bit addresses, %llu far node(s)\n",
+            (unsigned long long)address_relaxation_result.far_nodes
+        );
+    }
+
+    if (options.cfg_dot_path != NULL)
+    {
+        auto file = fopen(options.cfg_dot_path, "w");
+        if (file == NULL)
+        {
+            panic("Failed to open the control-flow graph output file");
+        }
+        auto graph = build_control_flow_graph(ast);
+        graph.print_dot(file);
+        graph.deallocate();
+        fclose(file);
+    }
+
+    auto timing = analyze_timing(ast, annotations);
+    if (options.timing_report_path != NULL)
+    {
+        auto file = fopen(options.timing_report_path, "w");
+        if (file == NULL)
+        {
+            panic("Failed to open the timing report file");
+        }
+        timing.print_report(file);
+        fclose(file);
+    }
+    auto deadline_check_result = timing.check_deadlines();
+    if (!deadline_check_result.success)
+    {
+        printf("Timing analysis failed: ");
+        deadline_check_result.error.print();
+        printf("\n");
+        return 1;
+    }
+
+    if (options.testbench_path != NULL)
+    {
+        auto file = fopen(options.testbench_path, "w");
+        if (file == NULL)
+        {
+            panic("Failed to open the testbench output file");
+        }
+        print_testbench(file, timing.function_timings[timing.get_function_count() - 1].cycles.worst);
+        fclose(file);
+        if (!ast.contains(AstNodeTypeHalt))
+        {
+            fprintf(stderr, "Testbench: the program never executes `halt`, so the simulation runs until it times out\n");
+        }
+    }
+
+    auto stacks = analyze_stacks(ast);
+    if (options.stack_report_path != NULL)
+    {
+        auto file = fopen(options.stack_report_path, "w");
+        if (file == NULL)
+        {
+            panic("Failed to open the stack report file");
+        }
+        stacks.print_report(file);
+        fclose(file);
+    }
+    for (u64 i = 0; i < stacks.warnings.size; i++)
+    {
+        fprintf(stderr, "Stack analysis: ");
+        fprintf(stderr, "%.*s\n", (int)stacks.warnings.data[i].size, stacks.warnings.data[i].data);
+    }
+    if (stacks.errors.size != 0)
+    {
+        printf("Stack analysis failed: ");
+        stacks.errors.data[0].print();
+        printf("\n");
+        return 1;
+    }
+    fprintf(
+        stderr,
+        "Stack analysis: evaluation stack %llu, general stack %llu\n",
+        (unsigned long long)stacks.get_required_evaluation_stack_depth(),
+        (unsigned long long)stacks.get_required_general_stack_depth()
+    );
+
+    auto node_comments = timing.make_node_comments();
+    ast = append_data(ast, ast_parsing_result.data, address_relaxation_result.is_wide);
+    auto binary_result = compile_to_binary(ast, &node_comments);
+    binary_result.evaluation_stack_depth = stacks.get_required_evaluation_stack_depth();
+    binary_result.general_stack_depth = stacks.get_required_general_stack_depth();
 
-    binary_result.print_vhdl();
+    switch (options.output_format)
+    {
+        case OutputFormatVhdl:
+            binary_result.print_vhdl();
+            break;
+        case OutputFormatCoe:
+            binary_result.print_coe();
+            break;
+        case OutputFormatMem:
+            binary_result.print_mem();
+            break;
+        case OutputFormatIntelHex:
+            binary_result.print_intel_hex();
+            break;
+        case OutputFormatRaw:
+            binary_result.print_raw();
+            break;
+        case OutputFormatSerialFrame:
+            binary_result.print_serial_frame();
+            break;
+    }
 
     return 0;
 }
@@ -0,0 +1,121 @@
+// Runs the optimization passes in order, reporting what each of them did on stderr,
+// since stdout is reserved for the generated VHDL.
+
+void report_peephole_result(PeepholeOptimizationResult result)
+{
+    fprintf(
+        stderr,
+        "Peephole optimizer: %llu rewrites, saved %llu bytes and %llu cycles (static)\n",
+        (unsigned long long)result.rewrites,
+        (unsigned long long)result.bytes_saved,
+        (unsigned long long)result.cycles_saved
+    );
+}
+
+void report_block_layout_result(BlockLayoutResult result, const char* source)
+{
+    fprintf(
+        stderr,
+        "Block layout: moved %llu block(s), inverted %llu branch(es), %+lld bytes, expected to save %lld cycles (%s)\n",
+        (unsigned long long)result.moved_blocks,
+        (unsigned long long)result.inverted_branches,
+        (long long)result.bytes_added,
+        (long long)result.cycles_saved,
+        source
+    );
+}
+
+// database can be empty, profile is NULL if there is none, data is the one split_data took out
+Ast optimize(Ast ast, Ast data, CostModel cost_model, RewriteDatabase database, ExecutionProfile* profile)
+{
+    auto peephole_result = optimize_peephole(ast, database);
+    report_peephole_result(peephole_result);
+    ast = peephole_result.ast;
+
+    auto inlining_result = inline_functions(ast, cost_model);
+    fprintf(
+        stderr,
+        "Inliner: inlined %llu call site(s), converted %llu tail call(s), saved %lld bytes and %lld cycles (static)\n",
+        (unsigned long long)inlining_result.inlined_call_sites,
+        (unsigned long long)inlining_result.tail_calls,
+        (long long)inlining_result.bytes_saved,
+        (long long)inlining_result.cycles_saved
+    );
+    ast = inlining_result.ast;
+
+    auto constant_propagation_result = propagate_constants(ast);
+    fprintf(
+        stderr,
+        "Constant propagation: folded %llu branch(es)\n",
+        (unsigned long long)constant_propagation_result.folded_branches
+    );
+    ast = constant_propagation_result.ast;
+
+    // inlined bodies and folded branches open up new local patterns, e.g. a `push 0, cmp` right after a `push`
+    // or the `push <label>, pop` left behind by a branch that is never taken
+    peephole_result = optimize_peephole(ast, database);
+    report_peephole_result(peephole_result);
+    ast = peephole_result.ast;
+
+    if (cost_model.priority == OptimizationPrioritySpeed)
+    {
+        auto unrolling_result = unroll_loops(ast, cost_model);
+        fprintf(
+            stderr,
+            "Loop unroller: unrolled %llu loop(s), expected to save %lld cycles (static)\n",
+            (unsigned long long)unrolling_result.unrolled_loops,
+            (long long)unrolling_result.cycles_saved
+        );
+        ast = unrolling_result.ast;
+
+        // the copies of the step fold into one
+        peephole_result = optimize_peephole(ast, database);
+        report_peephole_result(peephole_result);
+        ast = peephole_result.ast;
+    }
+
+    auto loop_invariant_code_motion_result = hoist_loop_invariants(ast, cost_model);
+    fprintf(
+        stderr,
+        "Loop-invariant code motion: hoisted values out of %llu of %llu loop(s)\n",
+        (unsigned long long)loop_invariant_code_motion_result.hoisted_loops,
+        (unsigned long long)loop_invariant_code_motion_result.loops
+    );
+    ast = loop_invariant_code_motion_result.ast;
+
+    auto dead_code_elimination_result = eliminate_dead_code(ast);
+    fprintf(
+        stderr,
+        "Dead code eliminator: reclaimed %llu bytes\n",
+        (unsigned long long)dead_code_elimination_result.bytes_saved
+    );
+    ast = dead_code_elimination_result.ast;
+
+    if (cost_model.priority == OptimizationPrioritySize)
+    {
+        auto outlining_result = outline_repeated_sequences(ast, cost_model);
+        fprintf(
+            stderr,
+            "Outliner: outlined %llu sequence(s), saved %lld bytes\n",
+            (unsigned long long)outlining_result.outlined_sequences,
+            (long long)outlining_result.bytes_saved
+        );
+        ast = outlining_result.ast;
+    }
+
+    // the profile is taken of the program laid out with the static estimate, so that layout comes first
+    // and the profile refines it
+    auto layout_result = lay_out_blocks(ast, cost_model, NULL, NULL);
+    report_block_layout_result(layout_result, "static estimate");
+    ast = layout_result.ast;
+    if (profile != NULL)
+    {
+        auto addresses = get_node_addresses(ast, data);
+        layout_result = lay_out_blocks(ast, cost_model, profile, addresses);
+        report_block_layout_result(layout_result, "profile");
+        ast = layout_result.ast;
+        free(addresses);
+    }
+
+    return ast;
+}
@@ -0,0 +1,378 @@
+// Moves instruction sequences that repeat across the program into shared subroutines, for --optimize-size.
+// Repeats are found with a suffix array over the nodes, equal nodes getting equal symbols and every label
+// a symbol of its own, so that no sequence spans a label.
+//
+// A sequence is replaced with `push __outlined_N, call` and the subroutine ends with `ret`. Inside of it
+// the top of the general stack is the return address, so the sequence may not use `load`, `store` or `ret`
+// and may not jump anywhere. A sequence that ends with `jmp` or `ret` never comes back, so it's entered with
+// `push __outlined_N, jmp` instead and can contain anything but labels.
+
+struct OutlinerState
+{
+    Ast ast;
+    CostModel cost_model;
+    u64* symbols;
+    u64* suffixes; // suffix array
+    u64* common_prefixes; // common_prefixes[i] is the longest common prefix of suffixes i-1 and i
+    u64 next_outlined_id;
+    u64 insertion_point; // ast.size + 1 if the subroutine needs a jump around it
+
+    // in the forms fuse_branches emits, so they follow has_native_calls
+    u64 call_size; // push __outlined_N, call
+    u64 call_cycles; // the call and `ret`
+    u64 tail_call_size; // push __outlined_N, jmp
+    u64 tail_call_cycles;
+    u64 ret_size;
+
+    void assign_symbols()
+    {
+        symbols = (u64*)malloc((ast.size + 1) * sizeof(u64));
+        auto texts = (String*)malloc((ast.size + 1) * sizeof(String));
+        u64 next_symbol = 0;
+        for (u64 i = 0; i < ast.size; i++)
+        {
+            texts[i] = ast.data[i].to_string();
+            symbols[i] = next_symbol;
+            if (ast.data[i].type == AstNodeTypeLabel)
+            {
+                next_symbol++;
+                continue;
+            }
+            for (u64 k = 0; k < i; k++)
+            {
+                if (ast.data[k].type == ast.data[i].type && texts[k] == texts[i])
+                {
+                    symbols[i] = symbols[k];
+                    break;
+                }
+            }
+            if (symbols[i] == next_symbol)
+            {
+                next_symbol++;
+            }
+        }
+        free(texts);
+    }
+
+    // negative if the suffix at left sorts first
+    s64 compare_suffixes(u64 left, u64 right)
+    {
+        while (left < ast.size && right < ast.size)
+        {
+            if (symbols[left] != symbols[right])
+            {
+                return symbols[left] < symbols[right] ? -1 : 1;
+            }
+            left++;
+            right++;
+        }
+        return left == ast.size ? -1 : 1;
+    }
+
+    // insertion sort, quadratic in the worst case like the search for repeats in outline_once, which takes most of
+    // the time: -Os on 40000 bytes of one sequence repeated over and over takes about 20 seconds
+    void build_suffix_array()
+    {
+        suffixes = (u64*)malloc((ast.size + 1) * sizeof(u64));
+        common_prefixes = (u64*)malloc((ast.size + 1) * sizeof(u64));
+        for (u64 i = 0; i < ast.size; i++)
+        {
+            auto suffix = i;
+            auto k = i;
+            while (k != 0 && compare_suffixes(suffix, suffixes[k-1]) < 0)
+            {
+                suffixes[k] = suffixes[k-1];
+                k--;
+            }
+            suffixes[k] = suffix;
+        }
+        for (u64 i = 0; i < ast.size; i++)
+        {
+            common_prefixes[i] = 0;
+            if (i == 0)
+            {
+                continue;
+            }
+            auto left = suffixes[i-1];
+            auto right = suffixes[i];
+            while (left + common_prefixes[i] < ast.size && right + common_prefixes[i] < ast.size
+                && symbols[left + common_prefixes[i]] == symbols[right + common_prefixes[i]])
+            {
+                common_prefixes[i]++;
+            }
+        }
+    }
+
+    // whether the sequence ending at end never comes back, so it's entered with a jump
+    bool is_tail(u64 end)
+    {
+        return !ast.data[end-1].falls_through();
+    }
+
+    // whether the nodes between begin and end can become a subroutine, the same for every occurrence
+    bool can_outline(u64 begin, u64 end)
+    {
+        auto tail = is_tail(end);
+        for (auto i = begin; i < end; i++)
+        {
+            auto node = ast.data[i];
+            if (node.type == AstNodeTypeLabel || node.type == AstNodeTypeDelay)
+            {
+                return false;
+            }
+            // the target of a jump or a call has to be pushed inside of the sequence
+            if ((node.is_jump() || node.type == AstNodeTypeCall) && i == begin)
+            {
+                return false;
+            }
+            if (!tail && (node.is_jump() || !node.falls_through()
+                || node.type == AstNodeTypeLoad || node.type == AstNodeTypeStore))
+            {
+                return false;
+            }
+            if (tail && !node.falls_through() && i != end - 1)
+            {
+                return false; // anything after it is a different sequence
+            }
+        }
+        return true;
+    }
+
+    // depends on where the occurrence is: a jump right after it would lose the target it pushed
+    bool can_replace(u64 begin, u64 end)
+    {
+        if (end < ast.size && !is_tail(end)
+            && (ast.data[end].is_jump() || ast.data[end].type == AstNodeTypeCall))
+        {
+            return false;
+        }
+        return true;
+    }
+
+    // in the form fuse_branches emits, like the calls that replace it, a call it contains takes 2 bytes as well
+    u64 get_fused_size(u64 begin, u64 end)
+    {
+        auto sequence = Ast::allocate();
+        for (auto i = begin; i < end; i++)
+        {
+            sequence.push(ast.data[i]);
+        }
+        auto fused = fuse_branches(sequence).ast;
+        auto result = fused.get_size();
+        free(sequence.data);
+        free(fused.data);
+        return result;
+    }
+
+    s64 get_bytes_saved(u64 length_in_bytes, u64 occurrences, bool tail)
+    {
+        auto site_size = tail ? tail_call_size : call_size;
+        auto body_size = length_in_bytes + (tail ? 0 : ret_size);
+        if (insertion_point == ast.size + 1)
+        {
+            body_size += tail_call_size;
+        }
+        return (s64)occurrences * ((s64)length_in_bytes - (s64)site_size) - (s64)body_size;
+    }
+
+    // fills starts with non-overlapping occurrences of the sequence at begin, returns how many there are
+    u64 find_occurrences(u64 begin, u64 length, u64* starts)
+    {
+        u64 count = 0;
+        for (u64 i = 0; i + length <= ast.size; i++)
+        {
+            bool matches = true;
+            for (u64 k = 0; k < length && matches; k++)
+            {
+                matches = symbols[i + k] == symbols[begin + k];
+            }
+            if (!matches || !can_replace(i, i + length))
+            {
+                continue;
+            }
+            starts[count++] = i;
+            i += length - 1;
+        }
+        return count;
+    }
+
+    // outlines the most profitable sequence, returns false if there is none
+    bool outline_once()
+    {
+        insertion_point = ast.find_append_point();
+        assign_symbols();
+        build_suffix_array();
+
+        auto starts = (u64*)malloc((ast.size + 1) * sizeof(u64));
+        s64 best_score = 0;
+        u64 best_begin = 0;
+        u64 best_length = 0;
+
+        // every run of suffixes that share at least `length` nodes is a repeated sequence of that length
+        for (u64 i = 1; i < ast.size; i++)
+        {
+            for (u64 length = 1; length <= common_prefixes[i]; length++)
+            {
+                // only the first suffix of each run is looked at
+                if (common_prefixes[i-1] >= length)
+                {
+                    continue;
+                }
+                auto begin = suffixes[i];
+                if (!can_outline(begin, begin + length))
+                {
+                    continue;
+                }
+                auto occurrences = find_occurrences(begin, length, starts);
+                if (occurrences < 2)
+                {
+                    continue;
+                }
+                auto tail = is_tail(begin + length);
+                auto bytes_saved = get_bytes_saved(get_fused_size(begin, begin + length), occurrences, tail);
+                auto extra_cycles = (s64)occurrences * (tail ? tail_call_cycles : call_cycles);
+                auto score = cost_model.score(-bytes_saved, -extra_cycles);
+                if (bytes_saved > 0 && score > best_score)
+                {
+                    best_score = score;
+                    best_begin = begin;
+                    best_length = length;
+                }
+            }
+        }
+
+        free(symbols);
+        free(suffixes);
+        free(common_prefixes);
+
+        if (best_length == 0)
+        {
+            free(starts);
+            return false;
+        }
+
+        assign_symbols();
+        auto occurrences = find_occurrences(best_begin, best_length, starts);
+        auto tail = is_tail(best_begin + best_length);
+        auto sequence_size = get_fused_size(best_begin, best_begin + best_length);
+        auto bytes_saved = get_bytes_saved(sequence_size, occurrences, tail);
+        free(symbols);
+
+        auto name = String::allocate();
+        do
+        {
+            name.size = 0;
+            name.push("__outlined_");
+            name.push(next_outlined_id);
+            next_outlined_id++;
+        }
+        while (ast.find_label(name) != ast.size);
+
+        auto result = Ast::allocate();
+        u64 next_start = 0;
+        for (u64 i = 0; i <= ast.size; )
+        {
+            if (i == insertion_point)
+            {
+                auto line = ast.data[best_begin].line;
+                result.push(AstNode::make_label(name, line));
+                for (u64 k = 0; k < best_length; k++)
+                {
+                    result.push(ast.data[best_begin + k]);
+                }
+                if (!tail)
+                {
+                    result.push(AstNode::make(AstNodeTypeRet, line));
+                }
+            }
+            if (i == ast.size)
+            {
+                break;
+            }
+            if (next_start < occurrences && starts[next_start] == i)
+            {
+                auto line = ast.data[i].line;
+                result.push(AstNode::make_push_label(name, line));
+                result.push(AstNode::make(tail ? AstNodeTypeJmp : AstNodeTypeCall, line));
+                next_start++;
+                i += best_length;
+                continue;
+            }
+            result.push(ast.data[i]);
+            i++;
+        }
+        if (insertion_point == ast.size + 1)
+        {
+            // the program runs off the end, so the subroutine needs a jump around it
+            auto skip_label = String::allocate();
+            skip_label.push(name);
+            skip_label.push("_skip");
+            auto line = ast.data[best_begin].line;
+            result.push(AstNode::make_push_label(skip_label, line));
+            result.push(AstNode::make(AstNodeTypeJmp, line));
+            result.push(AstNode::make_label(name, line));
+            for (u64 k = 0; k < best_length; k++)
+            {
+                result.push(ast.data[best_begin + k]);
+            }
+            if (!tail)
+            {
+                result.push(AstNode::make(AstNodeTypeRet, line));
+            }
+            result.push(AstNode::make_label(skip_label, line));
+        }
+
+        fprintf(stderr, "Outliner: %.*s:", (int)name.size, name.data);
+        for (u64 k = 0; k < best_length; k++)
+        {
+            auto text = ast.data[best_begin + k].to_string();
+            fprintf(stderr, "%s%.*s", k == 0 ? " " : ", ", (int)text.size, text.data);
+        }
+        fprintf(
+            stderr,
+            " (%llu bytes, %llu occurrences), saved %lld bytes\n",
+            (unsigned long long)sequence_size,
+            (unsigned long long)occurrences,
+            (long long)bytes_saved
+        );
+
+        free(starts);
+        ast = result;
+        return true;
+    }
+};
+
+struct OutliningResult
+{
+    Ast ast;
+    u64 outlined_sequences;
+    s64 bytes_saved;
+};
+
+OutliningResult outline_repeated_sequences(Ast ast, CostModel cost_model)
+{
+    auto size_before = fuse_branches(ast).ast.get_size(); // the calls it adds are only small once fused
+
+    OutlinerState state;
+    state.ast = ast;
+    state.cost_model = cost_model;
+    state.next_outlined_id = 0;
+    auto call = make_fused_jump(AstNodeTypeCall);
+    auto tail_call = make_fused_jump(AstNodeTypeJmp);
+    auto ret = AstNode::make(AstNodeTypeRet, 0);
+    state.call_size = call.get_size();
+    state.call_cycles = call.get_cycles() + ret.get_cycles();
+    state.tail_call_size = tail_call.get_size();
+    state.tail_call_cycles = tail_call.get_cycles();
+    state.ret_size = ret.get_size();
+
+    OutliningResult result;
+    result.outlined_sequences = 0;
+    while (state.outline_once())
+    {
+        result.outlined_sequences++;
+    }
+    result.ast = state.ast;
+    result.bytes_saved = (s64)size_before - (s64)fuse_branches(state.ast).ast.get_size();
+    return result;
+}
@@ -0,0 +1,310 @@
+// Pattern-driven rewrites of short instruction sequences.
+// None of the patterns remove or reorder `cmp`, and jumps never modify the flags register,
+// so the flags observed by later conditional jumps stay exactly the same.
+// Rewrites loaded from a superoptimizer database are checked to keep the flags too.
+
+struct PeepholeOptimizerState
+{
+    Ast ast;
+    u64 rewrites;
+    RewriteDatabase database;
+
+    bool is_instruction(u64 index, AstNodeType type)
+    {
+        return index < ast.size && ast.data[index].type == type;
+    }
+
+    // push <anything>, pop => (nothing)
+    // push, pop => (nothing)
+    // dup, pop => (nothing)
+    bool remove_push_pop(u64 index)
+    {
+        if (!is_instruction(index+1, AstNodeTypePop)
+            || !is_instruction(index, AstNodeTypePush)
+                && !is_instruction(index, AstNodeTypePushNothing)
+                && !is_instruction(index, AstNodeTypeDup))
+        {
+            return false;
+        }
+        ast.remove(index, 2);
+        return true;
+    }
+
+    // push a, push b, add => push a+b
+    // and the same for sub to mulh
+    bool fold_push_push_operation(u64 index)
+    {
+        if (index + 2 >= ast.size
+            || !ast.data[index].is_push_integer()
+            || !ast.data[index+1].is_push_integer()
+            || !ast.data[index+2].is_binary_operation())
+        {
+            return false;
+        }
+        ast.data[index].integer = ast.data[index+2].compute(ast.data[index].integer, ast.data[index+1].integer);
+        ast.remove(index+1, 2);
+        return true;
+    }
+
+    // push a, not => push ~a
+    // and the same for neg and eqz
+    bool fold_push_unary_operation(u64 index)
+    {
+        if (index + 1 >= ast.size || !ast.data[index].is_push_integer() || !ast.data[index+1].is_unary_operation())
+        {
+            return false;
+        }
+        ast.data[index].integer = ast.data[index+1].compute(ast.data[index].integer, 0);
+        ast.remove(index+1, 1);
+        return true;
+    }
+
+    // push a, add, push b, add => push a+b, add
+    bool fold_add_chain(u64 index)
+    {
+        if (index + 3 >= ast.size
+            || !ast.data[index].is_push_integer()
+            || !is_instruction(index+1, AstNodeTypeAdd)
+            || !ast.data[index+2].is_push_integer()
+            || !is_instruction(index+3, AstNodeTypeAdd))
+        {
+            return false;
+        }
+        ast.data[index].integer += ast.data[index+2].integer;
+        ast.remove(index+2, 2);
+        return true;
+    }
+
+    // push 0, add => (nothing)
+    // and the same for sub, or, xor, shl and shr, or push 255, and, or push 1, mul
+    bool remove_identity_operation(u64 index)
+    {
+        if (index + 1 >= ast.size || !ast.data[index].is_push_integer() || !ast.data[index+1].is_binary_operation()
+            || is_instruction(index+1, AstNodeTypeMulh))
+        {
+            return false;
+        }
+        auto identity = is_instruction(index+1, AstNodeTypeAnd) ? 255 : is_instruction(index+1, AstNodeTypeMul) ? 1 : 0;
+        if (ast.data[index].integer != identity)
+        {
+            return false;
+        }
+        ast.remove(index, 2);
+        return true;
+    }
+
+    // not, not => (nothing)
+    // neg, neg => (nothing)
+    bool remove_double_negation(u64 index)
+    {
+        if (!(is_instruction(index, AstNodeTypeNot) && is_instruction(index+1, AstNodeTypeNot))
+            && !(is_instruction(index, AstNodeTypeNeg) && is_instruction(index+1, AstNodeTypeNeg)))
+        {
+            return false;
+        }
+        ast.remove(index, 2);
+        return true;
+    }
+
+    // store, load => (nothing)
+    // load, store => (nothing)
+    // `load` removes the value from the general stack, so both pairs leave both stacks untouched
+    bool remove_store_load(u64 index)
+    {
+        if (!(is_instruction(index, AstNodeTypeStore) && is_instruction(index+1, AstNodeTypeLoad))
+            && !(is_instruction(index, AstNodeTypeLoad) && is_instruction(index+1, AstNodeTypeStore)))
+        {
+            return false;
+        }
+        ast.remove(index, 2);
+        return true;
+    }
+
+    // dup, ddup => (nothing)
+    bool remove_dup_ddup(u64 index)
+    {
+        if (!is_instruction(index, AstNodeTypeDup) || !is_instruction(index+1, AstNodeTypeDdup))
+        {
+            return false;
+        }
+        ast.remove(index, 2);
+        return true;
+    }
+
+    // store, ret => jmp
+    // ret is a short hand for load-jmp, so the stored value is loaded right back and jumped to
+    bool fold_store_ret(u64 index)
+    {
+        if (!is_instruction(index, AstNodeTypeStore) || !is_instruction(index+1, AstNodeTypeRet))
+        {
+            return false;
+        }
+        ast.data[index].type = AstNodeTypeJmp;
+        ast.data[index].line = ast.data[index+1].line;
+        ast.remove(index+1);
+        return true;
+    }
+
+    // push L, j* => (nothing), when L is defined right after the jump
+    bool remove_jump_to_next(u64 index)
+    {
+        if (index + 1 >= ast.size || !ast.data[index].is_push_label() || !ast.data[index+1].is_jump())
+        {
+            return false;
+        }
+        for (u64 i = index + 2; i < ast.size && ast.data[i].type == AstNodeTypeLabel; i++)
+        {
+            if (ast.data[i].label == ast.data[index].label)
+            {
+                ast.remove(index, 2);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool matches_rewrite(u64 index, Ast pattern)
+    {
+        if (index + pattern.size > ast.size)
+        {
+            return false;
+        }
+        for (u64 i = 0; i < pattern.size; i++)
+        {
+            auto node = ast.data[index + i];
+            if (node.type != pattern.data[i].type
+                || node.type == AstNodeTypePush && (!node.is_push_integer() || node.integer != pattern.data[i].integer))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // the first rewrite in the database whose pattern starts at index
+    bool apply_database_rewrite(u64 index)
+    {
+        for (u64 i = 0; i < database.size; i++)
+        {
+            auto rewrite = database.data[i];
+            if (!matches_rewrite(index, rewrite.pattern))
+            {
+                continue;
+            }
+            auto line = ast.data[index].line;
+            ast.remove(index, rewrite.pattern.size);
+            for (u64 k = 0; k < rewrite.replacement.size; k++)
+            {
+                auto node = rewrite.replacement.data[k];
+                node.line = line;
+                ast.insert(index + k, node);
+            }
+            return true;
+        }
+        return false;
+    }
+
+    // if L is followed by `push M, jmp`, returns M, otherwise returns L
+    String get_jump_destination(String label)
+    {
+        auto label_index = ast.find_label(label);
+        auto instruction_index = ast.skip_labels(label_index);
+        if (instruction_index + 1 < ast.size
+            && ast.data[instruction_index].is_push_label()
+            && ast.data[instruction_index+1].type == AstNodeTypeJmp)
+        {
+            return ast.data[instruction_index].label;
+        }
+        return label;
+    }
+
+    // push L, j*, where L: push M, jmp => push M, j*
+    bool thread_jump(u64 index)
+    {
+        if (index + 1 >= ast.size || !ast.data[index].is_push_label() || !ast.data[index+1].is_jump())
+        {
+            return false;
+        }
+
+        auto destination = ast.data[index].label;
+        for (u64 steps = 0; ; steps++)
+        {
+            if (steps == ast.size)
+            {
+                return false; // the chain of jumps is an infinite loop
+            }
+            auto next_destination = get_jump_destination(destination);
+            if (next_destination == destination)
+            {
+                break;
+            }
+            destination = next_destination;
+        }
+
+        if (destination == ast.data[index].label)
+        {
+            return false;
+        }
+        ast.data[index].label = destination;
+        return true;
+    }
+
+    bool run_once()
+    {
+        bool changed = false;
+        for (u64 i = 0; i < ast.size; i++)
+        {
+            while (
+                i < ast.size
+                && (
+                    remove_push_pop(i)
+                        || fold_push_push_operation(i)
+                        || fold_push_unary_operation(i)
+                        || fold_add_chain(i)
+                        || remove_identity_operation(i)
+                        || remove_double_negation(i)
+                        || remove_store_load(i)
+                        || remove_dup_ddup(i)
+                        || fold_store_ret(i)
+                        || remove_jump_to_next(i)
+                        || thread_jump(i)
+                        || apply_database_rewrite(i)
+                )
+            )
+            {
+                rewrites++;
+                changed = true;
+            }
+        }
+        return changed;
+    }
+};
+
+struct PeepholeOptimizationResult
+{
+    Ast ast;
+    u64 rewrites;
+    u64 bytes_saved;
+    u64 cycles_saved;
+};
+
+PeepholeOptimizationResult optimize_peephole(Ast ast, RewriteDatabase database)
+{
+    auto size_before = ast.get_size();
+    auto cycles_before = ast.get_cycles();
+
+    PeepholeOptimizerState state;
+    state.ast = ast;
+    state.rewrites = 0;
+    state.database = database;
+    while (state.run_once())
+    {
+    }
+
+    PeepholeOptimizationResult result;
+    result.ast = state.ast;
+    result.rewrites = state.rewrites;
+    result.bytes_saved = size_before - state.ast.get_size();
+    result.cycles_saved = cycles_before - state.ast.get_cycles();
+    return result;
+}
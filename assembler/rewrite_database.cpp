@@ -0,0 +1,196 @@
+// Rewrites produced by the superoptimizer (see /superoptimizer).
+// The file is a list of entries: the pattern in plain assembly, a line with just `=>`, the replacement
+// and an empty line. Lines starting with '#' are comments. Patterns never contain labels or jumps,
+// and every replacement leaves both stacks and the flags exactly as the pattern would.
+
+struct Rewrite
+{
+    Ast pattern;
+    Ast replacement;
+};
+
+struct RewriteDatabase
+{
+    u64 capacity;
+    u64 size;
+    Rewrite* data;
+
+    static const u64 DEFAULT_CAPACITY = 64;
+
+    static RewriteDatabase allocate()
+    {
+        RewriteDatabase result;
+        result.capacity = DEFAULT_CAPACITY;
+        result.size = 0;
+        result.data = (Rewrite*)malloc(result.capacity * sizeof(Rewrite));
+        return result;
+    }
+
+    void push(Rewrite rewrite)
+    {
+        if (size == capacity)
+        {
+            capacity *= 2;
+            data = (Rewrite*)realloc(data, capacity * sizeof(Rewrite));
+        }
+        data[size] = rewrite;
+        size++;
+    }
+};
+
+struct RewriteDatabaseLoadingResult
+{
+    bool success;
+    RewriteDatabase database;
+    String error;
+};
+
+RewriteDatabaseLoadingResult make_rewrite_database_error(const char* message, u64 line)
+{
+    RewriteDatabaseLoadingResult result;
+    result.success = false;
+    result.error = String::allocate();
+    result.error.push(message);
+    result.error.push(" on line ");
+    result.error.push(line);
+    return result;
+}
+
+// each side is assembled on its own, so it can only contain plain instructions
+bool parse_rewrite_side(String source, Ast* result)
+{
+    auto tokenization_result = tokenize(source);
+    if (!tokenization_result.success)
+    {
+        return false;
+    }
+    auto parsing_result = parse_ast(tokenization_result.tokens);
+    if (!parsing_result.success || parsing_result.data.size != 0)
+    {
+        return false;
+    }
+    for (u64 i = 0; i < parsing_result.ast.size; i++)
+    {
+        auto node = parsing_result.ast.data[i];
+        if (node.type == AstNodeTypeLabel || node.is_jump() || node.type == AstNodeTypeCall
+            || !node.falls_through() || node.type == AstNodeTypePush && !node.is_push_integer())
+        {
+            return false;
+        }
+    }
+    *result = parsing_result.ast;
+    return true;
+}
+
+struct RewriteDatabaseParsingState
+{
+    RewriteDatabase database;
+    String pattern;
+    String replacement;
+    bool is_in_replacement;
+    u64 entry_line;
+
+    bool has_entry()
+    {
+        return is_in_replacement || pattern.size != 0;
+    }
+
+    // NULL on success
+    const char* finish_entry()
+    {
+        if (!is_in_replacement)
+        {
+            return "Missing `=>`";
+        }
+        Rewrite rewrite;
+        if (!parse_rewrite_side(pattern, &rewrite.pattern) || !parse_rewrite_side(replacement, &rewrite.replacement)
+            || rewrite.pattern.size == 0)
+        {
+            return "Invalid rewrite";
+        }
+        if (rewrite.replacement.get_size() >= rewrite.pattern.get_size())
+        {
+            return "Replacement isn't smaller than the pattern";
+        }
+        database.push(rewrite);
+        pattern = String::allocate();
+        replacement = String::allocate();
+        is_in_replacement = false;
+        return NULL;
+    }
+};
+
+RewriteDatabaseLoadingResult parse_rewrite_database(String source)
+{
+    RewriteDatabaseParsingState state;
+    state.database = RewriteDatabase::allocate();
+    state.pattern = String::allocate();
+    state.replacement = String::allocate();
+    state.is_in_replacement = false;
+    state.entry_line = 1;
+
+    u64 line = 1;
+    for (u64 i = 0; i < source.size; line++)
+    {
+        auto line_end = i;
+        while (line_end < source.size && source.data[line_end] != '\n')
+        {
+            line_end++;
+        }
+        auto line_size = line_end - i;
+        if (line_size != 0 && source.data[line_end-1] == '\r')
+        {
+            line_size--;
+        }
+
+        if (line_size == 0)
+        {
+            if (state.has_entry())
+            {
+                auto error = state.finish_entry();
+                if (error != NULL)
+                {
+                    return make_rewrite_database_error(error, state.entry_line);
+                }
+            }
+        }
+        else if (line_size == 2 && source.data[i] == '=' && source.data[i+1] == '>')
+        {
+            if (state.is_in_replacement)
+            {
+                return make_rewrite_database_error("Unexpected `=>`", line);
+            }
+            state.is_in_replacement = true;
+        }
+        else if (source.data[i] != '#')
+        {
+            if (!state.has_entry())
+            {
+                state.entry_line = line;
+            }
+            auto side = state.is_in_replacement ? &state.replacement : &state.pattern;
+            for (u64 k = i; k < i + line_size; k++)
+            {
+                side->push(source.data[k]);
+            }
+            side->push('\n');
+        }
+
+        i = line_end + 1;
+    }
+
+    // the last entry doesn't need an empty line after it
+    if (state.has_entry())
+    {
+        auto error = state.finish_entry();
+        if (error != NULL)
+        {
+            return make_rewrite_database_error(error, state.entry_line);
+        }
+    }
+
+    RewriteDatabaseLoadingResult result;
+    result.success = true;
+    result.database = state.database;
+    return result;
+}
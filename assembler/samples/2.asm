@@ -11,7 +11,4 @@ push loop
 jmp
 end_loop:
 pop
-
-halt:
-push halt
-jmp
+halt
@@ -9,10 +9,7 @@ call
 push add_10
 call
 
-# halt
-halt:
-push halt
-jmp
+halt
 
 ## functions
 
@@ -0,0 +1,20 @@
+## a delay clobbers the flags, so the jump can't use the ones of the cmp before it
+## outputs 0 whether or not the program is optimized
+
+push 1
+push 2
+cmp
+delay 100
+push target
+jl
+
+push 0
+push 0
+out
+halt
+
+target:
+push 0
+push 1
+out
+halt
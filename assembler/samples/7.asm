@@ -0,0 +1,18 @@
+## a computed jump only has an offset in its page, so it can't be outside the first page
+## without -Os, which outlines the nops into the first page, it doesn't assemble:
+## "A computed jump has to be in the first page, but the one on line 18 isn't"
+
+push start
+jmp
+
+target:
+halt
+
+start:
+push target
+store
+.rept 300
+nop
+.endr
+load
+jmp
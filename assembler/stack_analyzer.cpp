@@ -0,0 +1,347 @@
+// Depths of the evaluation stack and the general stack, which alu.vhd never checks for overflow or underflow.
+// Every function is analyzed relative to its entry, where both depths are 0 with the return address right below.
+// Depths are propagated through the blocks of the function: `call` pushes a return address on the general stack
+// and adds whatever the callee needs on top of the depths at the call site, `ret` pops it again.
+//
+// Every block has to be reached with the same depths on every path, otherwise a loop could grow a stack
+// without bound, and every `ret` of a function has to leave the same depths behind. The program starts with
+// both stacks empty and can't go below that; a function may use values below its entry (its arguments) as long
+// as every caller has them. Recursion can't be bounded and is an error as well. A `ret` that doesn't find the
+// return address on top jumps to a stored address instead, which the analysis can't follow.
+
+const u64 HARDWARE_STACK_DEPTH = 256;
+
+struct StackFunctionSummary
+{
+    String name;
+    u64 entry; // block
+    bool is_analyzed;
+    bool is_in_progress;
+    bool returns;
+    s64 evaluation_effect; // depth change from the call to the return, not counting the pushed target
+    s64 evaluation_min; // below 0 if the function takes arguments
+    s64 evaluation_max;
+    s64 general_min; // below 0 if the function touches its own return address
+    s64 general_max; // including the return addresses of the calls it makes
+};
+
+struct StackAnalysis
+{
+    Ast ast;
+    ControlFlowGraph graph;
+    Functions functions;
+    StackFunctionSummary* summaries; // the last one is the program itself, starting at block 0
+    Strings errors;
+    Strings warnings; // places the analysis can't see past, the stacks keep their full size then
+
+    u64 get_function_count()
+    {
+        return functions.size + 1;
+    }
+
+    String make_message(const char* message, u64 line, String function)
+    {
+        auto result = String::allocate();
+        result.push(message);
+        result.push(" on line ");
+        result.push(line);
+        result.push(" (in ");
+        result.push(function);
+        result.push(")");
+        return result;
+    }
+
+    StackFunctionSummary analyze_function(u64 function)
+    {
+        auto summary = &summaries[function];
+        if (summary->is_analyzed || summary->is_in_progress)
+        {
+            return *summary;
+        }
+        summary->is_in_progress = true;
+        auto is_program = function == functions.size;
+        bool has_return = false;
+
+        auto evaluation_depths = (s64*)malloc((graph.block_count + 1) * sizeof(s64));
+        auto general_depths = (s64*)malloc((graph.block_count + 1) * sizeof(s64));
+        auto is_reached = (bool*)calloc(graph.block_count + 1, sizeof(bool));
+        auto is_reported = (bool*)calloc(graph.block_count + 1, sizeof(bool));
+        auto worklist = (u64*)malloc((graph.block_count + 1) * sizeof(u64));
+        u64 worklist_size = 0;
+        if (summary->entry != NO_BLOCK)
+        {
+            evaluation_depths[summary->entry] = 0;
+            general_depths[summary->entry] = 0;
+            is_reached[summary->entry] = true;
+            worklist[worklist_size++] = summary->entry;
+        }
+
+        while (worklist_size != 0)
+        {
+            auto b = worklist[--worklist_size];
+            auto block = graph.blocks[b];
+            auto evaluation = evaluation_depths[b];
+            auto general = general_depths[b];
+            bool falls_through = true;
+
+            for (auto i = block.begin; i < block.end; i++)
+            {
+                auto node = ast.data[i];
+                u64 pops;
+                u64 pushes;
+                node.get_stack_effect(&pops, &pushes);
+                if (evaluation + (s64)node.get_transient_evaluation_depth() > summary->evaluation_max)
+                {
+                    summary->evaluation_max = evaluation + (s64)node.get_transient_evaluation_depth();
+                }
+                evaluation -= (s64)pops;
+                if (is_program && evaluation < 0)
+                {
+                    errors.push(make_message("Evaluation stack underflow", node.line, summary->name));
+                    evaluation = 0;
+                }
+                if (evaluation < summary->evaluation_min)
+                {
+                    summary->evaluation_min = evaluation;
+                }
+                evaluation += (s64)pushes;
+
+                if (node.type == AstNodeTypeStore)
+                {
+                    general++;
+                }
+                else if (node.type == AstNodeTypeLoad)
+                {
+                    general--;
+                }
+                else if (node.type == AstNodeTypeCall)
+                {
+                    auto callee_index = i != 0 && ast.data[i-1].is_push_label() ? functions.find(ast.data[i-1].label) : functions.size;
+                    if (callee_index == functions.size)
+                    {
+                        warnings.push(make_message("Can't follow a computed call", node.line, summary->name));
+                        falls_through = false;
+                        break;
+                    }
+                    auto callee = analyze_function(callee_index);
+                    if (callee.is_in_progress)
+                    {
+                        errors.push(make_message("Recursive call of a function", node.line, summary->name));
+                        falls_through = false;
+                        break;
+                    }
+                    if (is_program && (evaluation + callee.evaluation_min < 0 || general + (s64)node.get_return_address_size() + callee.general_min < 0))
+                    {
+                        errors.push(make_message("Called function takes more values than there are on the stack", node.line, summary->name));
+                    }
+                    if (evaluation + callee.evaluation_min < summary->evaluation_min)
+                    {
+                        summary->evaluation_min = evaluation + callee.evaluation_min;
+                    }
+                    if (evaluation + callee.evaluation_max > summary->evaluation_max)
+                    {
+                        summary->evaluation_max = evaluation + callee.evaluation_max;
+                    }
+                    if (general + (s64)node.get_return_address_size() + callee.general_min < summary->general_min)
+                    {
+                        summary->general_min = general + (s64)node.get_return_address_size() + callee.general_min;
+                    }
+                    if (general + (s64)node.get_return_address_size() + callee.general_max > summary->general_max)
+                    {
+                        summary->general_max = general + (s64)node.get_return_address_size() + callee.general_max;
+                    }
+                    if (!callee.returns)
+                    {
+                        falls_through = false;
+                        break;
+                    }
+                    evaluation += callee.evaluation_effect;
+                }
+                else if (node.type == AstNodeTypeRet && (is_program || general != 0))
+                {
+                    // jumps to an address that was stored, not back to the caller
+                    general -= (s64)node.get_return_address_size();
+                    if (general >= 0)
+                    {
+                        warnings.push(make_message("Can't follow a `ret` to a stored address", node.line, summary->name));
+                    }
+                }
+                else if (node.type == AstNodeTypeRet)
+                {
+                    if (has_return && evaluation != summary->evaluation_effect)
+                    {
+                        errors.push(make_message("Returns with a different evaluation stack depth than before", node.line, summary->name));
+                    }
+                    has_return = true;
+                    summary->evaluation_effect = evaluation;
+                }
+
+                if (is_program && general < 0)
+                {
+                    errors.push(make_message("General stack underflow", node.line, summary->name));
+                    general = 0;
+                }
+                if (general < summary->general_min)
+                {
+                    summary->general_min = general;
+                }
+                if (evaluation > summary->evaluation_max)
+                {
+                    summary->evaluation_max = evaluation;
+                }
+                if (general > summary->general_max)
+                {
+                    summary->general_max = general;
+                }
+            }
+
+            auto last = ast.data[block.get_last_node()];
+            if (block.has_unknown_successor && last.type != AstNodeTypeRet && falls_through)
+            {
+                warnings.push(make_message("Can't follow a computed jump", last.line, summary->name));
+            }
+            for (u64 k = 0; k < block.successor_count && falls_through; k++)
+            {
+                auto successor = block.successors[k];
+                if (!is_reached[successor])
+                {
+                    is_reached[successor] = true;
+                    evaluation_depths[successor] = evaluation;
+                    general_depths[successor] = general;
+                    worklist[worklist_size++] = successor;
+                }
+                else if ((evaluation_depths[successor] != evaluation || general_depths[successor] != general)
+                    && !is_reported[successor])
+                {
+                    is_reported[successor] = true;
+                    auto line = ast.data[graph.blocks[successor].begin].line;
+                    errors.push(make_message("Stack depths differ between paths that meet", line, summary->name));
+                }
+            }
+        }
+
+        free(evaluation_depths);
+        free(general_depths);
+        free(is_reached);
+        free(is_reported);
+        free(worklist);
+
+        summary->returns = has_return || summary->entry == NO_BLOCK;
+        summary->is_in_progress = false;
+        summary->is_analyzed = true;
+        return *summary;
+    }
+
+    StackFunctionSummary get_program_summary()
+    {
+        return summaries[functions.size];
+    }
+
+    // what the stacks in the hardware have to hold, all of it if the analysis can't tell
+    u64 get_required_evaluation_stack_depth()
+    {
+        return warnings.size != 0 ? HARDWARE_STACK_DEPTH : (u64)get_program_summary().evaluation_max;
+    }
+
+    u64 get_required_general_stack_depth()
+    {
+        return warnings.size != 0 ? HARDWARE_STACK_DEPTH : (u64)get_program_summary().general_max;
+    }
+
+    void print_report(FILE* file)
+    {
+        fprintf(file, "Functions (deepest point above the entry, evaluation/general stack):\n");
+        for (u64 f = 0; f < get_function_count(); f++)
+        {
+            auto summary = summaries[f];
+            if (!summary.is_analyzed)
+            {
+                continue;
+            }
+            fprintf(
+                file,
+                "    %.*s: %lld/%lld",
+                (int)summary.name.size,
+                summary.name.data,
+                (long long)summary.evaluation_max,
+                (long long)summary.general_max
+            );
+            if (summary.evaluation_min < 0)
+            {
+                fprintf(file, ", takes %lld argument(s)", (long long)-summary.evaluation_min);
+            }
+            if (summary.returns && f != functions.size)
+            {
+                fprintf(file, ", returns with %+lld", (long long)summary.evaluation_effect);
+            }
+            fprintf(file, "\n");
+        }
+        fprintf(
+            file,
+            "Program: evaluation stack %llu, general stack %llu\n",
+            (unsigned long long)get_required_evaluation_stack_depth(),
+            (unsigned long long)get_required_general_stack_depth()
+        );
+        for (u64 i = 0; i < warnings.size; i++)
+        {
+            fprintf(file, "Warning: %.*s\n", (int)warnings.data[i].size, warnings.data[i].data);
+        }
+        for (u64 i = 0; i < errors.size; i++)
+        {
+            fprintf(file, "Error: %.*s\n", (int)errors.data[i].size, errors.data[i].data);
+        }
+    }
+};
+
+StackAnalysis analyze_stacks(Ast ast)
+{
+    StackAnalysis result;
+    result.ast = ast;
+    result.graph = build_control_flow_graph(ast);
+    result.functions = find_functions(ast);
+    result.errors = Strings::allocate();
+    result.warnings = Strings::allocate();
+
+    result.summaries = (StackFunctionSummary*)malloc(result.get_function_count() * sizeof(StackFunctionSummary));
+    for (u64 f = 0; f < result.get_function_count(); f++)
+    {
+        auto summary = &result.summaries[f];
+        summary->is_analyzed = false;
+        summary->is_in_progress = false;
+        summary->returns = false;
+        summary->evaluation_effect = 0;
+        summary->evaluation_min = 0;
+        summary->evaluation_max = 0;
+        summary->general_min = 0;
+        summary->general_max = 0;
+        if (f == result.functions.size)
+        {
+            summary->name = String::allocate();
+            summary->name.push("(program)");
+            summary->entry = result.graph.block_count != 0 ? 0 : NO_BLOCK;
+        }
+        else
+        {
+            summary->name = result.functions.data[f].name;
+            summary->entry = result.graph.get_block_of(result.functions.data[f].begin);
+        }
+    }
+
+    // the program first, so that every function reached from it is analyzed the way it's called
+    result.analyze_function(result.functions.size);
+    for (u64 f = 0; f < result.functions.size; f++)
+    {
+        result.analyze_function(f);
+    }
+
+    auto program = result.get_program_summary();
+    if ((u64)program.evaluation_max > HARDWARE_STACK_DEPTH || (u64)program.general_max > HARDWARE_STACK_DEPTH)
+    {
+        auto error = String::allocate();
+        error.push("The program needs more than the ");
+        error.push(HARDWARE_STACK_DEPTH);
+        error.push(" entries the stacks have");
+        result.errors.push(error);
+    }
+    return result;
+}
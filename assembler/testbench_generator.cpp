@@ -0,0 +1,82 @@
+// A GHDL testbench for `--testbench`: it runs the program from program.vhd until it executes `halt`, then prints
+// how many cycles that took and what is left on both stacks, and ends the simulation. A program that doesn't
+// halt within max_cycles fails it. max_cycles defaults to the worst case from the timing analysis, so a program
+// that gets slower than its bound fails as well.
+
+// 1 ms at 100 MHz, as long as test.sh simulates
+const u64 DEFAULT_TESTBENCH_CYCLES = 100000;
+
+void print_testbench(FILE* file, u64 worst_case_cycles)
+{
+    auto max_cycles = worst_case_cycles != UNBOUNDED_CYCLES ? worst_case_cycles : DEFAULT_TESTBENCH_CYCLES;
+    fprintf(
+        file,
+        "library IEEE;\n"
+        "use IEEE.std_logic_1164.all;\n"
+        "use IEEE.numeric_std.all;\n"
+        "use std.textio.all;\n"
+        "\n"
+        "-- written by the assembler with `--testbench`, runs the program in program.vhd until it executes `halt`\n"
+        "entity halt_test is\n"
+        "    generic (max_cycles : natural := %llu);\n"
+        "end halt_test;\n"
+        "\n"
+        "architecture halt_test_architecture of halt_test is\n"
+        "    signal clock : STD_ULOGIC := '0';\n"
+        "begin\n"
+        "    cpu_instance : entity work.cpu\n"
+        "        port map (clock => clock);\n"
+        "\n"
+        "    clock <= not clock after 5 ns;\n"
+        "\n"
+        "    monitor : process\n"
+        "        alias is_halted is << signal .halt_test.cpu_instance.alu_instance.is_halted : STD_ULOGIC >>;\n"
+        "        -- the top two values of the evaluation stack are in registers, the rest in a RAM\n"
+        "        alias evaluation_stack is << signal .halt_test.cpu_instance.alu_instance.evaluation_stack_ram.memory\n"
+        "            : work.types.T_MEMORY(work.program.evaluation_stack_depth - 1 downto 0) >>;\n"
+        "        alias evaluation_top is << signal .halt_test.cpu_instance.alu_instance.evaluation_top : STD_ULOGIC_VECTOR(7 downto 0) >>;\n"
+        "        alias evaluation_second is << signal .halt_test.cpu_instance.alu_instance.evaluation_second : STD_ULOGIC_VECTOR(7 downto 0) >>;\n"
+        "        alias evaluation_stack_size is << signal .halt_test.cpu_instance.alu_instance.evaluation_stack_size : integer >>;\n"
+        "        alias general_stack is << signal .halt_test.cpu_instance.alu_instance.general_stack_ram.memory\n"
+        "            : work.types.T_MEMORY(work.program.general_stack_depth - 1 downto 0) >>;\n"
+        "        alias general_stack_size is << signal .halt_test.cpu_instance.alu_instance.general_stack_size : integer >>;\n"
+        "        variable cycles : natural := 0;\n"
+        "        variable result_line : line;\n"
+        "    begin\n"
+        "        -- every rising edge is a cycle, and its results are there by the falling edge after it\n"
+        "        while is_halted = '0' loop\n"
+        "            assert cycles < max_cycles\n"
+        "                report \"The program didn't halt within \" & integer'image(max_cycles) & \" cycles\"\n"
+        "                severity failure;\n"
+        "            wait until falling_edge(clock);\n"
+        "            cycles := cycles + 1;\n"
+        "        end loop;\n"
+        "\n"
+        "        write(result_line, string'(\"Halted after \"));\n"
+        "        write(result_line, cycles);\n"
+        "        write(result_line, string'(\" cycles\"));\n"
+        "        writeline(output, result_line);\n"
+        "        write(result_line, string'(\"Evaluation stack:\"));\n"
+        "        for i in 0 to evaluation_stack_size - 1 loop\n"
+        "            write(result_line, string'(\" \"));\n"
+        "            if i = evaluation_stack_size - 1 then\n"
+        "                write(result_line, to_integer(unsigned(evaluation_top)));\n"
+        "            elsif i = evaluation_stack_size - 2 then\n"
+        "                write(result_line, to_integer(unsigned(evaluation_second)));\n"
+        "            else\n"
+        "                write(result_line, to_integer(unsigned(evaluation_stack(i))));\n"
+        "            end if;\n"
+        "        end loop;\n"
+        "        writeline(output, result_line);\n"
+        "        write(result_line, string'(\"General stack:\"));\n"
+        "        for i in 0 to general_stack_size - 1 loop\n"
+        "            write(result_line, string'(\" \"));\n"
+        "            write(result_line, to_integer(unsigned(general_stack(i))));\n"
+        "        end loop;\n"
+        "        writeline(output, result_line);\n"
+        "        std.env.finish;\n"
+        "    end process;\n"
+        "end halt_test_architecture;\n",
+        (unsigned long long)max_cycles
+    );
+}
@@ -0,0 +1,938 @@
+// Static best- and worst-case cycle counts of every basic block, loop and function, from AstNode::get_cycles.
+// A block takes the cycles of its nodes plus whatever the function it calls takes; a call of a delay routine
+// with a constant count takes exactly as long as the delay it implements.
+//
+// Loops are collapsed innermost first: a loop that runs its body at most N times takes N of its longest
+// iterations plus its longest way out, and then counts as a single node of the loop or function around it.
+// The number of iterations comes from a `.bound [MIN,] MAX` annotation on the header or from a countdown
+//
+//     push c
+//     loop: dup, push 0, cmp, push end, jeq
+//           <body that never touches the counter>
+//           push -d, add, push loop, jmp
+//
+// which runs its body exactly c/d times, also after block layout has rotated it into
+//
+//     push c, push loop, jmp
+//     body: <body>
+//           push -d, add
+//     loop: dup, push 0, cmp, push body, jne
+//
+// A conditional jump costs TAKEN_JUMP_PENALTY more on the edge to its target than on the one it falls through.
+// The edges out of a loop are part of the loop's way out.
+//
+// A loop without a bound, recursion or a computed jump makes the
+// worst case unbounded. `.deadline CYCLES` on a function, or on a loop header for a single iteration,
+// fails the build if the worst case can exceed it.
+
+const u64 UNBOUNDED_CYCLES = (u64)-1;
+
+u64 add_cycles(u64 left, u64 right)
+{
+    if (left == UNBOUNDED_CYCLES || right == UNBOUNDED_CYCLES || left > UNBOUNDED_CYCLES - 1 - right)
+    {
+        return UNBOUNDED_CYCLES;
+    }
+    return left + right;
+}
+
+u64 multiply_cycles(u64 cycles, u64 count)
+{
+    if (count == 0)
+    {
+        return 0;
+    }
+    if (cycles == UNBOUNDED_CYCLES || cycles > (UNBOUNDED_CYCLES - 1) / count)
+    {
+        return UNBOUNDED_CYCLES;
+    }
+    return cycles * count;
+}
+
+struct CycleRange
+{
+    u64 best;
+    u64 worst;
+
+    static CycleRange make(u64 best, u64 worst)
+    {
+        CycleRange result;
+        result.best = best;
+        result.worst = worst;
+        return result;
+    }
+
+    CycleRange add(CycleRange other)
+    {
+        return make(add_cycles(best, other.best), add_cycles(worst, other.worst));
+    }
+
+    // either this or other happens
+    void merge(CycleRange other)
+    {
+        best = other.best < best ? other.best : best;
+        worst = other.worst > worst ? other.worst : worst;
+    }
+
+    String to_string()
+    {
+        auto result = String::allocate();
+        if (best == UNBOUNDED_CYCLES)
+        {
+            result.push("unbounded");
+            return result;
+        }
+        result.push(best);
+        if (worst != best)
+        {
+            result.push("..");
+            if (worst == UNBOUNDED_CYCLES)
+            {
+                result.push("unbounded");
+            }
+            else
+            {
+                result.push(worst);
+            }
+        }
+        return result;
+    }
+};
+
+enum LoopBoundSource
+{
+    LoopBoundSourceNone,
+    LoopBoundSourceAnnotation,
+    LoopBoundSourceInferred,
+};
+
+struct LoopTiming
+{
+    u64 header; // block
+    LoopBoundSource bound_source;
+    u64 min_iterations;
+    u64 max_iterations;
+    bool exits;
+    CycleRange iteration; // from the header back to it
+    CycleRange total; // from entering the header until leaving the loop
+};
+
+struct FunctionTiming
+{
+    String name;
+    u64 entry; // block
+    bool is_analyzed;
+    bool is_in_progress;
+    bool returns; // some path gets to a `ret`, a `halt` or the end of the program
+    CycleRange cycles;
+};
+
+enum PathEnd
+{
+    PathEndLatch, // jumps back to the header of the loop
+    PathEndExit, // leaves the loop
+    PathEndReturn,
+};
+
+// one function with its loops collapsed so far, every block stands for the node its representative is
+struct TimingRegion
+{
+    ControlFlowGraph graph;
+    bool* is_in_region;
+    u64* representatives;
+    CycleRange* cycles; // by representative
+    bool* is_collapsed; // by representative, a loop whose cycles include those of the edges out of it
+
+    // longest and shortest paths, reset for every query
+    u8* path_states; // 0 not visited, 1 in progress, 2 done
+    bool* has_path;
+    CycleRange* paths;
+
+    // the blocks a path is restricted to, and the header of the loop (NO_BLOCK for a function) that paths
+    // never go back to
+    bool* within;
+    u64 header;
+    PathEnd end;
+
+    static TimingRegion allocate(ControlFlowGraph graph)
+    {
+        TimingRegion result;
+        result.graph = graph;
+        auto count = graph.block_count + 1;
+        result.is_in_region = (bool*)calloc(count, sizeof(bool));
+        result.representatives = (u64*)malloc(count * sizeof(u64));
+        result.cycles = (CycleRange*)malloc(count * sizeof(CycleRange));
+        result.is_collapsed = (bool*)calloc(count, sizeof(bool));
+        result.path_states = (u8*)malloc(count * sizeof(u8));
+        result.has_path = (bool*)malloc(count * sizeof(bool));
+        result.paths = (CycleRange*)malloc(count * sizeof(CycleRange));
+        for (u64 i = 0; i < graph.block_count; i++)
+        {
+            result.representatives[i] = i;
+        }
+        return result;
+    }
+
+    void deallocate()
+    {
+        free(is_in_region);
+        free(representatives);
+        free(cycles);
+        free(is_collapsed);
+        free(path_states);
+        free(has_path);
+        free(paths);
+    }
+
+    bool is_return_block(u64 block)
+    {
+        auto last = graph.ast.data[graph.blocks[block].get_last_node()];
+        return last.type == AstNodeTypeRet || graph.blocks[block].successor_count == 0;
+    }
+
+    bool is_followed(u64 from, u64 to)
+    {
+        return within[to] && representatives[to] != representatives[from] && representatives[to] != header;
+    }
+
+    // the penalty of a conditional jump at the end of from if it goes to to
+    CycleRange get_edge_cycles(u64 from, u64 to)
+    {
+        auto last = graph.blocks[from].get_last_node();
+        auto node = graph.ast.data[last];
+        if (is_collapsed[representatives[from]] || !node.is_jump() || node.type == AstNodeTypeJmp)
+        {
+            return CycleRange::make(0, 0);
+        }
+        auto target = graph.ast.get_jump_target(last);
+        if (target == graph.ast.size || graph.get_block_of(target) != to)
+        {
+            return CycleRange::make(0, 0);
+        }
+        // a jump to the block right after it gets there either way
+        if (graph.blocks[from].end < graph.ast.size && graph.get_block_of(graph.blocks[from].end) == to)
+        {
+            return CycleRange::make(0, TAKEN_JUMP_PENALTY);
+        }
+        return CycleRange::make(TAKEN_JUMP_PENALTY, TAKEN_JUMP_PENALTY);
+    }
+
+    // false if no path ends at node, otherwise the cycles of the edges it ends with
+    bool find_path_end(u64 node, CycleRange* result)
+    {
+        bool has_end = false;
+        for (u64 b = 0; b < graph.block_count; b++)
+        {
+            if (representatives[b] != node || !is_in_region[b])
+            {
+                continue;
+            }
+            if (end != PathEndLatch && is_return_block(b))
+            {
+                add_path(result, &has_end, CycleRange::make(0, 0));
+            }
+            for (u64 k = 0; k < graph.blocks[b].successor_count; k++)
+            {
+                auto successor = graph.blocks[b].successors[k];
+                if (end == PathEndLatch && within[successor] && representatives[successor] == header
+                    || end == PathEndExit && !within[successor])
+                {
+                    add_path(result, &has_end, get_edge_cycles(b, successor));
+                }
+            }
+        }
+        return has_end;
+    }
+
+    // either one of the paths so far or path happens
+    void add_path(CycleRange* paths_so_far, bool* has_any, CycleRange path)
+    {
+        if (*has_any)
+        {
+            paths_so_far->merge(path);
+        }
+        else
+        {
+            *paths_so_far = path;
+            *has_any = true;
+        }
+    }
+
+    // every path from node to an end, including both
+    void find_paths_from(u64 node)
+    {
+        if (path_states[node] == 2)
+        {
+            return;
+        }
+        if (path_states[node] == 1)
+        {
+            // a cycle that isn't a natural loop
+            has_path[node] = true;
+            paths[node] = CycleRange::make(0, UNBOUNDED_CYCLES);
+            return;
+        }
+        path_states[node] = 1;
+
+        auto rest = CycleRange::make(0, 0);
+        bool has_any = find_path_end(node, &rest);
+        for (u64 b = 0; b < graph.block_count; b++)
+        {
+            if (representatives[b] != node || !is_in_region[b])
+            {
+                continue;
+            }
+            for (u64 k = 0; k < graph.blocks[b].successor_count; k++)
+            {
+                auto successor = graph.blocks[b].successors[k];
+                if (!is_followed(b, successor))
+                {
+                    continue;
+                }
+                auto next = representatives[successor];
+                find_paths_from(next);
+                if (!has_path[next])
+                {
+                    continue;
+                }
+                add_path(&rest, &has_any, get_edge_cycles(b, successor).add(paths[next]));
+            }
+        }
+
+        path_states[node] = 2;
+        has_path[node] = has_any;
+        paths[node] = cycles[node].add(rest);
+    }
+
+    // false if there is no such path
+    bool find_paths(u64 from, bool* within_blocks, u64 loop_header, PathEnd path_end, CycleRange* result)
+    {
+        within = within_blocks;
+        header = loop_header;
+        end = path_end;
+        memset(path_states, 0, (graph.block_count + 1) * sizeof(u8));
+        find_paths_from(from);
+        *result = paths[from];
+        return has_path[from];
+    }
+};
+
+struct DeadlineCheckResult
+{
+    bool success;
+    String error;
+};
+
+struct TimingAnalysis
+{
+    Ast ast;
+    TimingAnnotations annotations;
+    ControlFlowGraph graph;
+    Functions functions;
+    Loops loops;
+    CycleRange* block_cycles;
+    bool* has_block_cycles;
+    FunctionTiming* function_timings; // the last one is the program itself, starting at block 0
+    LoopTiming* loop_timings; // by header block
+    bool* has_loop_timing;
+
+    u64 get_function_count()
+    {
+        return functions.size + 1;
+    }
+
+    // the annotation on any of the labels the block starts with, annotations.size if there is none
+    u64 find_annotation(u64 block)
+    {
+        for (auto i = graph.blocks[block].begin; i < graph.blocks[block].end && ast.data[i].type == AstNodeTypeLabel; i++)
+        {
+            auto annotation = annotations.find(ast.data[i].label);
+            if (annotation != annotations.size)
+            {
+                return annotation;
+            }
+        }
+        return annotations.size;
+    }
+
+    CycleRange get_block_cycles(u64 block)
+    {
+        if (has_block_cycles[block])
+        {
+            return block_cycles[block];
+        }
+        auto begin = graph.blocks[block].begin;
+        auto end = graph.blocks[block].end;
+        auto own = ast.get_cycles_between(begin, end);
+        auto result = CycleRange::make(own, own);
+
+        auto last = end - 1;
+        u64 delay_cycles;
+        if (ast.data[last].type == AstNodeTypeCall && get_delay_routine_cycles(ast, last, &delay_cycles))
+        {
+            result = result.add(CycleRange::make(delay_cycles, delay_cycles));
+        }
+        else if (ast.data[last].type == AstNodeTypeCall)
+        {
+            auto function = last != 0 && ast.data[last-1].is_push_label() ? functions.find(ast.data[last-1].label) : functions.size;
+            if (function == functions.size)
+            {
+                result.worst = UNBOUNDED_CYCLES;
+            }
+            else
+            {
+                auto callee = analyze_function(function);
+                result = result.add(callee.cycles);
+            }
+        }
+        else if (graph.blocks[block].has_unknown_successor && ast.data[last].type != AstNodeTypeRet)
+        {
+            result.worst = UNBOUNDED_CYCLES;
+        }
+
+        block_cycles[block] = result;
+        has_block_cycles[block] = true;
+        return result;
+    }
+
+    // a countdown like the one described at the top, returns false if the loop doesn't look like one
+    bool infer_loop_bound(Loop loop, u64* min_iterations, u64* max_iterations)
+    {
+        auto header = graph.blocks[loop.header];
+        auto test = ast.skip_labels(header.begin);
+        if (test + 5 != header.end || graph.is_entry_block[loop.header] || loop.header == 0
+            || ast.data[test].type != AstNodeTypeDup
+            || !ast.data[test+1].is_push_integer() || ast.data[test+1].integer != 0
+            || ast.data[test+2].type != AstNodeTypeCmp
+            || !ast.data[test+3].is_push_label()
+            || ast.data[test+4].type != AstNodeTypeJeq && ast.data[test+4].type != AstNodeTypeJne
+            || header.predecessor_count != 2)
+        {
+            return false;
+        }
+
+        // entered from a block that ends with `push c` and falls through or jumps to the header,
+        // and jumped or fallen back to from a single latch
+        u64 preheader = NO_BLOCK;
+        u64 latch = NO_BLOCK;
+        for (u64 k = 0; k < header.predecessor_count; k++)
+        {
+            auto predecessor = graph.get_predecessor(loop.header, k);
+            if (loop.contains[predecessor])
+            {
+                latch = predecessor;
+            }
+            else
+            {
+                preheader = predecessor;
+            }
+        }
+        if (latch == NO_BLOCK || preheader == NO_BLOCK)
+        {
+            return false;
+        }
+        auto counter_index = graph.blocks[preheader].get_last_node();
+        if (ast.data[counter_index].type == AstNodeTypeJmp)
+        {
+            counter_index = counter_index >= 2 ? counter_index - 2 : counter_index;
+        }
+        if (!ast.data[counter_index].is_push_integer() || graph.get_block_of(counter_index) != preheader)
+        {
+            return false;
+        }
+        auto latch_block = graph.blocks[latch];
+        auto latch_last = ast.data[latch_block.get_last_node()];
+        u64 step_size = latch_last.type == AstNodeTypeJmp ? 4 : 2;
+        if (latch_block.end < latch_block.begin + step_size)
+        {
+            return false;
+        }
+        auto step = latch_block.end - step_size;
+        if (!ast.data[step].is_push_integer() || ast.data[step].integer < 129
+            || ast.data[step+1].type != AstNodeTypeAdd
+            || latch_last.type == AstNodeTypeJmp && !ast.data[step+2].is_push_label())
+        {
+            return false;
+        }
+
+        // the body has to leave the counter alone on every path, calls of delay routines are the only calls
+        // whose stack effect is known
+        auto depths = (s64*)malloc((graph.block_count + 1) * sizeof(s64));
+        auto worklist = (u64*)malloc((graph.block_count + 1) * sizeof(u64));
+        for (u64 b = 0; b < graph.block_count; b++)
+        {
+            depths[b] = -1;
+        }
+        u64 worklist_size = 0;
+        auto body = ast.data[test+4].type == AstNodeTypeJeq
+            ? graph.get_block_of(header.end)
+            : graph.get_block_of(ast.get_jump_target(test + 4));
+        bool is_countdown = body != NO_BLOCK && loop.contains[body] && body != loop.header;
+        bool may_exit_early = false;
+        if (is_countdown)
+        {
+            depths[body] = 0;
+            worklist[worklist_size++] = body;
+        }
+        while (worklist_size != 0 && is_countdown)
+        {
+            auto b = worklist[--worklist_size];
+            auto block = graph.blocks[b];
+            auto depth = (u64)depths[b];
+            auto end = b == latch ? step : block.end;
+            if (block.has_unknown_successor)
+            {
+                is_countdown = false;
+                break;
+            }
+            for (auto i = block.begin; i < end && is_countdown; i++)
+            {
+                u64 pops;
+                u64 pushes;
+                ast.data[i].get_stack_effect(&pops, &pushes);
+                u64 delay_cycles;
+                if (ast.data[i].type == AstNodeTypeCall)
+                {
+                    is_countdown = get_delay_routine_cycles(ast, i, &delay_cycles);
+                    pops = 2; // the count is popped by the routine
+                }
+                if (pops > depth)
+                {
+                    is_countdown = false;
+                }
+                depth = depth - pops + pushes;
+            }
+            if (b == latch && depth != 0)
+            {
+                is_countdown = false;
+            }
+            for (u64 k = 0; k < block.successor_count && is_countdown; k++)
+            {
+                auto successor = block.successors[k];
+                if (!loop.contains[successor])
+                {
+                    may_exit_early = true;
+                }
+                else if (successor == loop.header)
+                {
+                    is_countdown = b == latch;
+                }
+                else if (depths[successor] == -1)
+                {
+                    depths[successor] = (s64)depth;
+                    worklist[worklist_size++] = successor;
+                }
+                else if ((u64)depths[successor] != depth)
+                {
+                    is_countdown = false;
+                }
+            }
+        }
+        free(depths);
+        free(worklist);
+
+        auto counter = ast.data[counter_index].integer;
+        auto decrement = 256 - (u64)ast.data[step].integer;
+        if (!is_countdown || counter % decrement != 0)
+        {
+            return false;
+        }
+        *max_iterations = counter / decrement;
+        *min_iterations = may_exit_early ? 0 : *max_iterations;
+        return true;
+    }
+
+    void collapse_loop(TimingRegion* region, Loop loop)
+    {
+        auto header = loop.header;
+        LoopTiming timing;
+        timing.header = header;
+        timing.bound_source = LoopBoundSourceNone;
+        timing.min_iterations = 0;
+        timing.max_iterations = 0;
+
+        auto annotation = find_annotation(header);
+        if (annotation != annotations.size && annotations.data[annotation].has_bound)
+        {
+            timing.bound_source = LoopBoundSourceAnnotation;
+            timing.min_iterations = annotations.data[annotation].min_iterations;
+            timing.max_iterations = annotations.data[annotation].max_iterations;
+        }
+        else if (infer_loop_bound(loop, &timing.min_iterations, &timing.max_iterations))
+        {
+            timing.bound_source = LoopBoundSourceInferred;
+        }
+
+        CycleRange exit;
+        if (!region->find_paths(header, loop.contains, header, PathEndLatch, &timing.iteration))
+        {
+            timing.iteration = CycleRange::make(0, 0);
+        }
+        timing.exits = region->find_paths(header, loop.contains, header, PathEndExit, &exit);
+        if (!timing.exits)
+        {
+            timing.total = CycleRange::make(UNBOUNDED_CYCLES, UNBOUNDED_CYCLES);
+        }
+        else if (timing.bound_source == LoopBoundSourceNone)
+        {
+            timing.total = CycleRange::make(exit.best, UNBOUNDED_CYCLES);
+        }
+        else
+        {
+            timing.total = CycleRange::make(
+                add_cycles(multiply_cycles(timing.iteration.best, timing.min_iterations), exit.best),
+                add_cycles(multiply_cycles(timing.iteration.worst, timing.max_iterations), exit.worst)
+            );
+        }
+
+        region->cycles[header] = timing.total;
+        region->is_collapsed[header] = true;
+        for (u64 b = 0; b < graph.block_count; b++)
+        {
+            if (loop.contains[b])
+            {
+                region->representatives[b] = header;
+            }
+        }
+        if (!has_loop_timing[header])
+        {
+            loop_timings[header] = timing;
+            has_loop_timing[header] = true;
+        }
+    }
+
+    FunctionTiming analyze_function(u64 function)
+    {
+        auto timing = &function_timings[function];
+        if (timing->is_analyzed)
+        {
+            return *timing;
+        }
+        if (timing->is_in_progress)
+        {
+            // recursion
+            FunctionTiming result = *timing;
+            result.returns = true;
+            result.cycles = CycleRange::make(0, UNBOUNDED_CYCLES);
+            return result;
+        }
+        timing->is_in_progress = true;
+        if (timing->entry == NO_BLOCK)
+        {
+            // the label is at the very end, so the call runs off the end of the program
+            timing->returns = true;
+            timing->is_in_progress = false;
+            timing->is_analyzed = true;
+            return *timing;
+        }
+
+        // everything reachable from the entry, without the functions it calls
+        auto region = TimingRegion::allocate(graph);
+        auto worklist = (u64*)malloc((graph.block_count + 1) * sizeof(u64));
+        u64 worklist_size = 0;
+        worklist[worklist_size++] = timing->entry;
+        region.is_in_region[timing->entry] = true;
+        while (worklist_size != 0)
+        {
+            auto block = graph.blocks[worklist[--worklist_size]];
+            for (u64 k = 0; k < block.successor_count; k++)
+            {
+                if (!region.is_in_region[block.successors[k]])
+                {
+                    region.is_in_region[block.successors[k]] = true;
+                    worklist[worklist_size++] = block.successors[k];
+                }
+            }
+        }
+        free(worklist);
+        for (u64 b = 0; b < graph.block_count; b++)
+        {
+            if (region.is_in_region[b])
+            {
+                region.cycles[b] = get_block_cycles(b);
+            }
+        }
+
+        // innermost loops first
+        auto is_collapsed = (bool*)calloc(loops.size + 1, sizeof(bool));
+        while (true)
+        {
+            auto next = loops.size;
+            for (u64 i = 0; i < loops.size; i++)
+            {
+                if (!is_collapsed[i] && region.is_in_region[loops.data[i].header]
+                    && (next == loops.size || loops.data[i].block_count < loops.data[next].block_count))
+                {
+                    next = i;
+                }
+            }
+            if (next == loops.size)
+            {
+                break;
+            }
+            is_collapsed[next] = true;
+            collapse_loop(&region, loops.data[next]);
+        }
+        free(is_collapsed);
+
+        auto entry = region.representatives[timing->entry];
+        timing->returns = region.find_paths(entry, region.is_in_region, NO_BLOCK, PathEndReturn, &timing->cycles);
+        if (!timing->returns)
+        {
+            timing->cycles = CycleRange::make(UNBOUNDED_CYCLES, UNBOUNDED_CYCLES);
+        }
+        region.deallocate();
+
+        timing->is_in_progress = false;
+        timing->is_analyzed = true;
+        return *timing;
+    }
+
+    void run()
+    {
+        for (u64 f = 0; f < get_function_count(); f++)
+        {
+            analyze_function(f);
+        }
+        // blocks that no function reaches, like the targets of computed jumps
+        for (u64 b = 0; b < graph.block_count; b++)
+        {
+            get_block_cycles(b);
+        }
+    }
+
+    String get_block_name(u64 block)
+    {
+        auto result = String::allocate();
+        auto begin = graph.blocks[block].begin;
+        if (ast.data[begin].type == AstNodeTypeLabel)
+        {
+            result.push(ast.data[begin].label);
+        }
+        else
+        {
+            result.push("block ");
+            result.push(block);
+        }
+        result.push(" (line ");
+        result.push(ast.data[begin].line);
+        result.push(")");
+        return result;
+    }
+
+    // one line for the first instruction of every block, for the comments of compile_to_binary
+    Strings make_node_comments()
+    {
+        auto result = Strings::allocate();
+        for (u64 i = 0; i < ast.size; i++)
+        {
+            result.push(String::allocate());
+        }
+        for (u64 b = 0; b < graph.block_count; b++)
+        {
+            auto first = ast.skip_labels(graph.blocks[b].begin);
+            if (first >= graph.blocks[b].end)
+            {
+                continue;
+            }
+            auto comment = &result.data[first];
+            for (u64 f = 0; f < get_function_count(); f++)
+            {
+                if (function_timings[f].entry == b)
+                {
+                    comment->push("function ");
+                    comment->push(function_timings[f].name);
+                    if (function_timings[f].returns)
+                    {
+                        comment->push(": ");
+                        comment->push(function_timings[f].cycles.to_string());
+                        comment->push(" cycles, ");
+                    }
+                    else
+                    {
+                        comment->push(" never returns, ");
+                    }
+                }
+            }
+            if (has_loop_timing[b])
+            {
+                comment->push("loop: ");
+                comment->push(loop_timings[b].iteration.to_string());
+                comment->push(" cycles per iteration, ");
+            }
+            comment->push("block: ");
+            comment->push(block_cycles[b].to_string());
+            comment->push(" cycles");
+        }
+        return result;
+    }
+
+    void print_report(FILE* file)
+    {
+        fprintf(file, "Functions (best..worst cycles, including calls):\n");
+        for (u64 f = 0; f < get_function_count(); f++)
+        {
+            auto timing = function_timings[f];
+            auto cycles = timing.cycles.to_string();
+            fprintf(file, "    %.*s: ", (int)timing.name.size, timing.name.data);
+            if (timing.returns)
+            {
+                fprintf(file, "%.*s\n", (int)cycles.size, cycles.data);
+            }
+            else
+            {
+                fprintf(file, "never returns\n");
+            }
+        }
+
+        fprintf(file, "Loops:\n");
+        for (u64 b = 0; b < graph.block_count; b++)
+        {
+            if (!has_loop_timing[b])
+            {
+                continue;
+            }
+            auto timing = loop_timings[b];
+            auto name = get_block_name(b);
+            auto iteration = timing.iteration.to_string();
+            fprintf(file, "    %.*s: %.*s per iteration, ", (int)name.size, name.data, (int)iteration.size, iteration.data);
+            if (!timing.exits)
+            {
+                fprintf(file, "never exits\n");
+                continue;
+            }
+            if (timing.bound_source == LoopBoundSourceNone)
+            {
+                fprintf(file, "no bound\n");
+                continue;
+            }
+            auto total = timing.total.to_string();
+            auto iterations = CycleRange::make(timing.min_iterations, timing.max_iterations).to_string();
+            fprintf(
+                file,
+                "%.*s iterations (%s), %.*s in total\n",
+                (int)iterations.size,
+                iterations.data,
+                timing.bound_source == LoopBoundSourceInferred ? "inferred" : "annotated",
+                (int)total.size,
+                total.data
+            );
+        }
+
+        fprintf(file, "Blocks:\n");
+        for (u64 b = 0; b < graph.block_count; b++)
+        {
+            auto name = get_block_name(b);
+            auto cycles = block_cycles[b].to_string();
+            fprintf(file, "    %llu %.*s: %.*s\n", (unsigned long long)b, (int)name.size, name.data, (int)cycles.size, cycles.data);
+        }
+    }
+
+    // reports the deadlines that are met on stderr
+    DeadlineCheckResult check_deadlines()
+    {
+        DeadlineCheckResult result;
+        result.success = true;
+        for (u64 i = 0; i < annotations.size; i++)
+        {
+            auto annotation = annotations.data[i];
+            if (!annotation.has_deadline)
+            {
+                continue;
+            }
+            auto label = ast.find_label(annotation.label);
+            if (label == ast.size)
+            {
+                fprintf(
+                    stderr,
+                    "Timing: the deadline on line %llu can't be checked, %.*s was optimized away\n",
+                    (unsigned long long)annotation.line,
+                    (int)annotation.label.size,
+                    annotation.label.data
+                );
+                continue;
+            }
+            auto block = graph.get_block_of(label);
+            auto function = functions.find(annotation.label);
+            if (function == functions.size && block != 0 && !has_loop_timing[block])
+            {
+                result.success = false;
+                result.error = String::allocate();
+                result.error.push("The deadline on line ");
+                result.error.push(annotation.line);
+                result.error.push(" isn't on a function or a loop");
+                return result;
+            }
+            // the program itself counts as a function when the label starts it
+            auto worst = function != functions.size || block == 0
+                ? function_timings[function].cycles.worst
+                : loop_timings[block].iteration.worst;
+
+            if (worst > annotation.deadline)
+            {
+                result.success = false;
+                result.error = String::allocate();
+                result.error.push("The deadline of ");
+                result.error.push(annotation.deadline);
+                result.error.push(" cycles for ");
+                result.error.push(annotation.label);
+                result.error.push(" on line ");
+                result.error.push(annotation.line);
+                result.error.push(" can be exceeded, the worst case is ");
+                result.error.push(CycleRange::make(worst, worst).to_string());
+                result.error.push(" cycles");
+                return result;
+            }
+            fprintf(
+                stderr,
+                "Timing: %.*s meets its deadline of %llu cycles, the worst case is %llu\n",
+                (int)annotation.label.size,
+                annotation.label.data,
+                (unsigned long long)annotation.deadline,
+                (unsigned long long)worst
+            );
+        }
+        return result;
+    }
+};
+
+TimingAnalysis analyze_timing(Ast ast, TimingAnnotations annotations)
+{
+    TimingAnalysis result;
+    result.ast = ast;
+    result.annotations = annotations;
+    result.graph = build_control_flow_graph(ast);
+    result.functions = find_functions(ast);
+    result.loops = result.graph.find_loops();
+    result.block_cycles = (CycleRange*)malloc((result.graph.block_count + 1) * sizeof(CycleRange));
+    result.has_block_cycles = (bool*)calloc(result.graph.block_count + 1, sizeof(bool));
+    result.loop_timings = (LoopTiming*)malloc((result.graph.block_count + 1) * sizeof(LoopTiming));
+    result.has_loop_timing = (bool*)calloc(result.graph.block_count + 1, sizeof(bool));
+
+    result.function_timings = (FunctionTiming*)malloc(result.get_function_count() * sizeof(FunctionTiming));
+    for (u64 f = 0; f < result.get_function_count(); f++)
+    {
+        auto timing = &result.function_timings[f];
+        timing->is_analyzed = false;
+        timing->is_in_progress = false;
+        timing->returns = false;
+        timing->cycles = CycleRange::make(0, 0);
+        if (f == result.functions.size)
+        {
+            timing->name = String::allocate();
+            timing->name.push("(program)");
+            timing->entry = 0;
+        }
+        else
+        {
+            timing->name = result.functions.data[f].name;
+            timing->entry = result.graph.get_block_of(result.functions.data[f].begin);
+        }
+    }
+
+    if (result.graph.block_count != 0)
+    {
+        result.run();
+    }
+    return result;
+}
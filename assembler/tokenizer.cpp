@@ -4,16 +4,82 @@ enum TokenType
     TokenTypeInteger,
     TokenTypeNewLine,
     TokenTypeColon,
+    TokenTypeDirective,
+    TokenTypeComma,
+    TokenTypeOpenParenthesis,
+    TokenTypeCloseParenthesis,
+    TokenTypeOperator,
 };
 
+enum OperatorType
+{
+    OperatorTypePlus,
+    OperatorTypeMinus,
+    OperatorTypeMultiply,
+    OperatorTypeDivide,
+    OperatorTypeModulo,
+    OperatorTypeAnd,
+    OperatorTypeOr,
+    OperatorTypeXor,
+    OperatorTypeNot,
+    OperatorTypeShiftLeft,
+    OperatorTypeShiftRight,
+    OperatorTypeEqual,
+    OperatorTypeNotEqual,
+    OperatorTypeLess,
+    OperatorTypeLessOrEqual,
+    OperatorTypeGreater,
+    OperatorTypeGreaterOrEqual,
+};
+
+struct OperatorSpelling
+{
+    const char* spelling;
+    OperatorType type;
+};
+
+// two character operators go first so that `<<` isn't read as two `<`
+const OperatorSpelling OPERATOR_SPELLINGS[] = {
+    {"<<", OperatorTypeShiftLeft},
+    {">>", OperatorTypeShiftRight},
+    {"==", OperatorTypeEqual},
+    {"!=", OperatorTypeNotEqual},
+    {"<=", OperatorTypeLessOrEqual},
+    {">=", OperatorTypeGreaterOrEqual},
+    {"+", OperatorTypePlus},
+    {"-", OperatorTypeMinus},
+    {"*", OperatorTypeMultiply},
+    {"/", OperatorTypeDivide},
+    {"%", OperatorTypeModulo},
+    {"&", OperatorTypeAnd},
+    {"|", OperatorTypeOr},
+    {"^", OperatorTypeXor},
+    {"~", OperatorTypeNot},
+    {"<", OperatorTypeLess},
+    {">", OperatorTypeGreater},
+};
+
+const char* get_operator_spelling(OperatorType type)
+{
+    for (u64 i = 0; i < sizeof(OPERATOR_SPELLINGS) / sizeof(OPERATOR_SPELLINGS[0]); i++)
+    {
+        if (OPERATOR_SPELLINGS[i].type == type)
+        {
+            return OPERATOR_SPELLINGS[i].spelling;
+        }
+    }
+    return "?";
+}
+
 struct Token
 {
     TokenType type;
     u64 line;
     union
     {
-        String name;
-        u8 integer;
+        String name; // also the name of a directive, without the dot
+        s64 integer;
+        OperatorType operator_type;
     };
 
     // DEBUG
@@ -26,7 +92,7 @@ struct Token
                 name.print();
                 break;
             case TokenTypeInteger:
-                printf("Integer %hhu", integer);
+                printf("Integer %lld", (long long)integer);
                 break;
             case TokenTypeNewLine:
                 printf("NewLine");
@@ -34,6 +100,22 @@ struct Token
             case TokenTypeColon:
                 printf("Colon");
                 break;
+            case TokenTypeDirective:
+                printf("Directive .");
+                name.print();
+                break;
+            case TokenTypeComma:
+                printf("Comma");
+                break;
+            case TokenTypeOpenParenthesis:
+                printf("OpenParenthesis");
+                break;
+            case TokenTypeCloseParenthesis:
+                printf("CloseParenthesis");
+                break;
+            case TokenTypeOperator:
+                printf("Operator %s", get_operator_spelling(operator_type));
+                break;
         }
     }
 };
@@ -101,6 +183,26 @@ bool is_digit(char c)
     return c >= '0' && c <= '9';
 }
 
+// returns 16 for characters that aren't hexadecimal digits
+u64 get_digit_value(char c)
+{
+    if (c >= '0' && c <= '9')
+    {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f')
+    {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F')
+    {
+        return c - 'A' + 10;
+    }
+    return 16;
+}
+
+const s64 MAX_INTEGER_LITERAL = 0xFFFFFFFF; // anything bigger can't be meant for an 8-bit machine
+
 struct TokenizationState
 {
     String source;
@@ -160,31 +262,33 @@ struct TokenizationState
         return true;
     }
 
+    // negative numbers are a unary minus in front of an integer, see parse_expression
     bool tokenize_integer()
     {
-        if ((source_index > source.size-2 || source.data[source_index] != '-' || !is_digit(source.data[source_index+1]))
-            && (source_index == source.size || !is_digit(source.data[source_index])))
+        if (source_index == source.size || !is_digit(source.data[source_index]))
         {
             return false;
         }
 
-        bool is_negative = source.data[source_index] == '-';
-        if (is_negative)
+        u64 base = 10;
+        if (source.data[source_index] == '0' && source_index + 2 < source.size
+            && (source.data[source_index+1] == 'x' || source.data[source_index+1] == 'b')
+            && get_digit_value(source.data[source_index+2]) < (source.data[source_index+1] == 'x' ? 16u : 2u))
         {
-            source_index++;
+            base = source.data[source_index+1] == 'x' ? 16 : 2;
+            source_index += 2;
         }
 
-        u8 integer = 0;
+        s64 integer = 0;
         do
         {
-            integer = integer * 10 + source.data[source_index] - '0';
+            integer = integer * base + get_digit_value(source.data[source_index]);
             source_index++;
-        } while (source_index != source.size && is_digit(source.data[source_index]));
-
-        if (is_negative)
-        {
-            integer = ~integer + 1;
-        }
+            if (integer > MAX_INTEGER_LITERAL)
+            {
+                return false;
+            }
+        } while (source_index != source.size && get_digit_value(source.data[source_index]) < base);
 
         Token integer_token;
         integer_token.type = TokenTypeInteger;
@@ -236,12 +340,77 @@ struct TokenizationState
         source_index++;
         return true;
     }
+
+    bool tokenize_directive()
+    {
+        if (source_index + 1 >= source.size || source.data[source_index] != '.'
+            || !is_valid_first_name_char(source.data[source_index+1]))
+        {
+            return false;
+        }
+        source_index++;
+        if (!tokenize_name())
+        {
+            return false;
+        }
+        tokens.data[tokens.size-1].type = TokenTypeDirective;
+        return true;
+    }
+
+    bool tokenize_parenthesis()
+    {
+        if (source_index == source.size || source.data[source_index] != '(' && source.data[source_index] != ')')
+        {
+            return false;
+        }
+        Token parenthesis_token;
+        parenthesis_token.type = source.data[source_index] == '(' ? TokenTypeOpenParenthesis : TokenTypeCloseParenthesis;
+        parenthesis_token.line = line;
+        tokens.push(parenthesis_token);
+        source_index++;
+        return true;
+    }
+
+    bool tokenize_operator()
+    {
+        for (u64 i = 0; i < sizeof(OPERATOR_SPELLINGS) / sizeof(OPERATOR_SPELLINGS[0]); i++)
+        {
+            auto spelling = OPERATOR_SPELLINGS[i].spelling;
+            auto length = strlen(spelling);
+            if (source_index + length <= source.size && strncmp(source.data + source_index, spelling, length) == 0)
+            {
+                Token operator_token;
+                operator_token.type = TokenTypeOperator;
+                operator_token.line = line;
+                operator_token.operator_type = OPERATOR_SPELLINGS[i].type;
+                tokens.push(operator_token);
+                source_index += length;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool tokenize_comma()
+    {
+        if (source_index == source.size || source.data[source_index] != ',')
+        {
+            return false;
+        }
+        Token comma_token;
+        comma_token.type = TokenTypeComma;
+        comma_token.line = line;
+        tokens.push(comma_token);
+        source_index++;
+        return true;
+    }
 };
 
 struct TokenizationResult
 {
     bool success;
     Tokens tokens;
+    u64 error_line;
 };
 
 TokenizationResult tokenize(String source)
@@ -261,6 +430,10 @@ TokenizationResult tokenize(String source)
                 || state.tokenize_integer()
                 || state.tokenize_newline()
                 || state.tokenize_colon()
+                || state.tokenize_directive()
+                || state.tokenize_comma()
+                || state.tokenize_parenthesis()
+                || state.tokenize_operator()
         )
         {
             continue;
@@ -268,6 +441,7 @@ TokenizationResult tokenize(String source)
 
         TokenizationResult result;
         result.success = false;
+        result.error_line = state.line;
         return result;
     }
 
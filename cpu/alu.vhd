@@ -3,10 +3,20 @@ use IEEE.std_logic_1164.all;
 use IEEE.numeric_std.all;
 
 entity alu is
+    -- the assembler works out how deep the stacks of a program get, see stack_analyzer.cpp
+    generic (
+        evaluation_stack_depth : natural := 256;
+        general_stack_depth : natural := 256
+    );
+
     port (
         clock : in STD_ULOGIC;
+        reset : in STD_ULOGIC := '0'; -- synchronous, starts over at address 0 with empty stacks
         instruction : in STD_ULOGIC_VECTOR(7 downto 0);
-        next_instruction_address : out STD_ULOGIC_VECTOR(7 downto 0);
+        next_instruction_address : out STD_ULOGIC_VECTOR(15 downto 0);
+        -- the ROM byte at data_address, for `romload`
+        data : in STD_ULOGIC_VECTOR(7 downto 0);
+        data_address : out STD_ULOGIC_VECTOR(15 downto 0);
         output_0 : out STD_ULOGIC
     );
 end alu;
@@ -15,127 +25,386 @@ architecture alu_architecture of alu is
     type T_FLAGS_REGISTER is ('l', 'e', 'g');
     signal flags_register : T_FLAGS_REGISTER;
 
-    signal instruction_register : STD_ULOGIC_VECTOR(7 downto 0) := "00000000";
+    -- The ROM reads synchronously: the byte at next_instruction_address is on `instruction` one cycle later.
+    -- fetch_address runs one byte ahead of instruction_register, the address of the byte being executed, so
+    -- the next byte is always on its way. A jump sends fetch_address to its target instead, which gets there a
+    -- cycle later, and the byte after the jump that arrives in between is thrown away. The ROM starts out with
+    -- the byte at address 0 already read.
+    signal instruction_register : STD_ULOGIC_VECTOR(15 downto 0) := (others => '0');
+    signal fetch_address : STD_ULOGIC_VECTOR(15 downto 0) := (0 => '1', others => '0');
+    signal is_flushing : STD_ULOGIC := '0';
+    -- `romload` waits a cycle for the data port in the same way
+    signal is_awaiting_data : STD_ULOGIC := '0';
+
+    -- jumps and `romload` stay in the page (256 bytes) they are in, unless `far` right before them took another
+    -- one off of the stack, see address_relaxation.cpp
+    signal far_page : STD_ULOGIC_VECTOR(7 downto 0) := "00000000";
+    signal is_far_pending : STD_ULOGIC := '0';
+    signal page : STD_ULOGIC_VECTOR(7 downto 0);
 
-    signal evaluation_stack : work.types.T_MEMORY(255 downto 0) := (others => "00000000");
+    -- The top two values of the evaluation stack are in registers and the rest is in a block RAM, which always
+    -- has the two values below them read out, so an instruction can take up to two values off of the stack in a
+    -- single cycle. A push moves the second value into the RAM. The general stack is all in a block RAM with its
+    -- top two values read out. The RAMs read on the clock edge, so they get the sizes the stacks will have after
+    -- it, from what the byte on `instruction` does to them.
     signal evaluation_stack_size : integer := 0;
+    signal evaluation_stack_change : integer range -2 to 1;
+    signal evaluation_next_size : integer;
+    signal evaluation_top : STD_ULOGIC_VECTOR(7 downto 0) := "00000000";
+    signal evaluation_second : STD_ULOGIC_VECTOR(7 downto 0) := "00000000";
+    signal evaluation_third : STD_ULOGIC_VECTOR(7 downto 0);
+    signal evaluation_fourth : STD_ULOGIC_VECTOR(7 downto 0);
+    signal evaluation_third_address : natural range 0 to evaluation_stack_depth - 1;
+    signal evaluation_fourth_address : natural range 0 to evaluation_stack_depth - 1;
+    signal evaluation_write_enable : STD_ULOGIC;
 
-    signal general_stack : work.types.T_MEMORY(255 downto 0) := (others => "00000000");
     signal general_stack_size : integer := 0;
+    signal general_stack_change : integer range -2 to 1;
+    signal general_next_size : integer;
+    signal general_top : STD_ULOGIC_VECTOR(7 downto 0);
+    signal general_second : STD_ULOGIC_VECTOR(7 downto 0);
+    signal general_top_address : natural range 0 to general_stack_depth - 1;
+    signal general_second_address : natural range 0 to general_stack_depth - 1;
+    signal general_write_enable : STD_ULOGIC;
+    signal general_write_data : STD_ULOGIC_VECTOR(7 downto 0);
 
     signal is_awaiting_second_byte : STD_ULOGIC := '0';
+    signal is_awaiting_third_byte : STD_ULOGIC := '0';
     -- TODO: rename to previous_byte
     signal previous_instruction : STD_ULOGIC_VECTOR(7 downto 0) := "00000000";
 
+    -- the page of a jump with an inline target, taken with its opcode
+    signal jump_page : STD_ULOGIC_VECTOR(7 downto 0) := "00000000";
+    -- the address after the `call` or `call_wide` that is executing, from its opcode or from its target
+    signal return_address : STD_ULOGIC_VECTOR(15 downto 0);
+
+    -- the top two values multiplied for `mul` and `mulh`, in a DSP slice instead of LUTs
+    signal product : unsigned(15 downto 0);
+    attribute use_dsp : string;
+    attribute use_dsp of product : signal is "yes";
+
     signal output_0_register : STD_ULOGIC := '0';
+
+    -- set once `halt` executes, for testbenches to stop the simulation
+    signal is_halted : STD_ULOGIC := '0';
+
+    -- whether a jump is taken with these flags, by its condition: jl, jle, jeq, jge, jg, jne or jmp in the
+    -- low bits of its opcode, counted from jl
+    function is_taken(condition : unsigned(7 downto 0); flags : T_FLAGS_REGISTER) return boolean is
+    begin
+        case to_integer(condition) is
+            when 0 => return flags = 'l';
+            when 1 => return flags = 'l' or flags = 'e';
+            when 2 => return flags = 'e';
+            when 3 => return flags = 'e' or flags = 'g';
+            when 4 => return flags = 'g';
+            when 5 => return flags /= 'e';
+            when others => return true;
+        end case;
+    end function;
 begin
-    next_instruction_address <= instruction_register;
+    next_instruction_address <= fetch_address;
+    return_address <= std_ulogic_vector(unsigned(instruction_register) + 1) when is_awaiting_second_byte = '1'
+        else std_ulogic_vector(unsigned(instruction_register) + 2);
+    page <= far_page when is_far_pending = '1' else instruction_register(15 downto 8);
+    product <= unsigned(evaluation_second) * unsigned(evaluation_top);
+    data_address <= page & evaluation_top;
     output_0 <= output_0_register;
 
-    process (clock) begin
+    -- what the byte on `instruction` does to the sizes of the stacks, the process below moves the values to match
+    process (all) begin
+        evaluation_stack_change <= 0;
+        general_stack_change <= 0;
+        general_write_data <= evaluation_top;
+        if is_flushing = '1' or is_awaiting_data = '1' or is_awaiting_third_byte = '1' then
+            null;
+        elsif is_awaiting_second_byte = '1' then
+            -- push
+            if previous_instruction = "00000001" then
+                evaluation_stack_change <= 1;
+            -- call and call_wide, the offset of the return address
+            elsif previous_instruction = "00101101" or previous_instruction = "00101111" then
+                general_stack_change <= 1;
+                general_write_data <= return_address(7 downto 0);
+            -- cmp_jl to cmp_jne
+            elsif unsigned(previous_instruction) >= 21 and unsigned(previous_instruction) <= 26 then
+                evaluation_stack_change <= -1;
+            end if;
+        else
+            case to_integer(unsigned(instruction)) is
+                -- pop, add, jl to jmp, ddup, far, sub to shr, mul and mulh
+                when 2 | 3 | 5 to 11 | 15 | 20 | 34 to 39 | 43 | 44 =>
+                    evaluation_stack_change <= -1;
+                -- cmp and out
+                when 4 | 13 =>
+                    evaluation_stack_change <= -2;
+                -- dup and push_nothing
+                when 12 | 14 =>
+                    evaluation_stack_change <= 1;
+                -- store
+                when 16 =>
+                    evaluation_stack_change <= -1;
+                    general_stack_change <= 1;
+                -- load
+                when 17 =>
+                    evaluation_stack_change <= 1;
+                    general_stack_change <= -1;
+                -- ret
+                when 46 =>
+                    general_stack_change <= -1;
+                -- call_wide, the page of the return address goes below its offset a cycle early
+                when 47 =>
+                    general_stack_change <= 1;
+                    general_write_data <= return_address(15 downto 8);
+                -- ret_wide
+                when 48 =>
+                    general_stack_change <= -2;
+                when others =>
+                    null;
+            end case;
+        end if;
+    end process;
+
+    evaluation_next_size <= 0 when reset = '1' else evaluation_stack_size + evaluation_stack_change;
+    general_next_size <= 0 when reset = '1' else general_stack_size + general_stack_change;
+
+    -- the second value goes to the address the third one is read from after the push
+    evaluation_write_enable <= '1' when reset = '0' and evaluation_stack_change = 1 and evaluation_stack_size >= 2 else '0';
+    evaluation_third_address <= (evaluation_next_size - 3) mod evaluation_stack_depth;
+    evaluation_fourth_address <= (evaluation_next_size - 4) mod evaluation_stack_depth;
+    evaluation_stack_ram : entity work.stack_ram
+        generic map (depth => evaluation_stack_depth)
+        port map (
+            clock => clock,
+            address => evaluation_third_address,
+            write_enable => evaluation_write_enable,
+            write_data => evaluation_second,
+            output => evaluation_third,
+            second_address => evaluation_fourth_address,
+            second_output => evaluation_fourth
+        );
+
+    general_write_enable <= '1' when reset = '0' and general_stack_change = 1 else '0';
+    general_top_address <= (general_next_size - 1) mod general_stack_depth;
+    general_second_address <= (general_next_size - 2) mod general_stack_depth;
+    general_stack_ram : entity work.stack_ram
+        generic map (depth => general_stack_depth)
+        port map (
+            clock => clock,
+            address => general_top_address,
+            write_enable => general_write_enable,
+            write_data => general_write_data,
+            output => general_top,
+            second_address => general_second_address,
+            second_output => general_second
+        );
+
+    process (clock)
+        procedure jump_to(target : STD_ULOGIC_VECTOR(15 downto 0)) is
+        begin
+            fetch_address <= target;
+            is_flushing <= '1';
+        end procedure;
+
+        -- the second value goes into the RAM
+        procedure push_evaluation(value : STD_ULOGIC_VECTOR(7 downto 0)) is
+        begin
+            evaluation_top <= value;
+            evaluation_second <= evaluation_top;
+        end procedure;
+
+        -- the values below come up out of the RAM
+        procedure pop_evaluation(count : natural) is
+        begin
+            if count = 1 then
+                evaluation_top <= evaluation_second;
+                evaluation_second <= evaluation_third;
+            else
+                evaluation_top <= evaluation_third;
+                evaluation_second <= evaluation_fourth;
+            end if;
+        end procedure;
+
+        -- the top two values replaced with value
+        procedure replace_top_two(value : STD_ULOGIC_VECTOR(7 downto 0)) is
+        begin
+            evaluation_top <= value;
+            evaluation_second <= evaluation_third;
+        end procedure;
+    begin
         if rising_edge(clock) then
-            instruction_register <= std_ulogic_vector(unsigned(instruction_register) + 1);
-
-            if is_awaiting_second_byte = '0' then
-                -- push
-                if instruction = "00000001" then
-                    is_awaiting_second_byte <= '1';
-                    previous_instruction <= instruction;
-                -- pop
-                elsif instruction = "00000010" then
-                    evaluation_stack_size <= evaluation_stack_size - 1;
-                -- add
-                elsif instruction = "00000011" then
-                    evaluation_stack(evaluation_stack_size-2) <= std_ulogic_vector(unsigned(evaluation_stack(evaluation_stack_size-2)) + unsigned(evaluation_stack(evaluation_stack_size-1)));
-                    evaluation_stack_size <= evaluation_stack_size - 1;
-                -- cmp
-                elsif instruction = "00000100" then
-                    if evaluation_stack(evaluation_stack_size-2) < evaluation_stack(evaluation_stack_size-1) then
-                        flags_register <= 'l';
-                    elsif evaluation_stack(evaluation_stack_size-2) > evaluation_stack(evaluation_stack_size-1) then
-                        flags_register <= 'g';
-                    else
-                        flags_register <= 'e';
-                    end if;
-                    evaluation_stack_size <= evaluation_stack_size - 2;
-                -- jl
-                elsif instruction = "00000101" then
-                    if flags_register = 'l' then
-                        instruction_register <= evaluation_stack(evaluation_stack_size - 1);
-                    end if;
-                    evaluation_stack_size <= evaluation_stack_size - 1;
-                -- jle
-                elsif instruction = "00000110" then
-                    if flags_register = 'l' or flags_register = 'e' then
-                        instruction_register <= evaluation_stack(evaluation_stack_size - 1);
-                    end if;
-                    evaluation_stack_size <= evaluation_stack_size - 1;
-                -- jeq
-                elsif instruction = "00000111" then
-                    if flags_register = 'e' then
-                        instruction_register <= evaluation_stack(evaluation_stack_size - 1);
-                    end if;
-                    evaluation_stack_size <= evaluation_stack_size - 1;
-                -- jge
-                elsif instruction = "00001000" then
-                    if flags_register = 'e' or flags_register = 'g' then
-                        instruction_register <= evaluation_stack(evaluation_stack_size - 1);
-                    end if;
-                    evaluation_stack_size <= evaluation_stack_size - 1;
-                -- jg
-                elsif instruction = "00001001" then
-                    if flags_register = 'g' then
-                        instruction_register <= evaluation_stack(evaluation_stack_size - 1);
+            evaluation_stack_size <= evaluation_next_size;
+            general_stack_size <= general_next_size;
+
+            if reset = '1' then
+                -- what the ROM has read while the cpu was held in reset is thrown away like after a jump
+                instruction_register <= (others => '0');
+                fetch_address <= (others => '0');
+                is_flushing <= '1';
+                is_awaiting_data <= '0';
+                is_far_pending <= '0';
+                is_awaiting_second_byte <= '0';
+                is_awaiting_third_byte <= '0';
+                output_0_register <= '0';
+                is_halted <= '0';
+            else
+                instruction_register <= fetch_address;
+                fetch_address <= std_ulogic_vector(unsigned(fetch_address) + 1);
+
+                if is_flushing = '1' then
+                    is_flushing <= '0';
+                elsif is_awaiting_data = '1' then
+                    evaluation_top <= data;
+                    is_awaiting_data <= '0';
+                elsif is_awaiting_second_byte = '0' and is_awaiting_third_byte = '0' then
+                    is_far_pending <= '0';
+                    -- push
+                    if instruction = "00000001" then
+                        is_awaiting_second_byte <= '1';
+                        previous_instruction <= instruction;
+                    -- pop
+                    elsif instruction = "00000010" then
+                        pop_evaluation(1);
+                    -- add
+                    elsif instruction = "00000011" then
+                        replace_top_two(std_ulogic_vector(unsigned(evaluation_second) + unsigned(evaluation_top)));
+                    -- cmp
+                    elsif instruction = "00000100" then
+                        if evaluation_second < evaluation_top then
+                            flags_register <= 'l';
+                        elsif evaluation_second > evaluation_top then
+                            flags_register <= 'g';
+                        else
+                            flags_register <= 'e';
+                        end if;
+                        pop_evaluation(2);
+                    -- jl to jmp
+                    elsif unsigned(instruction) >= 5 and unsigned(instruction) <= 11 then
+                        if is_taken(unsigned(instruction) - 5, flags_register) then
+                            jump_to(page & evaluation_top);
+                        end if;
+                        pop_evaluation(1);
+                    -- dup
+                    elsif instruction = "00001100" then
+                        push_evaluation(evaluation_top);
+                    -- out
+                    elsif instruction = "00001101" then
+                        if evaluation_second = "00000000" then
+                            output_0_register <= evaluation_top(0);
+                        end if;
+                        pop_evaluation(2);
+                    -- push_nothing
+                    elsif instruction = "00001110" then
+                        push_evaluation("00000000");
+                    -- ddup
+                    elsif instruction = "00001111" then
+                        replace_top_two(evaluation_top);
+                    -- store, the general stack gets the top value
+                    elsif instruction = "00010000" then
+                        pop_evaluation(1);
+                    -- load
+                    elsif instruction = "00010001" then
+                        push_evaluation(general_top);
+                    -- halt
+                    elsif instruction = "00010010" then
+                        -- jumps to itself, so it keeps executing `halt`
+                        jump_to(instruction_register);
+                        is_halted <= '1';
+                    -- romload
+                    elsif instruction = "00010011" then
+                        -- the ROM reads the byte in this cycle and has it in the next one, which fetches the byte
+                        -- after `romload` again
+                        is_awaiting_data <= '1';
+                        fetch_address <= fetch_address;
+                    -- far
+                    elsif instruction = "00010100" then
+                        far_page <= evaluation_top;
+                        is_far_pending <= '1';
+                        pop_evaluation(1);
+                    -- sub
+                    elsif instruction = "00100010" then
+                        replace_top_two(std_ulogic_vector(unsigned(evaluation_second) - unsigned(evaluation_top)));
+                    -- and
+                    elsif instruction = "00100011" then
+                        replace_top_two(evaluation_second and evaluation_top);
+                    -- or
+                    elsif instruction = "00100100" then
+                        replace_top_two(evaluation_second or evaluation_top);
+                    -- xor
+                    elsif instruction = "00100101" then
+                        replace_top_two(evaluation_second xor evaluation_top);
+                    -- shl, shifts by 8 or more leave 0
+                    elsif instruction = "00100110" then
+                        replace_top_two(std_ulogic_vector(shift_left(unsigned(evaluation_second), to_integer(unsigned(evaluation_top)))));
+                    -- shr, shifts in zeros
+                    elsif instruction = "00100111" then
+                        replace_top_two(std_ulogic_vector(shift_right(unsigned(evaluation_second), to_integer(unsigned(evaluation_top)))));
+                    -- mul, the low byte of the product
+                    elsif instruction = "00101011" then
+                        replace_top_two(std_ulogic_vector(product(7 downto 0)));
+                    -- mulh, the high byte
+                    elsif instruction = "00101100" then
+                        replace_top_two(std_ulogic_vector(product(15 downto 8)));
+                    -- not
+                    elsif instruction = "00101000" then
+                        evaluation_top <= not evaluation_top;
+                    -- neg
+                    elsif instruction = "00101001" then
+                        evaluation_top <= std_ulogic_vector(0 - unsigned(evaluation_top));
+                    -- eqz, leaves the flags alone
+                    elsif instruction = "00101010" then
+                        if evaluation_top = "00000000" then
+                            evaluation_top <= "00000001";
+                        else
+                            evaluation_top <= "00000000";
+                        end if;
+                    -- ret, back to the offset on the general stack in its own page
+                    elsif instruction = "00101110" then
+                        jump_to(page & general_top);
+                    -- ret_wide, to the whole address, the page below the offset
+                    elsif instruction = "00110000" then
+                        jump_to(general_second & general_top);
+                    -- cmp_jl to cmp_jne, jl to jmp with an inline target, call and call_wide
+                    elsif unsigned(instruction) >= 21 and unsigned(instruction) <= 33
+                        or instruction = "00101101" or instruction = "00101111" then
+                        is_awaiting_second_byte <= '1';
+                        previous_instruction <= instruction;
+                        jump_page <= page;
                     end if;
-                    evaluation_stack_size <= evaluation_stack_size - 1;
-                -- jne
-                elsif instruction = "00001010" then
-                    if flags_register /= 'e' then
-                        instruction_register <= evaluation_stack(evaluation_stack_size - 1);
+                    -- there is a definition for a no-op instruction,
+                    -- but in the implementation everything that isn't a valid instruction
+                    -- is interpreted as a no-op as well
+                elsif is_awaiting_second_byte = '1' then -- handle the second byte
+                    -- push
+                    if previous_instruction = "00000001" then
+                        push_evaluation(instruction);
+                    -- call and call_wide, the general stack gets the return address
+                    elsif previous_instruction = "00101101" or previous_instruction = "00101111" then
+                        jump_to(jump_page & instruction);
+                    -- cmp_jl to cmp_jne: compares like `push <byte>, cmp`, the target comes next
+                    elsif unsigned(previous_instruction) <= 26 then
+                        if evaluation_top < instruction then
+                            flags_register <= 'l';
+                        elsif evaluation_top > instruction then
+                            flags_register <= 'g';
+                        else
+                            flags_register <= 'e';
+                        end if;
+                        pop_evaluation(1);
+                        is_awaiting_third_byte <= '1';
+                    -- jl to jmp with an inline target
+                    else
+                        if is_taken(unsigned(previous_instruction) - 27, flags_register) then
+                            jump_to(jump_page & instruction);
+                        end if;
                     end if;
-                    evaluation_stack_size <= evaluation_stack_size - 1;
-                -- jmp
-                elsif instruction = "00001011" then
-                    instruction_register <= evaluation_stack(evaluation_stack_size - 1);
-                    evaluation_stack_size <= evaluation_stack_size - 1;
-                -- dup
-                elsif instruction = "00001100" then
-                    evaluation_stack(evaluation_stack_size) <= evaluation_stack(evaluation_stack_size-1);
-                    evaluation_stack_size <= evaluation_stack_size + 1;
-                -- out
-                elsif instruction = "00001101" then
-                    if evaluation_stack(evaluation_stack_size-2) = "00000000" then
-                        output_0_register <= evaluation_stack(evaluation_stack_size-1)(0);
+                    is_awaiting_second_byte <= '0';
+                else -- the target of cmp_jl to cmp_jne, the flags are already set
+                    if is_taken(unsigned(previous_instruction) - 21, flags_register) then
+                        jump_to(jump_page & instruction);
                     end if;
-                    evaluation_stack_size <= evaluation_stack_size - 2;
-                -- push_nothing
-                elsif instruction = "00001110" then
-                    evaluation_stack_size <= evaluation_stack_size + 1;
-                -- ddup
-                elsif instruction = "00001111" then
-                    evaluation_stack(evaluation_stack_size-2) <= evaluation_stack(evaluation_stack_size-1);
-                    evaluation_stack_size <= evaluation_stack_size - 1;
-                -- store
-                elsif instruction = "00010000" then
-                    general_stack(general_stack_size) <= evaluation_stack(evaluation_stack_size - 1);
-                    general_stack_size <= general_stack_size + 1;
-                    evaluation_stack_size <= evaluation_stack_size - 1;
-                -- load
-                elsif instruction = "00010001" then
-                    evaluation_stack(evaluation_stack_size) <= general_stack(general_stack_size - 1);
-                    evaluation_stack_size <= evaluation_stack_size + 1;
-                    general_stack_size <= general_stack_size - 1;
+                    is_awaiting_third_byte <= '0';
                 end if;
-                -- there is a definition for a no-op instruction,
-                -- but in the implementation everything that isn't a valid instruction
-                -- is interpreted as a no-op as well
-            else -- handle the second byte
-                -- push
-                if previous_instruction = "00000001" then
-                    evaluation_stack(evaluation_stack_size) <= instruction;
-                    evaluation_stack_size <= evaluation_stack_size + 1;
-                end if;
-                is_awaiting_second_byte <= '0';
             end if;
         end if;
     end process;
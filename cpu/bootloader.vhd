@@ -0,0 +1,97 @@
+library IEEE;
+use IEEE.std_logic_1164.all;
+use IEEE.numeric_std.all;
+
+-- Receives a program over the serial input and writes it into the program RAM, see `--output-format serial`
+-- in the assembler. A frame is the sync byte A5, the size of the code minus 1 as two bytes, high byte first,
+-- the code and a checksum that makes the size bytes, the code and itself sum up to 0, so a program can fill
+-- all 64 KiB. The cpu is held in reset from the sync byte on, and only starts the new program from address 0
+-- once the checksum matches. A frame with a wrong checksum leaves the cpu in reset until a good one arrives,
+-- since part of the old program is overwritten already.
+entity bootloader is
+    generic (clocks_per_bit : positive);
+
+    port (
+        clock : in STD_ULOGIC;
+        serial_input : in STD_ULOGIC;
+        write_enable : out STD_ULOGIC;
+        write_address : out STD_ULOGIC_VECTOR(15 downto 0);
+        write_data : out STD_ULOGIC_VECTOR(7 downto 0);
+        is_loading : out STD_ULOGIC
+    );
+end bootloader;
+
+architecture bootloader_architecture of bootloader is
+    constant FRAME_SYNC : STD_ULOGIC_VECTOR(7 downto 0) := x"A5";
+
+    type T_BOOTLOADER_STATE is (
+        waiting_for_sync,
+        receiving_size_high,
+        receiving_size_low,
+        receiving_code,
+        receiving_checksum
+    );
+    signal state : T_BOOTLOADER_STATE := waiting_for_sync;
+
+    signal byte : STD_ULOGIC_VECTOR(7 downto 0);
+    signal is_byte_valid : STD_ULOGIC;
+
+    signal size_high : unsigned(7 downto 0) := (others => '0');
+    signal remaining_bytes : natural range 0 to 65536 := 0;
+    signal address : unsigned(15 downto 0) := (others => '0');
+    signal checksum : unsigned(7 downto 0) := (others => '0');
+
+    -- the program the RAM starts with runs right away
+    signal is_loading_register : STD_ULOGIC := '0';
+begin
+    uart_receiver_instance : entity work.uart_receiver
+        generic map (clocks_per_bit => clocks_per_bit)
+        port map (
+            clock => clock,
+            serial_input => serial_input,
+            data => byte,
+            is_valid => is_byte_valid
+        );
+
+    is_loading <= is_loading_register;
+
+    process (clock) begin
+        if rising_edge(clock) then
+            write_enable <= '0';
+
+            if is_byte_valid = '1' then
+                case state is
+                    when waiting_for_sync =>
+                        if byte = FRAME_SYNC then
+                            is_loading_register <= '1';
+                            state <= receiving_size_high;
+                        end if;
+                    when receiving_size_high =>
+                        size_high <= unsigned(byte);
+                        checksum <= unsigned(byte);
+                        state <= receiving_size_low;
+                    when receiving_size_low =>
+                        remaining_bytes <= to_integer(size_high & unsigned(byte)) + 1;
+                        checksum <= checksum + unsigned(byte);
+                        address <= (others => '0');
+                        state <= receiving_code;
+                    when receiving_code =>
+                        write_enable <= '1';
+                        write_address <= std_ulogic_vector(address);
+                        write_data <= byte;
+                        address <= address + 1;
+                        checksum <= checksum + unsigned(byte);
+                        remaining_bytes <= remaining_bytes - 1;
+                        if remaining_bytes = 1 then
+                            state <= receiving_checksum;
+                        end if;
+                    when receiving_checksum =>
+                        if checksum + unsigned(byte) = 0 then
+                            is_loading_register <= '0';
+                        end if;
+                        state <= waiting_for_sync;
+                end case;
+            end if;
+        end if;
+    end process;
+end bootloader_architecture;
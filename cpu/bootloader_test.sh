@@ -0,0 +1,9 @@
+set -ex
+
+# `./bootloader_test.sh ../assembler/samples/4.asm -O` loads a program over the serial input, without
+# arguments it loads the default program
+../assembler/run.sh > program.vhd
+../assembler/main.bin "$@" --output-format serial > program.serial
+ghdl -a --std=08 types.vhd program.vhd rom.vhd rom_file.vhd uart_receiver.vhd bootloader.vhd program_ram.vhd stack_ram.vhd alu.vhd cpu.vhd bootloader_test.vhd
+ghdl -e --std=08 bootloader_test
+ghdl -r --std=08 bootloader_test --wave=bootloader_wave.ghw
@@ -0,0 +1,82 @@
+library IEEE;
+use IEEE.std_logic_1164.all;
+use IEEE.numeric_std.all;
+
+-- Stands in for the host: streams a frame written by the assembler with `--output-format serial` into the
+-- bootloader over the serial input, checks that the bootloader accepted it and that every byte of the code
+-- ended up in the program RAM, then reports when the loaded program changes output_0 for run_time.
+entity bootloader_test is
+    generic (
+        frame_file : string := "program.serial";
+        run_time : time := 500 us
+    );
+end bootloader_test;
+
+architecture bootloader_test_architecture of bootloader_test is
+    constant CLOCK_PERIOD : time := 10 ns;
+    constant CLOCKS_PER_BIT : positive := 16; -- far faster than a real baud rate, to keep the simulation short
+
+    signal clock : STD_ULOGIC := '0';
+    signal serial_input : STD_ULOGIC := '1';
+    signal output_0 : STD_ULOGIC;
+begin
+    cpu_instance : entity work.cpu
+        generic map (
+            has_bootloader => true,
+            clocks_per_bit => CLOCKS_PER_BIT
+        )
+        port map (
+            clock => clock,
+            serial_input => serial_input,
+            output_0 => output_0
+        );
+
+    clock <= not clock after CLOCK_PERIOD / 2;
+
+    host : process
+        type T_BYTE_FILE is file of character;
+        file frame : T_BYTE_FILE open read_mode is frame_file;
+        alias is_loading is << signal .bootloader_test.cpu_instance.is_loading : STD_ULOGIC >>;
+        alias memory is << signal .bootloader_test.cpu_instance.rom_instance.program_ram_instance.memory
+            : work.types.T_MEMORY(0 to 65535) >>;
+        variable c : character;
+        variable byte : STD_ULOGIC_VECTOR(7 downto 0);
+        -- the sync byte, the two size bytes, up to 64 KiB of code and the checksum
+        variable sent : work.types.T_MEMORY(0 to 65539);
+        variable byte_count : natural := 0;
+        variable code_size : natural;
+    begin
+        wait for 10 * CLOCK_PERIOD; -- the line idles high
+        while not endfile(frame) loop
+            read(frame, c);
+            byte := std_ulogic_vector(to_unsigned(character'pos(c), 8));
+            serial_input <= '0'; -- start bit
+            wait for CLOCKS_PER_BIT * CLOCK_PERIOD;
+            for i in 0 to 7 loop
+                serial_input <= byte(i);
+                wait for CLOCKS_PER_BIT * CLOCK_PERIOD;
+            end loop;
+            serial_input <= '1'; -- stop bit
+            wait for CLOCKS_PER_BIT * CLOCK_PERIOD;
+            sent(byte_count) := byte;
+            byte_count := byte_count + 1;
+        end loop;
+        report "Sent " & integer'image(byte_count) & " bytes";
+
+        assert is_loading = '0' report "The bootloader didn't accept the frame" severity failure;
+        code_size := to_integer(unsigned(sent(1)) & unsigned(sent(2))) + 1;
+        for i in 0 to code_size - 1 loop
+            assert memory(i) = sent(3 + i)
+                report "Byte " & integer'image(i) & " of the code isn't in the program RAM"
+                severity failure;
+        end loop;
+        report "Loaded " & integer'image(code_size) & " bytes";
+
+        wait for run_time;
+        std.env.finish;
+    end process;
+
+    monitor : process (output_0) begin
+        report "output_0 = " & STD_ULOGIC'image(output_0);
+    end process;
+end bootloader_test_architecture;
@@ -2,29 +2,102 @@ library IEEE;
 use IEEE.std_logic_1164.all;
 
 entity cpu is
+    generic (
+        -- empty for the program in program.vhd, otherwise a file written by the assembler with `--output-format mem`
+        rom_init_file : string := "";
+        -- the program is kept in a RAM that bootloader.vhd writes, starting out with the program in program.vhd
+        has_bootloader : boolean := false;
+        clocks_per_bit : positive := 868 -- 115200 baud at 100 MHz
+    );
+
     port (
         clock : in STD_ULOGIC;
+        serial_input : in STD_ULOGIC := '1';
         output_0 : out STD_ULOGIC
     );
 end cpu;
 
 architecture cpu_architecture of cpu is
     signal instruction : STD_ULOGIC_VECTOR(7 downto 0) := (others => '0');
-    signal instruction_address : STD_ULOGIC_VECTOR(7 downto 0) := "00000000";
+    signal instruction_address : STD_ULOGIC_VECTOR(15 downto 0) := (others => '0');
+    signal data : STD_ULOGIC_VECTOR(7 downto 0) := (others => '0');
+    signal data_address : STD_ULOGIC_VECTOR(15 downto 0) := (others => '0');
+
+    signal write_enable : STD_ULOGIC := '0';
+    signal write_address : STD_ULOGIC_VECTOR(15 downto 0) := (others => '0');
+    signal write_data : STD_ULOGIC_VECTOR(7 downto 0) := "00000000";
+    signal is_loading : STD_ULOGIC := '0';
 
     constant code : work.types.T_MEMORY := work.program.code;
+
+    -- a program loaded from a file or over the serial input can change without resynthesis,
+    -- so it gets stacks of the full size
+    function get_stack_depth(program_stack_depth : natural) return natural is
+    begin
+        if rom_init_file = "" and not has_bootloader then
+            return program_stack_depth;
+        end if;
+        return 256;
+    end function;
 begin
-    rom_instance : entity work.rom
-        generic map (code => code)
-        port map (
-            address => instruction_address,
-            output => instruction
-        );
+    rom_instance : if has_bootloader generate
+        program_ram_instance : entity work.program_ram
+            generic map (code => code)
+            port map (
+                clock => clock,
+                address => instruction_address,
+                output => instruction,
+                data_address => data_address,
+                data_output => data,
+                write_enable => write_enable,
+                write_address => write_address,
+                write_data => write_data
+            );
+
+        bootloader_instance : entity work.bootloader
+            generic map (clocks_per_bit => clocks_per_bit)
+            port map (
+                clock => clock,
+                serial_input => serial_input,
+                write_enable => write_enable,
+                write_address => write_address,
+                write_data => write_data,
+                is_loading => is_loading
+            );
+    elsif rom_init_file = "" generate
+        program_rom_instance : entity work.rom
+            generic map (code => code)
+            port map (
+                clock => clock,
+                address => instruction_address,
+                output => instruction,
+                data_address => data_address,
+                data_output => data
+            );
+    else generate
+        file_rom_instance : entity work.rom_file
+            generic map (init_file => rom_init_file)
+            port map (
+                clock => clock,
+                address => instruction_address,
+                output => instruction,
+                data_address => data_address,
+                data_output => data
+            );
+    end generate;
 
-    alu_instance : entity work.alu port map (
+    alu_instance : entity work.alu
+        generic map (
+            evaluation_stack_depth => get_stack_depth(work.program.evaluation_stack_depth),
+            general_stack_depth => get_stack_depth(work.program.general_stack_depth)
+        )
+        port map (
         clock => clock,
+        reset => is_loading,
         instruction => instruction,
         next_instruction_address => instruction_address,
+        data => data,
+        data_address => data_address,
         output_0 => output_0
     );
 end cpu_architecture;
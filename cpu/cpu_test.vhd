@@ -1,14 +1,40 @@
 library IEEE;
 use IEEE.std_logic_1164.all;
+use IEEE.numeric_std.all;
+use std.textio.all;
 
 entity cpu_test is
+    -- `ghdl -r cpu_test -grom_init_file=program.mem` runs a new program without analyzing anything again,
+    -- `-gprofile_path=profile.txt` writes a profile for `--profile` in the assembler
+    generic (
+        rom_init_file : string := "";
+        profile_path : string := ""
+    );
 end cpu_test;
 
 architecture cpu_test_architecture of cpu_test is
     signal clock : STD_ULOGIC := '0';
 begin
     cpu_instance : entity work.cpu
+        generic map (rom_init_file => rom_init_file)
         port map (clock => clock);
 
     clock <= not clock after 5 ns;
+
+    -- the address of the byte the cpu consumes in every cycle it executes one, for `--profile` in the assembler;
+    -- the cycles after jumps and `romload` don't consume a byte
+    profiling : if profile_path /= "" generate
+        profile : process (clock)
+            file profile_file : text open write_mode is profile_path;
+            variable profile_line : line;
+            alias instruction_register is << signal .cpu_test.cpu_instance.alu_instance.instruction_register : STD_ULOGIC_VECTOR(15 downto 0) >>;
+            alias is_flushing is << signal .cpu_test.cpu_instance.alu_instance.is_flushing : STD_ULOGIC >>;
+            alias is_awaiting_data is << signal .cpu_test.cpu_instance.alu_instance.is_awaiting_data : STD_ULOGIC >>;
+        begin
+            if rising_edge(clock) and is_flushing = '0' and is_awaiting_data = '0' then
+                write(profile_line, to_integer(unsigned(instruction_register)));
+                writeline(profile_file, profile_line);
+            end if;
+        end process;
+    end generate;
 end cpu_test_architecture;
@@ -0,0 +1,8 @@
+set -ex
+
+# `./halt_test.sh ../assembler/samples/5.asm -O` runs a program until it executes `halt`
+../assembler/run.sh > /dev/null
+../assembler/main.bin "$@" --testbench halt_test.vhd > program.vhd
+ghdl -a --std=08 types.vhd program.vhd rom.vhd rom_file.vhd uart_receiver.vhd bootloader.vhd program_ram.vhd stack_ram.vhd alu.vhd cpu.vhd halt_test.vhd
+ghdl -e --std=08 halt_test
+ghdl -r --std=08 halt_test
@@ -127,4 +127,6 @@ package program is
         b"00010001",
         b"00001011"
     );
+    constant evaluation_stack_depth : natural := 256;
+    constant general_stack_depth : natural := 256;
 end program;
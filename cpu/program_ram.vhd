@@ -0,0 +1,58 @@
+library ieee;
+use ieee.std_logic_1164.all;
+use ieee.numeric_std_unsigned.all;
+
+-- Takes the place of rom.vhd when the cpu has a bootloader: read the same way, written by the bootloader.
+-- The bootloader only writes while it holds the cpu in reset, so writes share the second port with `romload`
+-- and the memory fits in a dual port block RAM.
+entity program_ram is
+    generic (code : work.types.T_MEMORY); -- what the RAM holds at power-on
+
+    port (
+        clock : in STD_ULOGIC;
+        address : in STD_ULOGIC_VECTOR(15 downto 0);
+        output : out STD_ULOGIC_VECTOR(7 downto 0);
+        data_address : in STD_ULOGIC_VECTOR(15 downto 0);
+        data_output : out STD_ULOGIC_VECTOR(7 downto 0);
+        write_enable : in STD_ULOGIC;
+        write_address : in STD_ULOGIC_VECTOR(15 downto 0);
+        write_data : in STD_ULOGIC_VECTOR(7 downto 0)
+    );
+end program_ram;
+
+architecture program_ram_architecture of program_ram is
+    -- the whole address space like rom_file.vhd, a frame from the bootloader can fill all of it
+    constant SIZE : natural := 65536;
+
+    function initialize(code : work.types.T_MEMORY) return work.types.T_MEMORY is
+        variable result : work.types.T_MEMORY(0 to SIZE - 1) := (others => "00000000");
+    begin
+        for i in 0 to code'length - 1 loop
+            result(i) := code(code'low + i);
+        end loop;
+        return result;
+    end function;
+
+    signal memory : work.types.T_MEMORY(0 to SIZE - 1) := initialize(code);
+    signal output_register : STD_ULOGIC_VECTOR(7 downto 0) := initialize(code)(0);
+    signal data_output_register : STD_ULOGIC_VECTOR(7 downto 0) := "00000000";
+begin
+    output <= output_register;
+    data_output <= data_output_register;
+
+    process (clock) begin
+        if rising_edge(clock) then
+            output_register <= memory(to_integer(address));
+        end if;
+    end process;
+
+    process (clock) begin
+        if rising_edge(clock) then
+            if write_enable = '1' then
+                memory(to_integer(write_address)) <= write_data;
+            else
+                data_output_register <= memory(to_integer(data_address));
+            end if;
+        end if;
+    end process;
+end program_ram_architecture;
@@ -7,12 +7,33 @@ entity rom is
     generic (code : work.types.T_MEMORY);
 
     port (
-        address : in STD_ULOGIC_VECTOR(7 downto 0);
-        output : out STD_ULOGIC_VECTOR(7 downto 0)
+        clock : in STD_ULOGIC;
+        address : in STD_ULOGIC_VECTOR(15 downto 0);
+        output : out STD_ULOGIC_VECTOR(7 downto 0) := code(code'low);
+        -- a second read port for `romload`
+        data_address : in STD_ULOGIC_VECTOR(15 downto 0);
+        data_output : out STD_ULOGIC_VECTOR(7 downto 0) := "00000000"
     );
 end rom;
 
+-- Both ports read on the clock edge, so the ROM becomes a block RAM instead of LUTs, see alu.vhd for how the
+-- cpu waits for it. The output starts out with the first byte.
 architecture rom_architecture of rom is
 begin
-    output <= code(to_integer(address));
+    process (clock) begin
+        if rising_edge(clock) then
+            -- the byte after the last one is read ahead as well
+            if to_integer(address) <= code'high then
+                output <= code(to_integer(address));
+            else
+                output <= "00000000";
+            end if;
+            -- whatever is on top of the stack, not only the addresses `romload` is used with
+            if to_integer(data_address) <= code'high then
+                data_output <= code(to_integer(data_address));
+            else
+                data_output <= "00000000";
+            end if;
+        end if;
+    end process;
 end rom_architecture;
@@ -0,0 +1,56 @@
+library ieee;
+use ieee.std_logic_1164.all;
+use ieee.numeric_std.all;
+use ieee.numeric_std_unsigned.all;
+use std.textio.all;
+
+-- The same as rom.vhd, but the code is read from a file written by the assembler with `--output-format mem`
+-- when the design is elaborated, so a new program only needs a testbench rerun or a memory update of the
+-- bitstream instead of a resynthesis. Lines starting with '@' or '/' are skipped, the rest of the ROM is nop.
+-- It reads on the clock edge like rom.vhd.
+entity rom_file is
+    generic (init_file : string);
+
+    port (
+        clock : in STD_ULOGIC;
+        address : in STD_ULOGIC_VECTOR(15 downto 0);
+        output : out STD_ULOGIC_VECTOR(7 downto 0);
+        -- a second read port for `romload`
+        data_address : in STD_ULOGIC_VECTOR(15 downto 0);
+        data_output : out STD_ULOGIC_VECTOR(7 downto 0)
+    );
+end rom_file;
+
+architecture rom_file_architecture of rom_file is
+    impure function read_code(path : string) return work.types.T_MEMORY is
+        file code_file : text open read_mode is path;
+        variable code_line : line;
+        variable value : STD_ULOGIC_VECTOR(7 downto 0);
+        variable result : work.types.T_MEMORY(0 to 65535) := (others => "00000000");
+        variable i : natural := 0;
+    begin
+        while not endfile(code_file) and i <= result'high loop
+            readline(code_file, code_line);
+            if code_line'length /= 0 and code_line(code_line'left) /= '@' and code_line(code_line'left) /= '/' then
+                hread(code_line, value);
+                result(i) := value;
+                i := i + 1;
+            end if;
+        end loop;
+        return result;
+    end function;
+
+    constant code : work.types.T_MEMORY(0 to 65535) := read_code(init_file);
+    signal output_register : STD_ULOGIC_VECTOR(7 downto 0) := code(0);
+    signal data_output_register : STD_ULOGIC_VECTOR(7 downto 0) := "00000000";
+begin
+    output <= output_register;
+    data_output <= data_output_register;
+
+    process (clock) begin
+        if rising_edge(clock) then
+            output_register <= code(to_integer(address));
+            data_output_register <= code(to_integer(data_address));
+        end if;
+    end process;
+end rom_file_architecture;
@@ -0,0 +1,35 @@
+library ieee;
+use ieee.std_logic_1164.all;
+
+-- A stack kept in a block RAM for alu.vhd. Both ports read on the clock edge: the first one at the address it
+-- writes, with the byte it writes coming out right away, the second one only reads. The alu points them at
+-- the entries it needs in the next cycle.
+entity stack_ram is
+    generic (depth : positive);
+
+    port (
+        clock : in STD_ULOGIC;
+        address : in natural range 0 to depth - 1;
+        write_enable : in STD_ULOGIC;
+        write_data : in STD_ULOGIC_VECTOR(7 downto 0);
+        output : out STD_ULOGIC_VECTOR(7 downto 0) := "00000000";
+        second_address : in natural range 0 to depth - 1;
+        second_output : out STD_ULOGIC_VECTOR(7 downto 0) := "00000000"
+    );
+end stack_ram;
+
+architecture stack_ram_architecture of stack_ram is
+    signal memory : work.types.T_MEMORY(depth - 1 downto 0) := (others => "00000000");
+begin
+    process (clock) begin
+        if rising_edge(clock) then
+            if write_enable = '1' then
+                memory(address) <= write_data;
+                output <= write_data;
+            else
+                output <= memory(address);
+            end if;
+            second_output <= memory(second_address);
+        end if;
+    end process;
+end stack_ram_architecture;
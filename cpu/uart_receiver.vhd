@@ -0,0 +1,81 @@
+library IEEE;
+use IEEE.std_logic_1164.all;
+
+-- 8N1 serial input: a low start bit, 8 data bits with the least significant one first and a high stop bit.
+-- Every bit is sampled in its middle, a byte whose stop bit isn't high is dropped.
+entity uart_receiver is
+    generic (clocks_per_bit : positive);
+
+    port (
+        clock : in STD_ULOGIC;
+        serial_input : in STD_ULOGIC;
+        data : out STD_ULOGIC_VECTOR(7 downto 0);
+        is_valid : out STD_ULOGIC -- high for one cycle for every byte
+    );
+end uart_receiver;
+
+architecture uart_receiver_architecture of uart_receiver is
+    type T_RECEIVER_STATE is (idle, start_bit, data_bits, stop_bit);
+    signal state : T_RECEIVER_STATE := idle;
+
+    -- the input isn't synchronous to the clock
+    signal synchronized_input : STD_ULOGIC_VECTOR(1 downto 0) := "11";
+
+    signal clock_count : natural range 0 to clocks_per_bit - 1 := 0;
+    signal bit_index : natural range 0 to 7 := 0;
+    signal shift_register : STD_ULOGIC_VECTOR(7 downto 0) := "00000000";
+begin
+    process (clock)
+        variable input : STD_ULOGIC;
+    begin
+        if rising_edge(clock) then
+            synchronized_input <= synchronized_input(0) & serial_input;
+            input := synchronized_input(1);
+            is_valid <= '0';
+
+            case state is
+                when idle =>
+                    if input = '0' then
+                        clock_count <= 0;
+                        state <= start_bit;
+                    end if;
+                when start_bit =>
+                    -- half a bit later, in the middle of the start bit
+                    if clock_count = (clocks_per_bit - 1) / 2 then
+                        clock_count <= 0;
+                        bit_index <= 0;
+                        if input = '0' then
+                            state <= data_bits;
+                        else
+                            state <= idle; -- just a glitch
+                        end if;
+                    else
+                        clock_count <= clock_count + 1;
+                    end if;
+                when data_bits =>
+                    if clock_count = clocks_per_bit - 1 then
+                        clock_count <= 0;
+                        shift_register <= input & shift_register(7 downto 1);
+                        if bit_index = 7 then
+                            state <= stop_bit;
+                        else
+                            bit_index <= bit_index + 1;
+                        end if;
+                    else
+                        clock_count <= clock_count + 1;
+                    end if;
+                when stop_bit =>
+                    if clock_count = clocks_per_bit - 1 then
+                        clock_count <= 0;
+                        state <= idle;
+                        if input = '1' then
+                            data <= shift_register;
+                            is_valid <= '1';
+                        end if;
+                    else
+                        clock_count <= clock_count + 1;
+                    end if;
+            end case;
+        end if;
+    end process;
+end uart_receiver_architecture;
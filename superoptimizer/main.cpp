@@ -0,0 +1,761 @@
+// Offline superoptimizer for straight-line code.
+// Enumerates every sequence of up to --length instructions over pop, add, cmp, dup, ddup, store, load and
+// `push` of a few constants, cheapest first, and finds the sequences that do exactly the same thing to
+// the evaluation stack, the general stack and the flags as a strictly cheaper one.
+// Those pairs are written out as a rewrite database that `asm --rewrites <file>` applies during optimization.
+//
+// Pruning: a sequence that contains a shorter rewritable sequence is never looked at, since that smaller
+// rewrite already covers it. Fingerprinting: every sequence is run on a handful of fixed inputs and only
+// sequences with the same fingerprint are compared properly, exhaustively when at most three input values
+// are live and on 65536 random inputs otherwise. A replacement never reaches deeper into either stack than
+// its pattern, since the values below the pattern's aren't known to exist where it's applied.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+
+#include "../assembler/common.cpp"
+
+enum InstructionType
+{
+    InstructionTypePop,
+    InstructionTypeAdd,
+    InstructionTypeCmp,
+    InstructionTypeDup,
+    InstructionTypeDdup,
+    InstructionTypeStore,
+    InstructionTypeLoad,
+    InstructionTypePush,
+};
+
+const char* INSTRUCTION_NAMES[] = {"pop", "add", "cmp", "dup", "ddup", "store", "load", "push"};
+
+struct Instruction
+{
+    InstructionType type;
+    u8 integer; // only for push
+
+    u64 get_size()
+    {
+        return type == InstructionTypePush ? 2 : 1;
+    }
+};
+
+const u64 MAX_CONSTANTS = 16;
+const u64 MAX_INSTRUCTIONS = InstructionTypePush + MAX_CONSTANTS;
+const u64 MAX_SEQUENCE_LENGTH = 12; // sequences are encoded in 64 bits, 5 bits per instruction
+const u64 EVALUATION_INPUTS = 4;
+const u64 GENERAL_INPUTS = 2;
+const u64 MACHINE_STACK_SIZE = EVALUATION_INPUTS + 2 * MAX_SEQUENCE_LENGTH;
+const u64 FINGERPRINT_INPUTS = 8;
+const u64 MAX_EXHAUSTIVE_LIVE_INPUTS = 3;
+const u64 RANDOM_VERIFICATION_INPUTS = 65536;
+
+enum Flags : u8
+{
+    FlagsLess,
+    FlagsEqual,
+    FlagsGreater,
+};
+
+struct Machine
+{
+    u8 evaluation_stack[MACHINE_STACK_SIZE];
+    u64 evaluation_size;
+    u8 general_stack[MACHINE_STACK_SIZE];
+    u64 general_size;
+    u8 flags;
+    u64 lowest_evaluation_access; // how deep into the inputs the code reached
+    u64 lowest_general_access;
+
+    static Machine make(u8* inputs, u8 flags)
+    {
+        Machine result;
+        memcpy(result.evaluation_stack, inputs, EVALUATION_INPUTS);
+        result.evaluation_size = EVALUATION_INPUTS;
+        memcpy(result.general_stack, inputs + EVALUATION_INPUTS, GENERAL_INPUTS);
+        result.general_size = GENERAL_INPUTS;
+        result.flags = flags;
+        result.lowest_evaluation_access = EVALUATION_INPUTS;
+        result.lowest_general_access = GENERAL_INPUTS;
+        return result;
+    }
+
+    // false if the code needs more values than there are inputs
+    bool touch(u64 evaluation_count, u64 general_count)
+    {
+        if (evaluation_count > evaluation_size || general_count > general_size)
+        {
+            return false;
+        }
+        if (evaluation_size - evaluation_count < lowest_evaluation_access)
+        {
+            lowest_evaluation_access = evaluation_size - evaluation_count;
+        }
+        if (general_size - general_count < lowest_general_access)
+        {
+            lowest_general_access = general_size - general_count;
+        }
+        return true;
+    }
+
+    bool execute(Instruction instruction)
+    {
+        auto stack = evaluation_stack;
+        switch (instruction.type)
+        {
+            case InstructionTypePop:
+                if (!touch(1, 0)) return false;
+                evaluation_size--;
+                return true;
+            case InstructionTypeAdd:
+                if (!touch(2, 0)) return false;
+                stack[evaluation_size-2] += stack[evaluation_size-1];
+                evaluation_size--;
+                return true;
+            case InstructionTypeCmp:
+            {
+                if (!touch(2, 0)) return false;
+                auto a = stack[evaluation_size-2];
+                auto b = stack[evaluation_size-1];
+                flags = a < b ? FlagsLess : a > b ? FlagsGreater : FlagsEqual;
+                evaluation_size -= 2;
+                return true;
+            }
+            case InstructionTypeDup:
+                if (!touch(1, 0)) return false;
+                stack[evaluation_size] = stack[evaluation_size-1];
+                evaluation_size++;
+                return true;
+            case InstructionTypeDdup:
+                if (!touch(2, 0)) return false;
+                stack[evaluation_size-2] = stack[evaluation_size-1];
+                evaluation_size--;
+                return true;
+            case InstructionTypeStore:
+                if (!touch(1, 0)) return false;
+                general_stack[general_size++] = stack[--evaluation_size];
+                return true;
+            case InstructionTypeLoad:
+                if (!touch(0, 1)) return false;
+                stack[evaluation_size++] = general_stack[--general_size];
+                return true;
+            case InstructionTypePush:
+                stack[evaluation_size++] = instruction.integer;
+                return true;
+        }
+        return false;
+    }
+
+    bool operator==(Machine other)
+    {
+        return evaluation_size == other.evaluation_size
+            && general_size == other.general_size
+            && flags == other.flags
+            && memcmp(evaluation_stack, other.evaluation_stack, evaluation_size) == 0
+            && memcmp(general_stack, other.general_stack, general_size) == 0;
+    }
+
+    u64 hash(u64 seed)
+    {
+        auto result = seed ^ (evaluation_size << 8) ^ (general_size << 16) ^ ((u64)flags << 24);
+        for (u64 i = 0; i < evaluation_size; i++)
+        {
+            result = (result ^ evaluation_stack[i]) * 1099511628211ull;
+        }
+        result = (result ^ 0xFF) * 1099511628211ull;
+        for (u64 i = 0; i < general_size; i++)
+        {
+            result = (result ^ general_stack[i]) * 1099511628211ull;
+        }
+        return result;
+    }
+};
+
+struct Sequence
+{
+    u64 length;
+    u8 instructions[MAX_SEQUENCE_LENGTH]; // indices into the alphabet
+
+    // unique for every sequence, 0 is the empty one
+    u64 encode()
+    {
+        u64 result = 0;
+        for (u64 i = 0; i < length; i++)
+        {
+            result = (result << 5) | (instructions[i] + 1);
+        }
+        return result;
+    }
+
+    Sequence slice(u64 begin, u64 end)
+    {
+        Sequence result;
+        result.length = end - begin;
+        memcpy(result.instructions, instructions + begin, result.length);
+        return result;
+    }
+};
+
+// open addressing, 0 is never a valid key since the empty sequence is never stored
+struct U64Set
+{
+    u64 capacity; // always a power of two
+    u64 size;
+    u64* data;
+
+    static U64Set allocate()
+    {
+        U64Set result;
+        result.capacity = 1024;
+        result.size = 0;
+        result.data = (u64*)calloc(result.capacity, sizeof(u64));
+        return result;
+    }
+
+    u64 find_slot(u64 key)
+    {
+        auto index = (key * 11400714819323198485ull) & (capacity - 1);
+        while (data[index] != 0 && data[index] != key)
+        {
+            index = (index + 1) & (capacity - 1);
+        }
+        return index;
+    }
+
+    bool contains(u64 key)
+    {
+        return data[find_slot(key)] == key;
+    }
+
+    void add(u64 key)
+    {
+        if (2 * (size + 1) > capacity)
+        {
+            auto old = *this;
+            capacity *= 2;
+            size = 0;
+            data = (u64*)calloc(capacity, sizeof(u64));
+            for (u64 i = 0; i < old.capacity; i++)
+            {
+                if (old.data[i] != 0)
+                {
+                    add(old.data[i]);
+                }
+            }
+            free(old.data);
+        }
+        auto slot = find_slot(key);
+        if (data[slot] == 0)
+        {
+            data[slot] = key;
+            size++;
+        }
+    }
+};
+
+struct Sequences
+{
+    u64 capacity;
+    u64 size;
+    Sequence* data;
+
+    static Sequences allocate()
+    {
+        Sequences result;
+        result.capacity = 64;
+        result.size = 0;
+        result.data = (Sequence*)malloc(result.capacity * sizeof(Sequence));
+        return result;
+    }
+
+    void push(Sequence sequence)
+    {
+        if (size == capacity)
+        {
+            capacity *= 2;
+            data = (Sequence*)realloc(data, capacity * sizeof(Sequence));
+        }
+        data[size] = sequence;
+        size++;
+    }
+};
+
+struct Rewrite
+{
+    Sequence pattern;
+    Sequence replacement;
+};
+
+struct Rewrites
+{
+    u64 capacity;
+    u64 size;
+    Rewrite* data;
+
+    static Rewrites allocate()
+    {
+        Rewrites result;
+        result.capacity = 64;
+        result.size = 0;
+        result.data = (Rewrite*)malloc(result.capacity * sizeof(Rewrite));
+        return result;
+    }
+
+    void push(Rewrite rewrite)
+    {
+        if (size == capacity)
+        {
+            capacity *= 2;
+            data = (Rewrite*)realloc(data, capacity * sizeof(Rewrite));
+        }
+        data[size] = rewrite;
+        size++;
+    }
+};
+
+// sequences that aren't known to be rewritable, bucketed by fingerprint
+struct MinimalSequence
+{
+    Sequence sequence;
+    u64 fingerprint;
+    u64 next; // in the same bucket, NO_MINIMAL_SEQUENCE at the end
+};
+
+const u64 NO_MINIMAL_SEQUENCE = (u64)-1;
+const u64 FINGERPRINT_BUCKETS = 1 << 16;
+
+struct Superoptimizer
+{
+    Instruction alphabet[MAX_INSTRUCTIONS];
+    u64 alphabet_size;
+    u8 fingerprint_inputs[FINGERPRINT_INPUTS][EVALUATION_INPUTS + GENERAL_INPUTS + 1];
+
+    MinimalSequence* minimal_sequences;
+    u64 minimal_sequence_count;
+    u64 minimal_sequence_capacity;
+    u64* buckets;
+    U64Set rewritable; // encoded sequences that have a cheaper equivalent
+
+    u64 get_size(Sequence sequence)
+    {
+        u64 result = 0;
+        for (u64 i = 0; i < sequence.length; i++)
+        {
+            result += alphabet[sequence.instructions[i]].get_size();
+        }
+        return result;
+    }
+
+    // false if the sequence can't run on the inputs
+    bool run(Sequence sequence, u8* inputs, Machine* machine)
+    {
+        *machine = Machine::make(inputs, inputs[EVALUATION_INPUTS + GENERAL_INPUTS] % 3);
+        for (u64 i = 0; i < sequence.length; i++)
+        {
+            if (!machine->execute(alphabet[sequence.instructions[i]]))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool get_fingerprint(Sequence sequence, u64* fingerprint)
+    {
+        u64 result = 14695981039346656037ull;
+        for (u64 i = 0; i < FINGERPRINT_INPUTS; i++)
+        {
+            Machine machine;
+            if (!run(sequence, fingerprint_inputs[i], &machine))
+            {
+                return false;
+            }
+            result = machine.hash(result);
+        }
+        *fingerprint = result;
+        return true;
+    }
+
+    // whether replacement can stand in for pattern
+    bool are_equivalent(Sequence pattern, Sequence replacement)
+    {
+        // inputs below what the pattern touches pass through unchanged, the replacement mustn't touch them
+        u8 inputs[EVALUATION_INPUTS + GENERAL_INPUTS + 1];
+        Machine pattern_machine;
+        Machine replacement_machine;
+        memcpy(inputs, fingerprint_inputs[0], sizeof(inputs));
+        run(pattern, inputs, &pattern_machine);
+        run(replacement, inputs, &replacement_machine);
+        if (replacement_machine.lowest_evaluation_access < pattern_machine.lowest_evaluation_access
+            || replacement_machine.lowest_general_access < pattern_machine.lowest_general_access)
+        {
+            return false;
+        }
+        auto lowest_evaluation = pattern_machine.lowest_evaluation_access;
+        auto lowest_general = pattern_machine.lowest_general_access;
+
+        u64 live[EVALUATION_INPUTS + GENERAL_INPUTS];
+        u64 live_count = 0;
+        for (auto i = lowest_evaluation; i < EVALUATION_INPUTS; i++)
+        {
+            live[live_count++] = i;
+        }
+        for (auto i = lowest_general; i < GENERAL_INPUTS; i++)
+        {
+            live[live_count++] = EVALUATION_INPUTS + i;
+        }
+
+        u64 random_state = 0x9E3779B97F4A7C15ull;
+        auto is_exhaustive = live_count <= MAX_EXHAUSTIVE_LIVE_INPUTS;
+        auto input_count = is_exhaustive ? (u64)1 << (8 * live_count) : RANDOM_VERIFICATION_INPUTS;
+        for (u64 flags = 0; flags < 3; flags++)
+        {
+            inputs[EVALUATION_INPUTS + GENERAL_INPUTS] = (u8)flags;
+            for (u64 n = 0; n < input_count; n++)
+            {
+                for (u64 i = 0; i < live_count; i++)
+                {
+                    if (is_exhaustive)
+                    {
+                        inputs[live[i]] = (u8)(n >> (8 * i));
+                    }
+                    else
+                    {
+                        random_state ^= random_state << 13;
+                        random_state ^= random_state >> 7;
+                        random_state ^= random_state << 17;
+                        inputs[live[i]] = (u8)random_state;
+                    }
+                }
+                if (!run(pattern, inputs, &pattern_machine) || !run(replacement, inputs, &replacement_machine)
+                    || !(pattern_machine == replacement_machine))
+                {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    bool contains_rewritable(Sequence sequence)
+    {
+        for (u64 length = 1; length < sequence.length; length++)
+        {
+            for (u64 begin = 0; begin + length <= sequence.length; begin++)
+            {
+                if (rewritable.contains(sequence.slice(begin, begin + length).encode()))
+                {
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    // NO_MINIMAL_SEQUENCE if there is no cheaper equivalent
+    u64 find_equivalent(Sequence sequence, u64 fingerprint)
+    {
+        auto index = buckets[fingerprint & (FINGERPRINT_BUCKETS - 1)];
+        while (index != NO_MINIMAL_SEQUENCE)
+        {
+            auto candidate = minimal_sequences[index];
+            if (candidate.fingerprint == fingerprint && are_equivalent(sequence, candidate.sequence))
+            {
+                return index;
+            }
+            index = candidate.next;
+        }
+        return NO_MINIMAL_SEQUENCE;
+    }
+
+    void add_minimal(Sequence sequence, u64 fingerprint)
+    {
+        if (minimal_sequence_count == minimal_sequence_capacity)
+        {
+            minimal_sequence_capacity *= 2;
+            minimal_sequences = (MinimalSequence*)realloc(minimal_sequences, minimal_sequence_capacity * sizeof(MinimalSequence));
+        }
+        auto bucket = &buckets[fingerprint & (FINGERPRINT_BUCKETS - 1)];
+        MinimalSequence minimal;
+        minimal.sequence = sequence;
+        minimal.fingerprint = fingerprint;
+        minimal.next = *bucket;
+        *bucket = minimal_sequence_count;
+        minimal_sequences[minimal_sequence_count] = minimal;
+        minimal_sequence_count++;
+    }
+};
+
+// what one thread found among the sequences of one size
+struct WorkerResult
+{
+    Sequences minimal;
+    Rewrites rewrites;
+};
+
+void search_slice(Superoptimizer* superoptimizer, Sequences* candidates, u64 begin, u64 end, WorkerResult* result)
+{
+    result->minimal = Sequences::allocate();
+    result->rewrites = Rewrites::allocate();
+    for (auto i = begin; i < end; i++)
+    {
+        auto sequence = candidates->data[i];
+        u64 fingerprint;
+        if (superoptimizer->contains_rewritable(sequence) || !superoptimizer->get_fingerprint(sequence, &fingerprint))
+        {
+            continue;
+        }
+        auto equivalent = superoptimizer->find_equivalent(sequence, fingerprint);
+        if (equivalent == NO_MINIMAL_SEQUENCE)
+        {
+            result->minimal.push(sequence);
+            continue;
+        }
+        Rewrite rewrite;
+        rewrite.pattern = sequence;
+        rewrite.replacement = superoptimizer->minimal_sequences[equivalent].sequence;
+        result->rewrites.push(rewrite);
+    }
+}
+
+void print_sequence(Superoptimizer* superoptimizer, Sequence sequence)
+{
+    for (u64 i = 0; i < sequence.length; i++)
+    {
+        auto instruction = superoptimizer->alphabet[sequence.instructions[i]];
+        if (instruction.type == InstructionTypePush)
+        {
+            printf("push %d\n", instruction.integer);
+        }
+        else
+        {
+            printf("%s\n", INSTRUCTION_NAMES[instruction.type]);
+        }
+    }
+}
+
+struct CommandLineOptions
+{
+    u64 max_length;
+    u64 thread_count;
+    u8 constants[MAX_CONSTANTS];
+    u64 constant_count;
+};
+
+CommandLineOptions parse_command_line(s32 argc, char** argv)
+{
+    CommandLineOptions result;
+    result.max_length = 4;
+    result.thread_count = std::thread::hardware_concurrency();
+    if (result.thread_count == 0)
+    {
+        result.thread_count = 1;
+    }
+    u8 default_constants[] = {0, 1, 2, 255};
+    result.constant_count = sizeof(default_constants);
+    memcpy(result.constants, default_constants, sizeof(default_constants));
+
+    for (s32 i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--length") == 0 && i + 1 < argc)
+        {
+            i++;
+            result.max_length = strtoull(argv[i], NULL, 10);
+            if (result.max_length == 0 || result.max_length > MAX_SEQUENCE_LENGTH)
+            {
+                panic("The length has to be between 1 and 12");
+            }
+        }
+        else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+        {
+            i++;
+            result.thread_count = strtoull(argv[i], NULL, 10);
+            if (result.thread_count == 0)
+            {
+                result.thread_count = 1;
+            }
+        }
+        else if (strcmp(argv[i], "--constants") == 0 && i + 1 < argc)
+        {
+            // comma separated, e.g. 0,1,255
+            i++;
+            result.constant_count = 0;
+            auto text = argv[i];
+            while (*text != '\0')
+            {
+                if (result.constant_count == MAX_CONSTANTS)
+                {
+                    panic("Too many constants");
+                }
+                char* end;
+                auto value = strtol(text, &end, 0);
+                if (end == text || value < -128 || value > 255)
+                {
+                    panic("Invalid constant");
+                }
+                result.constants[result.constant_count++] = (u8)value;
+                text = *end == ',' ? end + 1 : end;
+            }
+        }
+        else
+        {
+            printf("Unknown option: %s\n", argv[i]);
+            exit(1);
+        }
+    }
+    return result;
+}
+
+int main(s32 argc, char** argv)
+{
+    auto options = parse_command_line(argc, argv);
+
+    Superoptimizer superoptimizer;
+    superoptimizer.alphabet_size = 0;
+    for (u64 i = 0; i < InstructionTypePush; i++)
+    {
+        Instruction instruction;
+        instruction.type = (InstructionType)i;
+        instruction.integer = 0;
+        superoptimizer.alphabet[superoptimizer.alphabet_size++] = instruction;
+    }
+    for (u64 i = 0; i < options.constant_count; i++)
+    {
+        Instruction instruction;
+        instruction.type = InstructionTypePush;
+        instruction.integer = options.constants[i];
+        superoptimizer.alphabet[superoptimizer.alphabet_size++] = instruction;
+    }
+
+    // fixed inputs, including the edges of the unsigned range
+    u64 random_state = 0x2545F4914F6CDD1Dull;
+    for (u64 i = 0; i < FINGERPRINT_INPUTS; i++)
+    {
+        for (u64 k = 0; k < EVALUATION_INPUTS + GENERAL_INPUTS + 1; k++)
+        {
+            random_state ^= random_state << 13;
+            random_state ^= random_state >> 7;
+            random_state ^= random_state << 17;
+            superoptimizer.fingerprint_inputs[i][k] = (u8)random_state;
+        }
+    }
+    superoptimizer.fingerprint_inputs[1][EVALUATION_INPUTS-1] = 0;
+    superoptimizer.fingerprint_inputs[2][EVALUATION_INPUTS-1] = 255;
+    superoptimizer.fingerprint_inputs[3][EVALUATION_INPUTS-2] = superoptimizer.fingerprint_inputs[3][EVALUATION_INPUTS-1];
+    for (u64 i = 0; i < 3; i++)
+    {
+        superoptimizer.fingerprint_inputs[i][EVALUATION_INPUTS + GENERAL_INPUTS] = (u8)i;
+    }
+
+    superoptimizer.minimal_sequence_capacity = 1024;
+    superoptimizer.minimal_sequence_count = 0;
+    superoptimizer.minimal_sequences = (MinimalSequence*)malloc(superoptimizer.minimal_sequence_capacity * sizeof(MinimalSequence));
+    superoptimizer.buckets = (u64*)malloc(FINGERPRINT_BUCKETS * sizeof(u64));
+    for (u64 i = 0; i < FINGERPRINT_BUCKETS; i++)
+    {
+        superoptimizer.buckets[i] = NO_MINIMAL_SEQUENCE;
+    }
+    superoptimizer.rewritable = U64Set::allocate();
+
+    // every sequence, bucketed by size so that all cheaper sequences are known before a size is searched
+    auto max_size = 2 * options.max_length;
+    auto by_size = (Sequences*)malloc((max_size + 1) * sizeof(Sequences));
+    for (u64 i = 0; i <= max_size; i++)
+    {
+        by_size[i] = Sequences::allocate();
+    }
+    Sequence sequence;
+    sequence.length = 0;
+    by_size[0].push(sequence);
+    for (u64 length = 1; length <= options.max_length; length++)
+    {
+        sequence.length = length;
+        memset(sequence.instructions, 0, sizeof(sequence.instructions));
+        while (true)
+        {
+            by_size[superoptimizer.get_size(sequence)].push(sequence);
+            u64 digit = 0;
+            while (digit < length && ++sequence.instructions[digit] == superoptimizer.alphabet_size)
+            {
+                sequence.instructions[digit] = 0;
+                digit++;
+            }
+            if (digit == length)
+            {
+                break;
+            }
+        }
+    }
+
+    auto results = (WorkerResult*)malloc(options.thread_count * sizeof(WorkerResult));
+    auto threads = new std::thread[options.thread_count];
+    auto all_rewrites = Rewrites::allocate();
+
+    for (u64 size = 0; size <= max_size; size++)
+    {
+        auto candidates = &by_size[size];
+        auto slice_size = (candidates->size + options.thread_count - 1) / options.thread_count;
+        for (u64 t = 0; t < options.thread_count; t++)
+        {
+            auto begin = t * slice_size < candidates->size ? t * slice_size : candidates->size;
+            auto end = begin + slice_size < candidates->size ? begin + slice_size : candidates->size;
+            threads[t] = std::thread(search_slice, &superoptimizer, candidates, begin, end, &results[t]);
+        }
+        for (u64 t = 0; t < options.thread_count; t++)
+        {
+            threads[t].join();
+        }
+
+        // merged in order, so the output doesn't depend on the number of threads
+        u64 new_rewrites = 0;
+        for (u64 t = 0; t < options.thread_count; t++)
+        {
+            for (u64 i = 0; i < results[t].minimal.size; i++)
+            {
+                u64 fingerprint = 0;
+                superoptimizer.get_fingerprint(results[t].minimal.data[i], &fingerprint);
+                superoptimizer.add_minimal(results[t].minimal.data[i], fingerprint);
+            }
+            for (u64 i = 0; i < results[t].rewrites.size; i++)
+            {
+                superoptimizer.rewritable.add(results[t].rewrites.data[i].pattern.encode());
+                all_rewrites.push(results[t].rewrites.data[i]);
+                new_rewrites++;
+            }
+            free(results[t].minimal.data);
+            free(results[t].rewrites.data);
+        }
+        fprintf(
+            stderr,
+            "Size %llu: %llu sequence(s), %llu rewrite(s)\n",
+            (unsigned long long)size,
+            (unsigned long long)candidates->size,
+            (unsigned long long)new_rewrites
+        );
+    }
+
+    printf("# Generated by the superoptimizer: up to %llu instructions, constants", (unsigned long long)options.max_length);
+    for (u64 i = 0; i < options.constant_count; i++)
+    {
+        printf(" %d", options.constants[i]);
+    }
+    printf("\n# Every rewrite is a pattern, a line with `=>`, its cheaper replacement and an empty line.\n\n");
+    for (u64 i = 0; i < all_rewrites.size; i++)
+    {
+        auto rewrite = all_rewrites.data[i];
+        printf(
+            "# %llu bytes => %llu bytes\n",
+            (unsigned long long)superoptimizer.get_size(rewrite.pattern),
+            (unsigned long long)superoptimizer.get_size(rewrite.replacement)
+        );
+        print_sequence(&superoptimizer, rewrite.pattern);
+        printf("=>\n");
+        print_sequence(&superoptimizer, rewrite.replacement);
+        printf("\n");
+    }
+
+    return 0;
+}
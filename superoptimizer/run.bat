@@ -0,0 +1,4 @@
+@echo off
+
+clang++ -O2 -Werror main.cpp -o main.exe || exit /b
+main %* > ..\assembler\rewrites.txt
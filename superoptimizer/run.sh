@@ -0,0 +1,6 @@
+set -ex
+
+PROJECT_PATH=$(dirname "${BASH_SOURCE[0]}")
+
+clang++ -O2 -Werror -pthread $PROJECT_PATH/main.cpp -o $PROJECT_PATH/main.bin
+$PROJECT_PATH/main.bin "$@" > $PROJECT_PATH/../assembler/rewrites.txt